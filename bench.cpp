@@ -0,0 +1,628 @@
+#include "my_set.h"
+#include "my_btree_set.h"
+#include "my_flat_set.h"
+#include "pool_allocator.h"
+#include "my_concurrent_set.h"
+#include "my_persistent_set.h"
+#include "my_mvcc_set.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+size_t allocated_bytes = 0;
+
+template <typename T>
+struct byte_counting_allocator
+{
+    typedef T value_type;
+
+    byte_counting_allocator() {}
+    template <typename U>
+    byte_counting_allocator(byte_counting_allocator<U> const&) {}
+
+    T* allocate(size_t n)
+    {
+        allocated_bytes += n * sizeof(T);
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, size_t n)
+    {
+        allocated_bytes -= n * sizeof(T);
+        ::operator delete(p);
+    }
+
+    template <typename U>
+    bool operator==(byte_counting_allocator<U> const&) const { return true; }
+    template <typename U>
+    bool operator!=(byte_counting_allocator<U> const&) const { return false; }
+};
+
+// Прежняя раскладка узла (полиморфный BaseNode с vptr) с тем же полем высоты
+struct legacy_base_node
+{
+    legacy_base_node *parent, *left_child, *right_child;
+    int height;
+    virtual ~legacy_base_node() {}
+};
+
+template <typename T>
+struct legacy_node : legacy_base_node
+{
+    T key;
+};
+
+template <typename F>
+double measure_ms(F f)
+{
+    auto start = std::chrono::steady_clock::now();
+    f();
+    auto finish = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(finish - start).count();
+}
+
+template <typename Set, typename Key>
+double bytes_per_element(size_t n)
+{
+    size_t before = allocated_bytes;
+    Set s;
+    for (size_t i = 0; i < n; i++)
+        s.insert(static_cast<Key>(i));
+    return static_cast<double>(allocated_bytes - before) / static_cast<double>(n);
+}
+
+void bench_memory()
+{
+    const size_t n = 1000000;
+    std::printf("== memory per element (%zu keys)\n", n);
+    std::printf("%-28s %10s %10s\n", "container", "legacy", "bytes");
+    std::printf("%-28s %10zu %10.1f\n", "set<int>", sizeof(legacy_node<int>),
+                bytes_per_element<set<int, std::less<int>, byte_counting_allocator<int>>, int>(n));
+    std::printf("%-28s %10zu %10.1f\n", "set<long long>", sizeof(legacy_node<long long>),
+                bytes_per_element<set<long long, std::less<long long>, byte_counting_allocator<long long>>, long long>(n));
+    std::printf("%-28s %10s %10.1f\n", "threaded_set<int>", "-",
+                bytes_per_element<threaded_set<int, std::less<int>, byte_counting_allocator<int>>, int>(n));
+    std::printf("%-28s %10s %10.1f\n", "ranked_set<int>", "-",
+                bytes_per_element<ranked_set<int, std::less<int>, byte_counting_allocator<int>>, int>(n));
+    std::printf("%-28s %10s %10.1f\n", "std::set<int>", "-",
+                bytes_per_element<std::set<int, std::less<int>, byte_counting_allocator<int>>, int>(n));
+
+    set<int> s;
+    for (size_t i = 0; i < n; i++)
+        s.insert(static_cast<int>(i));
+    std::printf("teardown of %zu keys: %.1f ms\n\n", n, measure_ms([&s]() { s.clear(); }));
+}
+
+template <typename Set>
+void bench_lookup_structure(char const* name, std::vector<int> const& keys, std::vector<int> const& queries)
+{
+    Set s;
+    double insert_ms = measure_ms([&]() {
+        for (int x : keys)
+            s.insert(x);
+    });
+
+    size_t found = 0;
+    double find_ms = measure_ms([&]() {
+        for (int x : queries)
+            found += s.find(x) != s.end();
+    });
+
+    long long sum = 0;
+    double scan_ms = measure_ms([&]() {
+        for (int x : s)
+            sum += x;
+    });
+
+    std::printf("%-20s %12.1f %12.1f %12.1f   (found %zu, sum %lld)\n",
+                name, insert_ms, find_ms, scan_ms, found, sum);
+}
+
+void bench_flat_set(std::vector<int> const& keys, std::vector<int> const& queries)
+{
+    // flat_set строится целиком из диапазона: поэлементная вставка в массив квадратична
+    flat_set<int> s;
+    double build_ms = measure_ms([&]() {
+        flat_set<int> built(keys.begin(), keys.end());
+        s.swap(built);
+    });
+
+    size_t found = 0;
+    double find_ms = measure_ms([&]() {
+        for (int x : queries)
+            found += s.find(x) != s.end();
+    });
+
+    long long sum = 0;
+    double scan_ms = measure_ms([&]() {
+        for (int x : s)
+            sum += x;
+    });
+
+    std::printf("%-20s %12.1f %12.1f %12.1f   (found %zu, sum %lld)\n",
+                "flat_set<int>", build_ms, find_ms, scan_ms, found, sum);
+}
+
+void bench_btree(size_t n)
+{
+    std::mt19937 gen(12345);
+    std::vector<int> keys(n), queries(n);
+    for (size_t i = 0; i < n; i++)
+        keys[i] = static_cast<int>(gen());
+    for (size_t i = 0; i < n; i++)
+        queries[i] = i % 2 ? keys[gen() % n] : static_cast<int>(gen());
+
+    std::printf("== binary tree vs B+-tree vs flat array (%zu random int keys, ms)\n", n);
+    std::printf("%-20s %12s %12s %12s\n", "container", "insert", "find", "scan");
+    bench_lookup_structure<set<int>>("set<int>", keys, queries);
+    bench_lookup_structure<btree_set<int>>("btree_set<int>", keys, queries);
+    bench_lookup_structure<std::set<int>>("std::set<int>", keys, queries);
+    bench_flat_set(keys, queries);
+    std::printf("\n");
+}
+
+
+template <typename Set>
+void bench_scan_structure(char const* name, std::vector<int> const& keys, std::vector<int> const& starts)
+{
+    // Ключи вставляются в случайном порядке, поэтому соседние по порядку узлы
+    // разбросаны по памяти
+    Set s;
+    for (int x : keys)
+        s.insert(x);
+
+    const int rounds = 5;
+    long long sum = 0;
+    double forward_ms = measure_ms([&]() {
+        for (int r = 0; r < rounds; r++)
+            for (auto it = s.begin(); it != s.end(); ++it)
+                sum += *it;
+    }) / rounds;
+    double backward_ms = measure_ms([&]() {
+        for (int r = 0; r < rounds; r++)
+            for (auto it = s.rbegin(); it != s.rend(); ++it)
+                sum += *it;
+    }) / rounds;
+
+    const int range_length = 1000;
+    double range_ms = measure_ms([&]() {
+        for (int x : starts)
+        {
+            auto it = s.lower_bound(x);
+            for (int i = 0; i < range_length && it != s.end(); i++, ++it)
+                sum += *it;
+        }
+    });
+
+    std::printf("%-20s %12.1f %12.1f %12.1f %12.2f   (sum %lld)\n", name, forward_ms, backward_ms, range_ms,
+                forward_ms * 1e6 / static_cast<double>(s.size()), sum);
+}
+
+void bench_scan(size_t n)
+{
+    std::mt19937 gen(777);
+    std::vector<int> keys(n), starts(n / 1000 + 1);
+    for (size_t i = 0; i < n; i++)
+        keys[i] = static_cast<int>(gen());
+    for (size_t i = 0; i < starts.size(); i++)
+        starts[i] = static_cast<int>(gen());
+
+    std::printf("== full and range scans (%zu random int keys, ms; %zu ranges of 1000 keys)\n", n, starts.size());
+    std::printf("%-20s %12s %12s %12s %12s\n", "container", "forward", "backward", "ranges", "ns/elem");
+    bench_scan_structure<set<int>>("set<int>", keys, starts);
+    bench_scan_structure<threaded_set<int>>("threaded_set<int>", keys, starts);
+    bench_scan_structure<std::set<int>>("std::set<int>", keys, starts);
+    std::printf("\n");
+}
+
+void bench_parallel_build(size_t n)
+{
+    std::mt19937 gen(4242);
+    std::vector<int> keys(n);
+    for (size_t i = 0; i < n; i++)
+        keys[i] = static_cast<int>(gen());
+
+    std::printf("== bulk construction from unsorted input (%zu random int keys, %u hardware threads)\n",
+                n, std::thread::hardware_concurrency());
+    std::printf("%-28s %12s %12s\n", "method", "ms", "speedup");
+    size_t size = 0;
+    double sequential_ms = measure_ms([&]() {
+        set<int> s;
+        for (int x : keys)
+            s.insert(x);
+        size = s.size();
+    });
+    std::printf("%-28s %12.1f %12.2f   (size %zu)\n", "insert one by one", sequential_ms, 1.0, size);
+    for (unsigned threads : {1u, 2u, 4u, 8u})
+    {
+        double ms = measure_ms([&]() {
+            set<int> s(parallel_build, keys.begin(), keys.end(), threads);
+            size = s.size();
+        });
+        char name[32];
+        std::snprintf(name, sizeof(name), "parallel_build, %u threads", threads);
+        std::printf("%-28s %12.1f %12.2f   (size %zu)\n", name, ms, sequential_ms / ms, size);
+    }
+    std::printf("\n");
+}
+
+void bench_parallel_scan(size_t n)
+{
+    std::mt19937 gen(4343);
+    std::vector<int> keys(n);
+    for (size_t i = 0; i < n; i++)
+        keys[i] = static_cast<int>(gen() % 1000000000);
+    set<int> s(parallel_build, keys.begin(), keys.end());
+    const int lo = 250000000, hi = 750000000;
+
+    std::printf("== reduce over all keys and over [lo, hi) (%zu random int keys, ms)\n", s.size());
+    std::printf("%-28s %12s %12s %12s\n", "method", "all", "range", "speedup");
+    long long sum = 0, range_sum = 0;
+    double serial_ms = measure_ms([&]() {
+        for (int x : s)
+            sum += x;
+    });
+    double serial_range_ms = measure_ms([&]() {
+        for (auto it = s.lower_bound(lo), end = s.lower_bound(hi); it != end; ++it)
+            range_sum += *it;
+    });
+    std::printf("%-28s %12.1f %12.1f %12.2f   (sum %lld, %lld)\n", "iterator loop", serial_ms, serial_range_ms,
+                1.0, sum, range_sum);
+    for (unsigned threads : {1u, 2u, 4u, 8u})
+    {
+        work_stealing_pool pool(threads);
+        auto identity = [](int x) { return static_cast<long long>(x); };
+        double ms = measure_ms([&]() {
+            sum = s.parallel_transform_reduce(0LL, std::plus<long long>(), identity, pool);
+        });
+        double range_ms = measure_ms([&]() {
+            range_sum = s.parallel_transform_reduce(lo, hi, 0LL, std::plus<long long>(), identity, pool);
+        });
+        char name[32];
+        std::snprintf(name, sizeof(name), "parallel, %u threads", threads);
+        std::printf("%-28s %12.1f %12.1f %12.2f   (sum %lld, %lld)\n", name, ms, range_ms, serial_ms / ms,
+                    sum, range_sum);
+    }
+    std::printf("\n");
+}
+
+template <typename Set>
+double mixed_throughput(Set& s, unsigned threads, size_t operations, int range)
+{
+    // 90% поисков, по 5% вставок и удалений; возвращает миллионы операций в секунду
+    std::vector<std::thread> workers;
+    std::atomic<size_t> found(0);
+    double ms = measure_ms([&]() {
+        for (unsigned t = 0; t < threads; t++)
+            workers.emplace_back([&, t]() {
+                std::mt19937 gen(t + 1);
+                size_t hits = 0;
+                for (size_t i = 0; i < operations / threads; i++)
+                {
+                    int x = static_cast<int>(gen() % static_cast<unsigned>(range));
+                    unsigned kind = gen() % 20;
+                    if (kind == 0)
+                        s.insert(x);
+                    else if (kind == 1)
+                        s.erase(x);
+                    else
+                        hits += s.contains(x);
+                }
+                found += hits;
+            });
+        for (auto& worker : workers)
+            worker.join();
+    });
+    return static_cast<double>(operations) / ms / 1000.0;
+}
+
+// set под одним общим мьютексом -- то, что заменяет concurrent_set
+struct locked_set
+{
+    std::mutex lock;
+    set<int> s;
+
+    void insert(int x)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        s.insert(x);
+    }
+
+    void erase(int x)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        s.erase(x);
+    }
+
+    bool contains(int x)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return s.contains(x);
+    }
+};
+
+void bench_concurrent(size_t n)
+{
+    const int range = 1 << 20;
+    std::printf("== concurrent mixed workload (90%% find, 5%% insert, 5%% erase; %zu ops over %d keys, Mops/s)\n",
+                n, range);
+    std::printf("%-28s %12s %12s\n", "threads", "mutex+set", "concurrent");
+    for (unsigned threads : {1u, 2u, 4u, 8u})
+    {
+        locked_set locked;
+        concurrent_set<int> concurrent;
+        for (int x = 0; x < range; x += 2)
+        {
+            locked.s.insert(x);
+            concurrent.insert(x);
+        }
+        double locked_mops = mixed_throughput(locked, threads, n, range);
+        double concurrent_mops = mixed_throughput(concurrent, threads, n, range);
+        std::printf("%-28u %12.2f %12.2f\n", threads, locked_mops, concurrent_mops);
+    }
+    std::printf("\n");
+}
+
+void bench_snapshots(size_t n)
+{
+    // Снимок для отчёта, после которого писатель делает ещё 1000 изменений
+    std::mt19937 gen(4545);
+    std::vector<int> keys(n), updates(1000);
+    for (size_t i = 0; i < n; i++)
+        keys[i] = static_cast<int>(gen());
+    for (auto& x : updates)
+        x = static_cast<int>(gen());
+
+    set<int> s(keys.begin(), keys.end());
+    persistent_set<int> p(keys.begin(), keys.end());
+    std::printf("== snapshot for a reader, then 1000 inserts (%zu random int keys, ms)\n", s.size());
+    std::printf("%-28s %12s %12s\n", "container", "snapshot", "inserts");
+
+    size_t size = 0;
+    double copy_ms = measure_ms([&]() {
+        set<int> copy(s);
+        size = copy.size();
+    });
+    double set_insert_ms = measure_ms([&]() {
+        for (int x : updates)
+            s.insert(x);
+    });
+    std::printf("%-28s %12.3f %12.3f   (size %zu)\n", "set (deep copy)", copy_ms, set_insert_ms, size);
+
+    persistent_set<int> snapshot;
+    double snapshot_ms = measure_ms([&]() {
+        snapshot = p.snapshot();
+    });
+    double path_copy_ms = measure_ms([&]() {
+        for (int x : updates)
+            p.insert(x);
+    });
+    std::printf("%-28s %12.3f %12.3f   (size %zu)\n", "persistent_set", snapshot_ms, path_copy_ms, snapshot.size());
+    std::printf("\n");
+}
+
+
+template <typename Scan, typename Write>
+void readers_during_writes(char const* name, unsigned readers, size_t writes, Scan scan, Write write)
+{
+    // Читатели сканируют, пока писатель делает writes изменений
+    std::atomic<bool> done(false);
+    std::atomic<size_t> scans(0);
+    std::atomic<long> checksum(0);
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < readers; t++)
+        threads.emplace_back([&, t]() {
+            std::mt19937 gen(t + 1);
+            size_t local = 0;
+            long sum = 0;
+            while (!done)
+            {
+                sum += scan(static_cast<int>(gen()));
+                local++;
+            }
+            scans += local;
+            checksum += sum;
+        });
+    std::mt19937 gen(readers + 100);
+    double ms = measure_ms([&]() {
+        for (size_t i = 0; i < writes; i++)
+            write(static_cast<int>(gen()), i % 2 == 0);
+    });
+    done = true;
+    for (auto& thread : threads)
+        thread.join();
+    std::printf("%-28s %8u %12.1f %12.1f\n", name, readers, ms, static_cast<double>(scans) / ms);
+}
+
+void bench_mvcc(size_t n)
+{
+    // Сканы по 100 ключей против одного писателя: set под мьютексом и mvcc_set
+    const size_t writes = 20000;
+    std::mt19937 gen(5656);
+    std::vector<int> keys(n);
+    for (auto& x : keys)
+        x = static_cast<int>(gen());
+    std::printf("== readers scanning 100 keys while one writer makes %zu updates (%zu random int keys)\n", writes, n);
+    std::printf("%-28s %8s %12s %12s\n", "container", "readers", "writer ms", "scans/ms");
+    for (unsigned readers : {1u, 2u, 4u})
+    {
+        std::mutex lock;
+        set<int> locked(keys.begin(), keys.end());
+        readers_during_writes("mutex+set", readers, writes, [&](int from) {
+            std::lock_guard<std::mutex> guard(lock);
+            long sum = 0;
+            auto it = locked.lower_bound(from);
+            for (int i = 0; i < 100 && it != locked.end(); i++, ++it)
+                sum += *it;
+            return sum;
+        }, [&](int x, bool insert) {
+            std::lock_guard<std::mutex> guard(lock);
+            if (insert)
+                locked.insert(x);
+            else
+            {
+                auto it = locked.lower_bound(x);
+                locked.erase(it == locked.end() ? locked.begin() : it);
+            }
+        });
+
+        mvcc_set<int> mvcc(persistent_set<int>(keys.begin(), keys.end()));
+        readers_during_writes("mvcc_set", readers, writes, [&](int from) {
+            auto view = mvcc.read();
+            long sum = 0;
+            auto it = view->lower_bound(from);
+            for (int i = 0; i < 100 && it != view.end(); i++, ++it)
+                sum += *it;
+            return sum;
+        }, [&](int x, bool insert) {
+            if (insert)
+                mvcc.insert(x);
+            else
+                mvcc.update([x](persistent_set<int>& next) {
+                    auto it = next.lower_bound(x);
+                    if (it == next.end())
+                        it = next.begin();
+                    next.erase(*it);
+                });
+        });
+    }
+    std::printf("\n");
+}
+
+
+void bench_batch_lookup(size_t n)
+{
+    // Поиск пачками по 4096 ключей: цикл find против find_batch и lower_bound_batch
+    const size_t batch = 4096;
+    std::mt19937 gen(6767);
+    std::vector<int> keys(n), queries(n);
+    for (size_t i = 0; i < n; i++)
+        keys[i] = static_cast<int>(gen());
+    for (size_t i = 0; i < n; i++)
+        queries[i] = i % 2 ? keys[gen() % n] : static_cast<int>(gen());
+    set<int> s(keys.begin(), keys.end());
+    std::vector<set<int>::const_iterator> results(batch);
+
+    std::printf("== batched lookups (%zu random int keys, %zu queries in batches of %zu, ms)\n", n, n, batch);
+    std::printf("%-28s %12s %12s\n", "method", "time", "found");
+    size_t found = 0;
+    double loop_ms = measure_ms([&]() {
+        for (size_t i = 0; i < n; i += batch)
+        {
+            size_t count = std::min(batch, n - i);
+            for (size_t j = 0; j < count; j++)
+                results[j] = s.find(queries[i + j]);
+            for (size_t j = 0; j < count; j++)
+                found += results[j] != s.end();
+        }
+    });
+    std::printf("%-28s %12.1f %12zu\n", "loop of find", loop_ms, found);
+
+    found = 0;
+    double batch_ms = measure_ms([&]() {
+        for (size_t i = 0; i < n; i += batch)
+        {
+            size_t count = std::min(batch, n - i);
+            s.find_batch(queries.data() + i, queries.data() + i + count, results.begin());
+            for (size_t j = 0; j < count; j++)
+                found += results[j] != s.end();
+        }
+    });
+    std::printf("%-28s %12.1f %12zu\n", "find_batch", batch_ms, found);
+
+    found = 0;
+    double lower_ms = measure_ms([&]() {
+        for (size_t i = 0; i < n; i += batch)
+        {
+            size_t count = std::min(batch, n - i);
+            s.lower_bound_batch(queries.data() + i, queries.data() + i + count, results.begin());
+            for (size_t j = 0; j < count; j++)
+                found += results[j] != s.end();
+        }
+    });
+    std::printf("%-28s %12.1f %12zu\n", "lower_bound_batch", lower_ms, found);
+    std::printf("\n");
+}
+
+
+// std::less без специализации поиска в узле btree_set: обычный бинарный поиск
+template <typename T>
+struct plain_less
+{
+    bool operator()(T const& a, T const& b) const
+    {
+        return a < b;
+    }
+};
+
+template <typename Set, typename Key>
+double btree_find_ms(std::vector<Key> const& keys, std::vector<Key> const& queries, size_t& found)
+{
+    Set s;
+    for (Key x : keys)
+        s.insert(x);
+    found = 0;
+    return measure_ms([&]() {
+        for (Key x : queries)
+            found += s.find(x) != s.end();
+        for (Key x : queries)
+            found += s.lower_bound(x) != s.end();
+    });
+}
+
+template <typename Key>
+void bench_btree_search_key(char const* name, size_t n)
+{
+    std::mt19937_64 gen(7878);
+    std::vector<Key> keys(n), queries(n);
+    for (auto& x : keys)
+        x = static_cast<Key>(gen());
+    for (size_t i = 0; i < n; i++)
+        queries[i] = i % 2 ? keys[gen() % n] : static_cast<Key>(gen());
+    size_t scalar_found = 0, simd_found = 0;
+    double scalar_ms = btree_find_ms<btree_set<Key, plain_less<Key>>>(keys, queries, scalar_found);
+    double simd_ms = btree_find_ms<btree_set<Key>>(keys, queries, simd_found);
+    std::printf("%-28s %12.1f %12.1f   (found %zu / %zu)\n", name, scalar_ms, simd_ms, scalar_found, simd_found);
+}
+
+void bench_btree_search(size_t n)
+{
+    // find и lower_bound по всем запросам; в узле btree_set 64 ключа int32_t или 32 uint64_t
+    std::printf("== btree_set node search (%zu random keys, find + lower_bound, ms)\n", n);
+    std::printf("%-28s %12s %12s\n", "key type", "binary", "simd");
+    bench_btree_search_key<int32_t>("int32_t", n);
+    bench_btree_search_key<uint64_t>("uint64_t", n);
+    std::printf("\n");
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    size_t n = argc > 1 ? static_cast<size_t>(std::atoll(argv[1])) : 1000000;
+
+    bench_memory();
+    bench_btree(n);
+    bench_scan(n);
+    bench_parallel_build(n);
+    bench_parallel_scan(n);
+    bench_concurrent(n);
+    bench_snapshots(n);
+    bench_mvcc(n);
+    bench_batch_lookup(n);
+    bench_btree_search(n);
+    return 0;
+}
@@ -0,0 +1,284 @@
+#ifndef EPOCH_RECLAIM_H
+#define EPOCH_RECLAIM_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Отложенное освобождение памяти по эпохам для структур, которые читают без блокировок.
+// Читатель на время обхода закрепляет текущую эпоху (pin). Объект, уже недостижимый
+// из структуры, откладывается (retire) с номером эпохи и освобождается, когда
+// глобальная эпоха уйдёт на две вперёд: эпоха сдвигается, только если все
+// закреплённые читатели уже видели текущую, так что ни один из них не мог
+// дойти до отложенного объекта. Число одновременно закреплённых guard не
+// ограничено: когда заняты все слоты, добавляется ещё блок слотов
+class epoch_domain
+{
+    static const size_t slot_count = 256;
+    static const size_t collect_period = 64;
+
+    // Эпоха закрепившего слот читателя, 0 -- слот свободен. Слоты разнесены
+    // по кэш-линиям, чтобы читатели разных потоков не мешали друг другу
+    struct slot
+    {
+        std::atomic<uint64_t> epoch;
+        char padding[64 - sizeof(std::atomic<uint64_t>)];
+
+        slot() : epoch(0) {}
+    };
+
+    // Блоки слотов не освобождаются до разрушения домена, поэтому guard
+    // может держать указатель на свой слот
+    struct slot_block
+    {
+        slot slots[slot_count];
+        std::atomic<slot_block*> next;
+
+        slot_block() : next(nullptr) {}
+    };
+
+    struct retired_object
+    {
+        void* ptr;
+        void (*deleter)(void*);
+        uint64_t epoch;
+    };
+
+    std::atomic<uint64_t> global_epoch;
+    slot_block slots;
+    std::mutex retired_lock;
+    std::vector<retired_object> retired;
+
+    slot* claim_slot(uint64_t epoch);
+    bool try_advance();
+    std::vector<retired_object> take_reclaimable();
+
+public:
+    // Закреплённая эпоха; пока guard жив, отложенные после pin объекты не освобождаются
+    class guard
+    {
+        friend class epoch_domain;
+
+    private:
+        epoch_domain* domain;
+        slot* pinned;
+
+        guard(epoch_domain* domain, slot* pinned);
+
+    public:
+        guard() noexcept;
+        guard(guard&& other) noexcept;
+        guard& operator=(guard&& other) noexcept;
+        ~guard();
+
+        guard(guard const&) = delete;
+        guard& operator=(guard const&) = delete;
+
+        epoch_domain* get_domain() const noexcept;
+        // Ещё один guard с той же эпохой: он защищает всё, что защищает этот,
+        // и после его сброса
+        guard clone() const;
+        void reset() noexcept;
+    };
+
+    epoch_domain();
+    // Освобождает всё отложенное: читателей к этому моменту быть не должно
+    ~epoch_domain();
+
+    epoch_domain(epoch_domain const&) = delete;
+    epoch_domain& operator=(epoch_domain const&) = delete;
+
+    guard pin();
+    // ptr уже недостижим для новых читателей; deleter(ptr) вызовется позже
+    void retire(void* ptr, void (*deleter)(void*));
+    // Пытается сдвинуть эпоху и освобождает всё, что уже можно
+    void collect();
+    size_t retired_count();
+};
+
+
+/// EPOCH DOMAIN IMPLEMENTATION ==============================================================
+
+inline epoch_domain::epoch_domain()
+        : global_epoch(1),
+          slots(),
+          retired_lock(),
+          retired()
+{}
+
+inline epoch_domain::~epoch_domain()
+{
+    for (retired_object& object : retired)
+        object.deleter(object.ptr);
+    slot_block* block = slots.next.load();
+    while (block)
+    {
+        slot_block* next = block->next.load();
+        delete block;
+        block = next;
+    }
+}
+
+inline epoch_domain::slot* epoch_domain::claim_slot(uint64_t epoch)
+{
+    // Поиск начинается со своего для потока места в блоке, чтобы потоки не
+    // состязались за одни и те же слоты. Если свободных нет ни в одном блоке,
+    // в конец цепочки добавляется новый
+    size_t start = std::hash<std::thread::id>()(std::this_thread::get_id());
+    for (slot_block* block = &slots; ; )
+    {
+        for (size_t i = 0; i < slot_count; i++)
+        {
+            slot& candidate = block->slots[(start + i) % slot_count];
+            uint64_t free_slot = 0;
+            if (candidate.epoch.load(std::memory_order_relaxed) == 0
+                && candidate.epoch.compare_exchange_strong(free_slot, epoch))
+                return &candidate;
+        }
+        slot_block* next = block->next.load();
+        if (!next)
+        {
+            slot_block* grown = new slot_block();
+            if (block->next.compare_exchange_strong(next, grown))
+                next = grown;
+            else
+                delete grown;
+        }
+        block = next;
+    }
+}
+
+inline epoch_domain::guard epoch_domain::pin()
+{
+    uint64_t epoch = global_epoch.load();
+    slot* pinned = claim_slot(epoch);
+    // Эпоха могла смениться, пока слот ещё не был виден
+    for (uint64_t current; (current = global_epoch.load()) != epoch; epoch = current)
+        pinned->epoch.store(current);
+    return guard(this, pinned);
+}
+
+inline void epoch_domain::retire(void* ptr, void (*deleter)(void*))
+{
+    std::vector<retired_object> reclaimable;
+    {
+        std::lock_guard<std::mutex> guard(retired_lock);
+        retired.push_back(retired_object{ptr, deleter, global_epoch.load()});
+        if (retired.size() % collect_period == 0)
+            reclaimable = take_reclaimable();
+    }
+    for (retired_object& object : reclaimable)
+        object.deleter(object.ptr);
+}
+
+inline void epoch_domain::collect()
+{
+    std::vector<retired_object> reclaimable;
+    {
+        std::lock_guard<std::mutex> guard(retired_lock);
+        reclaimable = take_reclaimable();
+    }
+    for (retired_object& object : reclaimable)
+        object.deleter(object.ptr);
+}
+
+inline size_t epoch_domain::retired_count()
+{
+    std::lock_guard<std::mutex> guard(retired_lock);
+    return retired.size();
+}
+
+inline bool epoch_domain::try_advance()
+{
+    uint64_t epoch = global_epoch.load();
+    for (slot_block* block = &slots; block; block = block->next.load())
+        for (slot& s : block->slots)
+        {
+            uint64_t pinned = s.epoch.load();
+            if (pinned != 0 && pinned != epoch)
+                return false;
+        }
+    return global_epoch.compare_exchange_strong(epoch, epoch + 1);
+}
+
+inline std::vector<epoch_domain::retired_object> epoch_domain::take_reclaimable()
+{
+    // Вызывается под retired_lock; сами деструкторы вызываются уже без него
+    try_advance();
+    uint64_t epoch = global_epoch.load();
+    std::vector<retired_object> reclaimable;
+    size_t kept = 0;
+    for (retired_object& object : retired)
+    {
+        if (object.epoch + 2 <= epoch)
+            reclaimable.push_back(object);
+        else
+            retired[kept++] = object;
+    }
+    retired.resize(kept);
+    return reclaimable;
+}
+
+/// GUARD IMPLEMENTATION =====================================================================
+
+inline epoch_domain::guard::guard() noexcept
+        : domain(nullptr),
+          pinned(nullptr)
+{}
+
+inline epoch_domain::guard::guard(epoch_domain* domain, slot* pinned)
+        : domain(domain),
+          pinned(pinned)
+{}
+
+inline epoch_domain::guard::guard(guard&& other) noexcept
+        : domain(other.domain),
+          pinned(other.pinned)
+{
+    other.domain = nullptr;
+}
+
+inline epoch_domain::guard& epoch_domain::guard::operator=(guard&& other) noexcept
+{
+    if (this != &other)
+    {
+        reset();
+        domain = other.domain;
+        pinned = other.pinned;
+        other.domain = nullptr;
+    }
+    return *this;
+}
+
+inline epoch_domain::guard::~guard()
+{
+    reset();
+}
+
+inline epoch_domain* epoch_domain::guard::get_domain() const noexcept
+{
+    return domain;
+}
+
+inline epoch_domain::guard epoch_domain::guard::clone() const
+{
+    // Эпоха не может уйти дальше закреплённой этим guard больше чем на одну,
+    // пока он жив, так что новый слот с той же эпохой защищает те же объекты
+    if (!domain)
+        return guard();
+    return guard(domain, domain->claim_slot(pinned->epoch.load()));
+}
+
+inline void epoch_domain::guard::reset() noexcept
+{
+    if (domain)
+        pinned->epoch.store(0);
+    domain = nullptr;
+}
+
+#endif //EPOCH_RECLAIM_H
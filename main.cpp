@@ -1,6 +1,12 @@
 #include "gtest/gtest.h"
 
 #include "my_set.h"
+#include "my_btree_set.h"
+#include "my_flat_set.h"
+#include "pool_allocator.h"
+#include "my_concurrent_set.h"
+#include "my_persistent_set.h"
+#include "my_mvcc_set.h"
 
 #include <vector>
 #include <algorithm>
@@ -13,6 +19,13 @@
 #include <utility>
 #include <iterator>
 #include <random>
+#include <cmath>
+#include <sstream>
+#include <atomic>
+#include <numeric>
+#include <stdexcept>
+#include <thread>
+#include <limits>
 
 TEST(iterators, single_element_begin_end)
 {
@@ -991,4 +1004,2387 @@ TEST(iterators, assignment)
     q.insert(1);
     it = q.begin();
     ASSERT_TRUE((*it) == 1);
-}
\ No newline at end of file
+}
+template<typename C>
+void assert_balanced(C const &c) {
+    // Высота AVL-дерева не превосходит 1.45 * log2(n + 2)
+    ASSERT_LE(static_cast<double>(c.height()), 1.45 * std::log2(c.size() + 2.0));
+}
+
+TEST(balance, sorted_insert)
+{
+    set<int> q;
+    for (int i = 0; i < 100000; i++)
+        q.insert(i);
+    assert_balanced(q);
+
+    auto it = q.begin();
+    for (int i = 0; i < 100000; i++, ++it)
+        ASSERT_EQ(i, *it);
+    ASSERT_TRUE(it == q.end());
+}
+
+TEST(balance, reverse_sorted_insert)
+{
+    set<int> q;
+    for (int i = 100000; i > 0; i--)
+        q.insert(i);
+    assert_balanced(q);
+    ASSERT_EQ(1, *q.begin());
+    ASSERT_EQ(100000, *q.rbegin());
+}
+
+TEST(balance, zigzag_insert)
+{
+    set<int> q;
+    for (int i = 0, j = 100000; i < j; i++, j--)
+    {
+        q.insert(i);
+        q.insert(j);
+    }
+    assert_balanced(q);
+}
+
+TEST(balance, erase)
+{
+    std::set<int> a;
+    set<int> b;
+    for (int i = 0; i < 20000; i++)
+    {
+        a.insert(i);
+        b.insert(i);
+    }
+
+    std::mt19937 gen(42);
+    for (int i = 0; i < 15000; i++)
+    {
+        int x = static_cast<int>(gen() % 20000);
+        if (a.count(x))
+        {
+            a.erase(x);
+            b.erase(b.find(x));
+        }
+        if (i % 1000 == 0)
+            assert_balanced(b);
+    }
+    assert_balanced(b);
+    ASSERT_EQ(a.size(), b.size());
+    ASSERT_TRUE(std::equal(a.begin(), a.end(), b.begin()));
+
+    for (int i = 0; i < 20000; i += 2)
+    {
+        if (b.find(i) != b.end())
+            b.erase(b.find(i));
+    }
+    assert_balanced(b);
+}
+
+TEST(copy, structure)
+{
+    set<int> a;
+    for (int i = 0; i < 10000; i++)
+        a.insert(i);
+    set<int> b(a);
+    ASSERT_EQ(a.size(), b.size());
+    ASSERT_EQ(a.height(), b.height());
+    ASSERT_TRUE(std::equal(a.begin(), a.end(), b.begin()));
+
+    b.erase(b.begin());
+    b.insert(-1);
+    ASSERT_EQ(0, *a.begin());
+    ASSERT_EQ(-1, *b.begin());
+}
+
+TEST(copy, assignment)
+{
+    set<int> a;
+    mass_push_back(a, {5, 3, 8, 1, 2});
+    set<int> b;
+    mass_push_back(b, {7});
+    b = a;
+    expect_eq(b, {1, 2, 3, 5, 8});
+    expect_reverse_eq(b, {8, 5, 3, 2, 1});
+    ASSERT_EQ(5u, b.size());
+}
+
+TEST(copy, sorted_unique_build)
+{
+    for (int n = 0; n < 300; n++)
+    {
+        std::vector<int> v;
+        for (int i = 0; i < n; i++)
+            v.push_back(i * 3);
+
+        set<int> s(sorted_unique, v.begin(), v.end());
+        ASSERT_EQ(v.size(), s.size());
+        // Идеально сбалансированное дерево: высота ceil(log2(n + 1))
+        size_t expected_height = 0;
+        while ((size_t(1) << expected_height) < v.size() + 1)
+            expected_height++;
+        ASSERT_EQ(expected_height, s.height());
+        ASSERT_TRUE(std::equal(v.begin(), v.end(), s.begin()));
+    }
+}
+
+TEST(copy, sorted_unique_then_modify)
+{
+    std::vector<std::string> v{"a", "b", "c", "d", "e"};
+    set<std::string> s(sorted_unique, v.begin(), v.end());
+    s.insert("bb");
+    s.erase(s.find("a"));
+    s.erase(s.find("d"));
+    expect_eq(s, {"b", "bb", "c", "e"});
+}
+
+struct copy_counter {
+    static int copies;
+    int x;
+
+    copy_counter(int x) : x(x) {}
+    copy_counter(int a, int b) : x(a * b) {}
+    copy_counter(copy_counter const &other) : x(other.x) { copies++; }
+    copy_counter(copy_counter &&other) noexcept : x(other.x) {}
+    copy_counter &operator=(copy_counter const &other) { x = other.x; copies++; return *this; }
+    copy_counter &operator=(copy_counter &&other) noexcept { x = other.x; return *this; }
+
+    friend bool operator<(const copy_counter &a, const copy_counter &b) { return a.x < b.x; }
+    friend bool operator>(const copy_counter &a, const copy_counter &b) { return a.x > b.x; }
+    friend bool operator==(const copy_counter &a, const copy_counter &b) { return a.x == b.x; }
+};
+
+int copy_counter::copies = 0;
+
+TEST(move, insert_rvalue)
+{
+    copy_counter::copies = 0;
+    set<copy_counter> s;
+    for (int i = 0; i < 100; i++)
+        s.insert(copy_counter(i));
+    s.insert(copy_counter(5));
+    ASSERT_EQ(100u, s.size());
+    ASSERT_EQ(0, copy_counter::copies);
+}
+
+TEST(move, emplace)
+{
+    copy_counter::copies = 0;
+    set<copy_counter> s;
+    auto res = s.emplace(3, 4);
+    ASSERT_TRUE(res.second);
+    ASSERT_EQ(12, res.first->x);
+    res = s.emplace(6, 2);
+    ASSERT_FALSE(res.second);
+    ASSERT_EQ(12, res.first->x);
+    res = s.emplace(1);
+    ASSERT_TRUE(res.second);
+    ASSERT_EQ(1, s.begin()->x);
+    ASSERT_EQ(2u, s.size());
+    ASSERT_EQ(0, copy_counter::copies);
+}
+
+TEST(move, constructor)
+{
+    copy_counter::copies = 0;
+    set<copy_counter> a;
+    for (int i = 0; i < 10; i++)
+        a.emplace(i);
+    auto first = a.begin();
+
+    set<copy_counter> b(std::move(a));
+    ASSERT_EQ(0, copy_counter::copies);
+    ASSERT_TRUE(a.empty());
+    ASSERT_TRUE(a.begin() == a.end());
+    ASSERT_EQ(10u, b.size());
+    ASSERT_TRUE(first == b.begin());
+    ASSERT_EQ(9, (--b.end())->x);
+
+    a.emplace(42);
+    ASSERT_EQ(42, a.begin()->x);
+}
+
+TEST(move, assignment)
+{
+    copy_counter::copies = 0;
+    set<copy_counter> a, b;
+    for (int i = 0; i < 10; i++)
+        a.emplace(i);
+    b.emplace(100);
+
+    b = std::move(a);
+    ASSERT_EQ(0, copy_counter::copies);
+    ASSERT_EQ(10u, b.size());
+    ASSERT_EQ(0, b.begin()->x);
+
+    b = std::move(b);
+    ASSERT_EQ(10u, b.size());
+
+    set<copy_counter> c;
+    c = b;
+    ASSERT_EQ(10, copy_counter::copies);
+    ASSERT_EQ(10u, c.size());
+}
+
+template<typename T>
+struct counting_allocator {
+    typedef T value_type;
+
+    std::shared_ptr<long> live;
+
+    counting_allocator() : live(std::make_shared<long>(0)) {}
+    template<typename U>
+    counting_allocator(counting_allocator<U> const &other) : live(other.live) {}
+
+    T *allocate(size_t n) {
+        *live += static_cast<long>(n);
+        return static_cast<T *>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T *p, size_t n) {
+        *live -= static_cast<long>(n);
+        ::operator delete(p);
+    }
+
+    template<typename U>
+    bool operator==(counting_allocator<U> const &other) const { return live == other.live; }
+    template<typename U>
+    bool operator!=(counting_allocator<U> const &other) const { return live != other.live; }
+};
+
+TEST(allocator, counting)
+{
+    counting_allocator<int> a;
+    {
+        set<int, std::less<int>, counting_allocator<int>> s(a);
+        for (int i = 0; i < 100; i++)
+            s.insert(i);
+        ASSERT_EQ(100, *a.live);
+        s.erase(s.begin());
+        ASSERT_EQ(99, *a.live);
+
+        set<int, std::less<int>, counting_allocator<int>> copy(s);
+        ASSERT_TRUE(copy.get_allocator() == a);
+        ASSERT_EQ(198, *a.live);
+
+        set<int, std::less<int>, counting_allocator<int>> moved(std::move(copy));
+        ASSERT_EQ(198, *a.live);
+        moved.clear();
+        ASSERT_EQ(99, *a.live);
+    }
+    ASSERT_EQ(0, *a.live);
+}
+
+TEST(allocator, counting_unequal_move_assignment)
+{
+    counting_allocator<int> a, b;
+    {
+        set<int, std::less<int>, counting_allocator<int>> s(a), t(b);
+        mass_push_back(s, {1, 2, 3});
+        mass_push_back(t, {4});
+        t = std::move(s);
+        expect_eq(t, {1, 2, 3});
+        ASSERT_TRUE(t.get_allocator() == b);
+        ASSERT_EQ(3, *b.live);
+
+        t = s;
+        ASSERT_TRUE(t.get_allocator() == b);
+    }
+    ASSERT_EQ(0, *a.live);
+    ASSERT_EQ(0, *b.live);
+}
+
+TEST(allocator, pool)
+{
+    pool_allocator<int> alloc(std::make_shared<node_pool>(64));
+    set<int, std::less<int>, pool_allocator<int>> s(alloc);
+    for (int i = 0; i < 1000; i++)
+        s.insert(i);
+    size_t slabs = alloc.get_pool()->slab_count();
+    ASSERT_EQ(1000u / 64 + 1, slabs);
+
+    // Освобождённые узлы переиспользуются, новые слэбы не нужны
+    for (int round = 0; round < 10; round++)
+    {
+        for (int i = 0; i < 1000; i += 2)
+            s.erase(s.find(i));
+        for (int i = 0; i < 1000; i += 2)
+            s.insert(i);
+    }
+    ASSERT_EQ(slabs, alloc.get_pool()->slab_count());
+    ASSERT_EQ(1000u, s.size());
+    ASSERT_EQ(0, *s.begin());
+    ASSERT_EQ(999, *s.rbegin());
+
+    set<int, std::less<int>, pool_allocator<int>> copy(s);
+    ASSERT_TRUE(copy.get_allocator() == alloc);
+    swap(copy, s);
+    ASSERT_EQ(1000u, copy.size());
+}
+
+TEST(allocator, pool_moved_from_containers)
+{
+    // Из перемещённого контейнера можно продолжать вставлять: аллокатор в нём остаётся рабочим
+    pool_allocator<int> alloc;
+    pool_allocator<int> moved_alloc(std::move(alloc));
+    ASSERT_TRUE(alloc == moved_alloc);
+
+    set<int, std::less<int>, pool_allocator<int>> a;
+    a.insert(1);
+    auto b = std::move(a);
+    a.insert(2);
+    ASSERT_EQ(1u, a.size());
+    ASSERT_EQ(1, *b.begin());
+    a = std::move(b);
+    b.insert(3);
+    ASSERT_EQ(1, *a.begin());
+    ASSERT_EQ(3, *b.begin());
+
+    btree_set<int, std::less<int>, pool_allocator<int>> c;
+    c.insert(1);
+    auto d = std::move(c);
+    c.insert(2);
+    ASSERT_EQ(2, *c.begin());
+    ASSERT_EQ(1, *d.begin());
+}
+
+TEST(allocator, pool_strings)
+{
+    set<std::string, std::less<std::string>, pool_allocator<std::string>> s;
+    for (int i = 0; i < 500; i++)
+        s.insert(std::to_string(i));
+    for (int i = 0; i < 500; i += 3)
+        s.erase(s.find(std::to_string(i)));
+    ASSERT_EQ(333u, s.size());
+    ASSERT_EQ("1", *s.begin());
+}
+
+TEST(compare, greater)
+{
+    set<int, std::greater<int>> s;
+    mass_push_back(s, {3, 1, 4, 1, 5, 9, 2, 6});
+    expect_eq(s, {9, 6, 5, 4, 3, 2, 1});
+    ASSERT_EQ(4, *s.find(4));
+    ASSERT_TRUE(s.find(7) == s.end());
+    ASSERT_EQ(4, *s.lower_bound(4));
+    ASSERT_EQ(3, *s.upper_bound(4));
+    ASSERT_EQ(6, *s.lower_bound(7));
+}
+
+struct counting_less {
+    static size_t calls;
+
+    bool operator()(int a, int b) const {
+        calls++;
+        return a < b;
+    }
+};
+
+size_t counting_less::calls = 0;
+
+TEST(compare, one_comparison_per_level)
+{
+    set<int, counting_less> s;
+    for (int i = 0; i < 1000; i++)
+        s.insert(i * 2);
+
+    for (int i = -1; i < 2001; i++)
+    {
+        counting_less::calls = 0;
+        s.find(i);
+        ASSERT_LE(counting_less::calls, s.height() + 1);
+
+        counting_less::calls = 0;
+        s.insert(i);
+        ASSERT_LE(counting_less::calls, s.height() + 1);
+    }
+    ASSERT_EQ(2002u, s.size());
+}
+
+struct counting_three_way {
+    typedef void is_three_way;
+    static size_t calls;
+
+    int operator()(std::string const &a, std::string const &b) const {
+        calls++;
+        return a.compare(b);
+    }
+};
+
+size_t counting_three_way::calls = 0;
+
+TEST(compare, three_way)
+{
+    set<std::string, counting_three_way> s;
+    for (int i = 0; i < 1000; i++)
+        s.insert(std::to_string(i));
+
+    for (int i = 0; i < 1000; i++)
+    {
+        counting_three_way::calls = 0;
+        auto res = s.insert(std::to_string(i));
+        ASSERT_FALSE(res.second);
+        ASSERT_LE(counting_three_way::calls, s.height());
+
+        counting_three_way::calls = 0;
+        ASSERT_EQ(std::to_string(i), *s.find(std::to_string(i)));
+        ASSERT_LE(counting_three_way::calls, s.height());
+    }
+    ASSERT_TRUE(s.find("x") == s.end());
+    ASSERT_EQ("10", *s.upper_bound("1"));
+    ASSERT_EQ("1", *s.lower_bound("1"));
+    ASSERT_EQ("999", *s.rbegin());
+}
+
+TEST(compare, three_way_default)
+{
+    set<int, three_way_compare<int>> s;
+    mass_push_back(s, {5, 3, 8, 1, 2});
+    s.erase(s.find(5));
+    expect_eq(s, {1, 2, 3, 8});
+    ASSERT_TRUE(s.find(5) == s.end());
+    ASSERT_EQ(8, *s.lower_bound(4));
+}
+
+struct tracked_key {
+    static int constructions;
+    int x;
+
+    tracked_key(int x) : x(x) { constructions++; }
+    tracked_key(tracked_key const &other) : x(other.x) { constructions++; }
+};
+
+int tracked_key::constructions = 0;
+
+struct tracked_key_less {
+    typedef void is_transparent;
+
+    bool operator()(tracked_key const &a, tracked_key const &b) const { return a.x < b.x; }
+    bool operator()(tracked_key const &a, int b) const { return a.x < b; }
+    bool operator()(int a, tracked_key const &b) const { return a < b.x; }
+};
+
+TEST(transparent, no_temporaries)
+{
+    set<tracked_key, tracked_key_less> s;
+    for (int i = 0; i < 100; i += 2)
+        s.emplace(i);
+
+    tracked_key::constructions = 0;
+    ASSERT_EQ(10, s.find(10)->x);
+    ASSERT_TRUE(s.find(11) == s.end());
+    ASSERT_EQ(12, s.lower_bound(11)->x);
+    ASSERT_EQ(14, s.upper_bound(12)->x);
+    ASSERT_EQ(1u, s.count(50));
+    ASSERT_EQ(0u, s.count(51));
+    ASSERT_TRUE(s.contains(98));
+    ASSERT_FALSE(s.contains(99));
+    auto range = s.equal_range(20);
+    ASSERT_EQ(20, range.first->x);
+    ASSERT_EQ(22, range.second->x);
+    range = s.equal_range(21);
+    ASSERT_TRUE(range.first == range.second);
+    ASSERT_EQ(22, range.first->x);
+    ASSERT_EQ(0, tracked_key::constructions);
+}
+
+TEST(transparent, strings)
+{
+    set<std::string, transparent_less> s;
+    mass_push_back(s, {std::string("apple"), std::string("banana"), std::string("cherry")});
+    const char *key = "banana";
+    ASSERT_EQ("banana", *s.find(key));
+    ASSERT_TRUE(s.contains("apple"));
+    ASSERT_FALSE(s.contains("apricot"));
+    ASSERT_EQ("banana", *s.lower_bound("apricot"));
+    ASSERT_EQ("cherry", *s.upper_bound("banana"));
+    ASSERT_TRUE(s.upper_bound("cherry") == s.end());
+}
+
+TEST(correctness, count_contains_equal_range)
+{
+    set<int> s;
+    mass_push_back(s, {1, 3, 5});
+    ASSERT_EQ(1u, s.count(3));
+    ASSERT_EQ(0u, s.count(4));
+    ASSERT_TRUE(s.contains(5));
+    ASSERT_FALSE(s.contains(0));
+    auto range = s.equal_range(3);
+    ASSERT_EQ(3, *range.first);
+    ASSERT_EQ(5, *range.second);
+    range = s.equal_range(6);
+    ASSERT_TRUE(range.first == s.end() && range.second == s.end());
+}
+
+TEST(btree, matches_std_set)
+{
+    std::mt19937 gen(7);
+    btree_set<int> b;
+    std::set<int> s;
+    for (int i = 0; i < 50000; i++)
+    {
+        int x = static_cast<int>(gen() % 5000);
+        if (gen() % 3 != 0)
+        {
+            auto res = b.insert(x);
+            ASSERT_EQ(s.insert(x).second, res.second);
+            ASSERT_EQ(x, *res.first);
+        }
+        else if (s.count(x))
+        {
+            auto next = b.erase(b.find(x));
+            auto expected = s.erase(s.find(x));
+            if (expected == s.end())
+                ASSERT_TRUE(next == b.end());
+            else
+                ASSERT_EQ(*expected, *next);
+        }
+        else
+            ASSERT_TRUE(b.find(x) == b.end());
+    }
+    ASSERT_EQ(s.size(), b.size());
+    ASSERT_TRUE(std::equal(s.begin(), s.end(), b.begin()));
+    ASSERT_TRUE(std::equal(s.rbegin(), s.rend(), b.rbegin()));
+    for (int x = -1; x <= 5000; x++)
+    {
+        ASSERT_EQ(s.lower_bound(x) == s.end(), b.lower_bound(x) == b.end());
+        if (s.lower_bound(x) != s.end())
+        {
+            ASSERT_EQ(*s.lower_bound(x), *b.lower_bound(x));
+        }
+        ASSERT_EQ(s.upper_bound(x) == s.end(), b.upper_bound(x) == b.end());
+        if (s.upper_bound(x) != s.end())
+        {
+            ASSERT_EQ(*s.upper_bound(x), *b.upper_bound(x));
+        }
+    }
+}
+
+TEST(btree, sorted_insert_and_erase_all)
+{
+    btree_set<int> b;
+    for (int i = 0; i < 100000; i++)
+        b.insert(i);
+    ASSERT_LE(b.height(), 4u);
+    auto it = b.begin();
+    for (int i = 0; i < 100000; i++, ++it)
+        ASSERT_EQ(i, *it);
+    ASSERT_TRUE(it == b.end());
+
+    it = b.begin();
+    for (int i = 0; i < 100000; i++)
+        it = b.erase(it);
+    ASSERT_TRUE(b.empty());
+    ASSERT_TRUE(b.begin() == b.end());
+}
+
+TEST(btree, copy_move_swap)
+{
+    btree_set<std::string> a;
+    for (int i = 0; i < 1000; i++)
+        a.insert(std::to_string(i));
+    btree_set<std::string> b(a);
+    ASSERT_TRUE(std::equal(a.begin(), a.end(), b.begin()));
+    ASSERT_TRUE(std::equal(a.rbegin(), a.rend(), b.rbegin()));
+
+    btree_set<std::string> c(std::move(a));
+    ASSERT_TRUE(a.empty());
+    ASSERT_EQ(1000u, c.size());
+
+    a.insert("x");
+    swap(a, c);
+    ASSERT_EQ(1u, c.size());
+    ASSERT_EQ(1000u, a.size());
+    c = a;
+    ASSERT_EQ(1000u, c.size());
+    ASSERT_TRUE(c.contains("999"));
+    ASSERT_FALSE(c.contains("x"));
+}
+
+TEST(btree, sorted_unique_and_transparent)
+{
+    std::vector<std::string> v;
+    for (int i = 0; i < 1000; i++)
+        v.push_back(std::to_string(100000 + i));
+    btree_set<std::string, transparent_less> b(sorted_unique, v.begin(), v.end());
+    ASSERT_EQ(1000u, b.size());
+    ASSERT_TRUE(std::equal(v.begin(), v.end(), b.begin()));
+    ASSERT_TRUE(b.contains("100500"));
+    ASSERT_EQ("100501", *b.upper_bound("100500"));
+    ASSERT_EQ(1u, b.count("100999"));
+    ASSERT_TRUE(b.find("2") == b.end());
+}
+
+TEST(flat_set, build_sort_unique)
+{
+    std::vector<int> v{5, 3, 9, 3, 1, 5, 5, 7};
+    flat_set<int> s(v.begin(), v.end());
+    expect_eq(s, {1, 3, 5, 7, 9});
+    expect_reverse_eq(s, {9, 7, 5, 3, 1});
+    ASSERT_EQ(5u, s.size());
+}
+
+TEST(flat_set, lookups)
+{
+    std::vector<int> v;
+    for (int i = 0; i < 1000; i += 2)
+        v.push_back(i);
+    for (size_t n = 0; n <= v.size(); n += 37)
+    {
+        flat_set<int> s(sorted_unique, v.begin(), v.begin() + n);
+        for (int x = -1; x <= 1000; x++)
+        {
+            auto lb = std::lower_bound(v.begin(), v.begin() + n, x);
+            auto ub = std::upper_bound(v.begin(), v.begin() + n, x);
+            ASSERT_EQ(lb - v.begin(), s.lower_bound(x) - s.begin());
+            ASSERT_EQ(ub - v.begin(), s.upper_bound(x) - s.begin());
+            ASSERT_EQ(lb != v.begin() + n && *lb == x, s.contains(x));
+            ASSERT_EQ(s.contains(x) ? 1u : 0u, s.count(x));
+        }
+    }
+}
+
+TEST(flat_set, insert_erase)
+{
+    flat_set<int> s;
+    mass_push_back(s, {5, 3, 8, 1, 2});
+    ASSERT_FALSE(s.insert(3).second);
+    ASSERT_TRUE(s.emplace(4).second);
+    expect_eq(s, {1, 2, 3, 4, 5, 8});
+    ASSERT_EQ(5, *s.erase(s.find(4)));
+    auto next = s.erase(s.find(8));
+    ASSERT_TRUE(next == s.end());
+    expect_eq(s, {1, 2, 3, 5});
+
+    flat_set<int> t;
+    swap(s, t);
+    ASSERT_TRUE(s.empty());
+    expect_eq(t, {1, 2, 3, 5});
+}
+
+TEST(flat_set, transparent_strings)
+{
+    std::vector<std::string> v{"pear", "apple", "fig", "apple"};
+    flat_set<std::string, transparent_less> s(v.begin(), v.end());
+    ASSERT_EQ(3u, s.size());
+    ASSERT_EQ("apple", *s.begin());
+    ASSERT_TRUE(s.contains("fig"));
+    ASSERT_EQ("pear", *s.upper_bound("fig"));
+    auto range = s.equal_range("fig");
+    ASSERT_EQ(1, range.second - range.first);
+}
+
+TEST(range, constructor_unsorted)
+{
+    std::vector<int> v{5, 3, 9, 3, 1, 5, 5, 7};
+    set<int> s(v.begin(), v.end());
+    expect_eq(s, {1, 3, 5, 7, 9});
+    ASSERT_EQ(5u, s.size());
+}
+
+TEST(range, constructor_sorted_is_perfectly_balanced)
+{
+    std::vector<int> v;
+    for (int i = 0; i < 1023; i++)
+        v.push_back(i);
+    counting_less::calls = 0;
+    set<int, counting_less> s(v.begin(), v.end());
+    ASSERT_EQ(10u, s.height());
+    ASSERT_EQ(1023u, s.size());
+    // Только проверка упорядоченности
+    ASSERT_EQ(1022u, counting_less::calls);
+    ASSERT_TRUE(std::equal(v.begin(), v.end(), s.begin()));
+}
+
+TEST(range, sorted_append_to_nonempty)
+{
+    set<int, counting_less> s;
+    for (int i = 0; i < 100; i++)
+        s.insert(i);
+
+    std::vector<int> v;
+    for (int i = 100; i < 100000; i++)
+        v.push_back(i);
+    counting_less::calls = 0;
+    s.insert(v.begin(), v.end());
+    // Одно сравнение с текущим максимумом на элемент
+    ASSERT_EQ(v.size(), counting_less::calls);
+    ASSERT_EQ(100000u, s.size());
+    assert_balanced(s);
+
+    auto it = s.begin();
+    for (int i = 0; i < 100000; i++, ++it)
+        ASSERT_EQ(i, *it);
+}
+
+TEST(range, input_iterators)
+{
+    std::istringstream in("1 2 3 10 20 30 5 25 30");
+    set<int> s((std::istream_iterator<int>(in)), std::istream_iterator<int>());
+    expect_eq(s, {1, 2, 3, 5, 10, 20, 25, 30});
+    assert_balanced(s);
+}
+
+TEST(range, mixed_insert)
+{
+    std::set<int> expected;
+    set<int> s;
+    std::mt19937 gen(3);
+    for (int round = 0; round < 20; round++)
+    {
+        std::vector<int> v;
+        for (int i = 0; i < 500; i++)
+            v.push_back(static_cast<int>(gen() % 3000));
+        if (round % 2)
+            std::sort(v.begin(), v.end());
+        s.insert(v.begin(), v.end());
+        expected.insert(v.begin(), v.end());
+        ASSERT_EQ(expected.size(), s.size());
+        ASSERT_TRUE(std::equal(expected.begin(), expected.end(), s.begin()));
+        assert_balanced(s);
+    }
+}
+
+TEST(hint, append_at_end)
+{
+    set<int, counting_less> s;
+    for (int i = 0; i < 10000; i++)
+    {
+        counting_less::calls = 0;
+        auto it = s.insert(s.end(), i);
+        ASSERT_EQ(i, *it);
+        // Одно сравнение с предыдущим максимумом
+        ASSERT_LE(counting_less::calls, 1u);
+    }
+    ASSERT_EQ(10000u, s.size());
+    assert_balanced(s);
+}
+
+TEST(hint, correct_wrong_and_duplicate)
+{
+    set<int> s;
+    for (int i = 0; i < 100; i += 10)
+        s.insert(i);
+
+    auto it = s.insert(s.find(50), 45);
+    ASSERT_EQ(45, *it);
+    it = s.insert(s.begin(), -5);
+    ASSERT_EQ(-5, *it);
+    it = s.insert(s.find(20), 75);
+    ASSERT_EQ(75, *it);
+    it = s.insert(s.end(), 5);
+    ASSERT_EQ(5, *it);
+
+    size_t size = s.size();
+    ASSERT_EQ(s.find(30), s.insert(s.find(40), 30));
+    ASSERT_EQ(s.find(30), s.insert(s.find(30), 30));
+    ASSERT_EQ(s.find(30), s.insert(s.begin(), 30));
+    ASSERT_EQ(size, s.size());
+    expect_eq(s, {-5, 0, 5, 10, 20, 30, 40, 45, 50, 60, 70, 75, 80, 90});
+}
+
+TEST(hint, emplace_hint)
+{
+    set<std::string> s;
+    auto it = s.emplace_hint(s.end(), 3, 'b');
+    ASSERT_EQ("bbb", *it);
+    it = s.emplace_hint(it, "aa");
+    ASSERT_EQ("aa", *it);
+    it = s.emplace_hint(s.end(), "aa");
+    ASSERT_EQ(s.begin(), it);
+    ASSERT_EQ(2u, s.size());
+}
+
+TEST(hint, random_hints)
+{
+    std::mt19937 gen(7);
+    std::set<int> expected;
+    set<int> s;
+    for (int i = 0; i < 5000; i++)
+    {
+        int x = static_cast<int>(gen() % 2000);
+        auto hint = s.lower_bound(static_cast<int>(gen() % 2000));
+        auto it = s.insert(hint, x);
+        ASSERT_EQ(x, *it);
+        expected.insert(x);
+    }
+    ASSERT_EQ(expected.size(), s.size());
+    ASSERT_TRUE(std::equal(expected.begin(), expected.end(), s.begin()));
+    assert_balanced(s);
+}
+
+TEST(erase, by_key)
+{
+    set<int> s;
+    for (int i = 0; i < 10; i++)
+        s.insert(i);
+    ASSERT_EQ(1u, s.erase(3));
+    ASSERT_EQ(0u, s.erase(3));
+    ASSERT_EQ(0u, s.erase(42));
+    expect_eq(s, {0, 1, 2, 4, 5, 6, 7, 8, 9});
+}
+
+TEST(erase, range)
+{
+    std::mt19937 gen(11);
+    for (int round = 0; round < 200; round++)
+    {
+        int n = static_cast<int>(gen() % 300);
+        set<int> s;
+        std::set<int> expected;
+        for (int i = 0; i < n; i++)
+        {
+            s.insert(i);
+            expected.insert(i);
+        }
+        int a = n ? static_cast<int>(gen() % (n + 1)) : 0;
+        int b = n ? static_cast<int>(gen() % (n + 1)) : 0;
+        if (a > b)
+            std::swap(a, b);
+
+        auto it = s.erase(s.lower_bound(a), s.lower_bound(b));
+        expected.erase(expected.lower_bound(a), expected.lower_bound(b));
+        if (b < n)
+            ASSERT_EQ(b, *it);
+        else
+            ASSERT_EQ(s.end(), it);
+        ASSERT_EQ(expected.size(), s.size());
+        ASSERT_TRUE(std::equal(expected.begin(), expected.end(), s.begin()));
+        assert_balanced(s);
+        ASSERT_TRUE(std::equal(expected.rbegin(), expected.rend(), s.rbegin()));
+    }
+}
+
+TEST(erase, range_then_modify)
+{
+    set<int> s;
+    for (int i = 0; i < 1000; i++)
+        s.insert(i);
+    s.erase(s.find(100), s.find(900));
+    s.erase(s.begin(), s.find(50));
+    ASSERT_EQ(150u, s.size());
+    for (int i = 200; i < 300; i++)
+        s.insert(i);
+    s.erase(s.find(950), s.end());
+    s.erase(s.begin(), s.end());
+    ASSERT_TRUE(s.empty());
+    ASSERT_EQ(s.begin(), s.end());
+    s.insert(1);
+    expect_eq(s, {1});
+}
+
+template <typename C>
+void assert_bounds(C const& c)
+{
+    if (c.empty())
+    {
+        ASSERT_EQ(c.begin(), c.end());
+        return;
+    }
+    auto last = c.end();
+    --last;
+    ASSERT_EQ(*c.begin(), c.front());
+    ASSERT_EQ(*last, c.back());
+    ASSERT_EQ(*c.rbegin(), c.back());
+    auto first = last;
+    for (size_t i = 1; i < c.size(); i++)
+        --first;
+    ASSERT_EQ(c.begin(), first);
+}
+
+TEST(bounds, insert_erase)
+{
+    std::mt19937 gen(5);
+    set<int> s;
+    assert_bounds(s);
+    for (int i = 0; i < 2000; i++)
+    {
+        int x = static_cast<int>(gen() % 500);
+        if (gen() % 3)
+            s.insert(x);
+        else
+            s.erase(x);
+        assert_bounds(s);
+    }
+}
+
+TEST(bounds, bulk_operations)
+{
+    std::vector<int> v{1, 2, 3, 4, 5, 6, 7, 8, 9};
+    set<int> s(v.begin(), v.end());
+    assert_bounds(s);
+    ASSERT_EQ(1, s.front());
+    ASSERT_EQ(9, s.back());
+
+    s.erase(s.begin(), s.find(3));
+    s.erase(s.find(8), s.end());
+    assert_bounds(s);
+    ASSERT_EQ(3, s.front());
+    ASSERT_EQ(7, s.back());
+
+    set<int> copy(s);
+    assert_bounds(copy);
+    set<int> other;
+    other.swap(copy);
+    assert_bounds(copy);
+    assert_bounds(other);
+    ASSERT_EQ(7, other.back());
+    copy.insert(42);
+    ASSERT_EQ(42, copy.front());
+    ASSERT_EQ(42, copy.back());
+
+    set<int> moved(std::move(other));
+    assert_bounds(moved);
+    assert_bounds(other);
+    other.insert(0);
+    ASSERT_EQ(0, other.front());
+
+    moved.clear();
+    assert_bounds(moved);
+    moved.insert(5);
+    ASSERT_EQ(5, moved.front());
+    ASSERT_EQ(5, moved.back());
+}
+
+TEST(bounds, pop_front_pop_back)
+{
+    std::vector<int> keys;
+    for (int i = 0; i < 1000; i++)
+        keys.push_back(i);
+    std::shuffle(keys.begin(), keys.end(), std::mt19937(9));
+    set<int> s(keys.begin(), keys.end());
+
+    for (int i = 0; i < 500; i++)
+    {
+        ASSERT_EQ(i, s.front());
+        ASSERT_EQ(999 - i, s.back());
+        s.pop_front();
+        s.pop_back();
+        assert_bounds(s);
+    }
+    ASSERT_TRUE(s.empty());
+}
+
+template <typename C>
+void assert_same(std::set<int> const& expected, C const& c)
+{
+    ASSERT_EQ(expected.size(), c.size());
+    ASSERT_TRUE(std::equal(expected.begin(), expected.end(), c.begin()));
+    ASSERT_TRUE(std::equal(expected.rbegin(), expected.rend(), c.rbegin()));
+}
+
+TEST(threaded, random_operations)
+{
+    std::mt19937 gen(17);
+    std::set<int> expected;
+    threaded_set<int> s;
+    for (int i = 0; i < 20000; i++)
+    {
+        int x = static_cast<int>(gen() % 1000);
+        switch (gen() % 5)
+        {
+        case 0:
+        case 1:
+            s.insert(x);
+            expected.insert(x);
+            break;
+        case 2:
+            s.insert(s.lower_bound(x), x);
+            expected.insert(x);
+            break;
+        case 3:
+            s.erase(x);
+            expected.erase(x);
+            break;
+        default:
+        {
+            int y = x + static_cast<int>(gen() % 20);
+            s.erase(s.lower_bound(x), s.lower_bound(y));
+            expected.erase(expected.lower_bound(x), expected.lower_bound(y));
+        }
+        }
+        if (i % 500 == 0)
+            assert_same(expected, s);
+    }
+    assert_same(expected, s);
+    assert_balanced(s);
+}
+
+TEST(threaded, bulk_copy_move_swap)
+{
+    std::vector<int> v;
+    for (int i = 0; i < 1000; i++)
+        v.push_back(i * 2);
+    std::set<int> expected(v.begin(), v.end());
+
+    threaded_set<int> built(v.begin(), v.end());
+    assert_same(expected, built);
+    threaded_set<int> sorted(sorted_unique, v.begin(), v.end());
+    assert_same(expected, sorted);
+
+    threaded_set<int> copy(built);
+    assert_same(expected, copy);
+    copy.insert(-1);
+    copy.insert(5000);
+    ASSERT_EQ(-1, *copy.begin());
+    ASSERT_EQ(5000, *copy.rbegin());
+
+    threaded_set<int> empty;
+    empty.swap(built);
+    assert_same(expected, empty);
+    assert_same(std::set<int>(), built);
+    built.insert(7);
+    expect_eq(built, {7});
+
+    threaded_set<int> moved(std::move(empty));
+    assert_same(expected, moved);
+    assert_same(std::set<int>(), empty);
+    moved = copy;
+    expected.insert(-1);
+    expected.insert(5000);
+    assert_same(expected, moved);
+
+    while (!moved.empty())
+        moved.pop_front();
+    ASSERT_EQ(moved.begin(), moved.end());
+    moved.insert(3);
+    expect_eq(moved, {3});
+}
+
+TEST(threaded, strings)
+{
+    threaded_set<std::string, transparent_less> s;
+    s.emplace("b");
+    s.emplace("a");
+    s.emplace_hint(s.end(), "c");
+    expect_eq(s, {std::string("a"), std::string("b"), std::string("c")});
+    ASSERT_EQ(1u, s.count("b"));
+}
+
+template <typename C>
+void assert_order_statistics(std::set<int> const& expected, C const& c)
+{
+    std::vector<int> keys(expected.begin(), expected.end());
+    for (size_t i = 0; i < keys.size(); i++)
+    {
+        ASSERT_EQ(keys[i], *c.nth(i));
+        ASSERT_EQ(i, c.rank(keys[i]));
+    }
+    ASSERT_EQ(c.end(), c.nth(keys.size()));
+    ASSERT_EQ(static_cast<std::ptrdiff_t>(keys.size()), c.distance(c.begin(), c.end()));
+}
+
+TEST(ranked, rank_nth_count_range)
+{
+    std::vector<int> v;
+    for (int i = 0; i < 100; i++)
+        v.push_back(i * 10);
+    ranked_set<int> s(v.begin(), v.end());
+
+    ASSERT_EQ(0u, s.rank(-5));
+    ASSERT_EQ(0u, s.rank(0));
+    ASSERT_EQ(1u, s.rank(5));
+    ASSERT_EQ(50u, s.rank(500));
+    ASSERT_EQ(100u, s.rank(100000));
+    ASSERT_EQ(370, *s.nth(37));
+    ASSERT_EQ(s.end(), s.nth(100));
+
+    ASSERT_EQ(10u, s.count_range(100, 200));
+    ASSERT_EQ(11u, s.count_range(100, 201));
+    ASSERT_EQ(0u, s.count_range(200, 100));
+    ASSERT_EQ(0u, s.count_range(101, 109));
+    ASSERT_EQ(100u, s.count_range(-1, 1000));
+
+    ASSERT_EQ(20, s.distance(s.find(100), s.find(300)));
+    ASSERT_EQ(-20, s.distance(s.find(300), s.find(100)));
+    ASSERT_EQ(5, s.distance(s.find(950), s.end()));
+    ASSERT_EQ(0, s.distance(s.begin(), s.begin()));
+}
+
+TEST(ranked, random_operations)
+{
+    std::mt19937 gen(23);
+    std::set<int> expected;
+    ranked_set<int> s;
+    for (int i = 0; i < 20000; i++)
+    {
+        int x = static_cast<int>(gen() % 1000);
+        switch (gen() % 5)
+        {
+        case 0:
+        case 1:
+            s.insert(x);
+            expected.insert(x);
+            break;
+        case 2:
+            s.insert(s.lower_bound(x), x);
+            expected.insert(x);
+            break;
+        case 3:
+            s.erase(x);
+            expected.erase(x);
+            break;
+        default:
+        {
+            int y = x + static_cast<int>(gen() % 20);
+            s.erase(s.lower_bound(x), s.lower_bound(y));
+            expected.erase(expected.lower_bound(x), expected.lower_bound(y));
+        }
+        }
+        if (i % 1000 == 0)
+            assert_order_statistics(expected, s);
+        int lo = static_cast<int>(gen() % 1000);
+        int hi = static_cast<int>(gen() % 1000);
+        ASSERT_EQ(lo < hi ? static_cast<size_t>(std::distance(expected.lower_bound(lo), expected.lower_bound(hi))) : 0u,
+                  s.count_range(lo, hi));
+    }
+    assert_order_statistics(expected, s);
+}
+
+TEST(ranked, copy_swap_threaded)
+{
+    std::set<int> expected;
+    set<int, std::less<int>, std::allocator<int>, true, true> s;
+    for (int i = 0; i < 500; i++)
+    {
+        s.insert((i * 37) % 1000);
+        expected.insert((i * 37) % 1000);
+    }
+    auto copy = s;
+    assert_order_statistics(expected, copy);
+    assert_same(expected, copy);
+
+    decltype(s) other;
+    other.swap(copy);
+    assert_order_statistics(expected, other);
+    assert_order_statistics(std::set<int>(), copy);
+
+    other.pop_front();
+    expected.erase(expected.begin());
+    assert_order_statistics(expected, other);
+    assert_same(expected, other);
+}
+
+struct sum_augment
+{
+    typedef long long value_type;
+
+    static value_type identity() { return 0; }
+    static value_type make(int key) { return key; }
+    static value_type combine(value_type a, value_type b) { return a + b; }
+};
+
+// Некоммутативная операция: проверяет, что ключи сворачиваются по порядку
+struct concat_augment
+{
+    typedef std::string value_type;
+
+    static value_type identity() { return std::string(); }
+    static value_type make(int key) { return std::to_string(key) + ","; }
+    static value_type combine(value_type const& a, value_type const& b) { return a + b; }
+};
+
+std::string concat_range(std::set<int> const& s, int lo, int hi)
+{
+    std::string result;
+    for (auto it = s.lower_bound(lo); it != s.end() && *it < hi; ++it)
+        result += std::to_string(*it) + ",";
+    return result;
+}
+
+TEST(augment, sum)
+{
+    std::vector<int> v;
+    for (int i = 1; i <= 100; i++)
+        v.push_back(i);
+    augmented_set<int, sum_augment> s(v.begin(), v.end());
+    ASSERT_EQ(5050, s.aggregate());
+    ASSERT_EQ(55, s.aggregate(1, 11));
+    ASSERT_EQ(0, s.aggregate(11, 1));
+    ASSERT_EQ(0, s.aggregate(200, 300));
+    ASSERT_EQ(100, s.aggregate(100, 1000));
+    s.erase(s.find(10), s.find(91));
+    ASSERT_EQ(5050 - (10 + 90) * 81 / 2, s.aggregate());
+    ASSERT_EQ(45 + 91, s.aggregate(0, 92));
+}
+
+TEST(augment, ordered_random_operations)
+{
+    std::mt19937 gen(29);
+    std::set<int> expected;
+    augmented_set<int, concat_augment> s;
+    for (int i = 0; i < 5000; i++)
+    {
+        int x = static_cast<int>(gen() % 300);
+        switch (gen() % 4)
+        {
+        case 0:
+        case 1:
+            s.insert(x);
+            expected.insert(x);
+            break;
+        case 2:
+            s.erase(x);
+            expected.erase(x);
+            break;
+        default:
+        {
+            int y = x + static_cast<int>(gen() % 10);
+            s.erase(s.lower_bound(x), s.lower_bound(y));
+            expected.erase(expected.lower_bound(x), expected.lower_bound(y));
+        }
+        }
+        int lo = static_cast<int>(gen() % 300);
+        int hi = static_cast<int>(gen() % 300);
+        ASSERT_EQ(concat_range(expected, lo, hi), s.aggregate(lo, hi));
+    }
+    ASSERT_EQ(concat_range(expected, 0, 300), s.aggregate());
+
+    auto copy = s;
+    ASSERT_EQ(s.aggregate(), copy.aggregate());
+}
+
+// Интервалы упорядочены по началу, агрегат -- наибольший конец в поддереве
+struct max_end_augment
+{
+    typedef int value_type;
+
+    static value_type identity() { return -1; }
+    static value_type make(std::pair<int, int> const& interval) { return interval.second; }
+    static value_type combine(value_type a, value_type b) { return a > b ? a : b; }
+};
+
+TEST(augment, interval_stabbing)
+{
+    augmented_set<std::pair<int, int>, max_end_augment> intervals;
+    intervals.insert({1, 5});
+    intervals.insert({3, 4});
+    intervals.insert({10, 20});
+    intervals.insert({12, 13});
+    ASSERT_EQ(20, intervals.aggregate());
+
+    // Точку p покрывает какой-то интервал, если среди начинающихся не позже p
+    // наибольший конец не меньше p
+    auto stabbed = [&](int p) {
+        return intervals.aggregate(intervals.front(), std::make_pair(p + 1, 0)) >= p;
+    };
+    ASSERT_TRUE(stabbed(2));
+    ASSERT_TRUE(stabbed(5));
+    ASSERT_FALSE(stabbed(7));
+    ASSERT_TRUE(stabbed(15));
+    ASSERT_FALSE(stabbed(21));
+
+    intervals.erase(std::make_pair(10, 20));
+    ASSERT_FALSE(stabbed(15));
+    ASSERT_TRUE(stabbed(12));
+}
+
+std::set<int> random_std_set(std::mt19937& gen, size_t n, int range)
+{
+    std::set<int> result;
+    while (result.size() < n)
+        result.insert(static_cast<int>(gen() % range));
+    return result;
+}
+
+TEST(algebra, matches_std_algorithms)
+{
+    std::mt19937 gen(31);
+    size_t sizes[] = {0, 1, 5, 50, 500, 3000};
+    for (size_t n : sizes)
+        for (size_t m : sizes)
+        {
+            std::set<int> a = random_std_set(gen, n, 8000);
+            std::set<int> b = random_std_set(gen, m, 8000);
+            std::set<int> expected;
+
+            set<int> s(a.begin(), a.end());
+            s.set_union(set<int>(b.begin(), b.end()));
+            std::set_union(a.begin(), a.end(), b.begin(), b.end(), std::inserter(expected, expected.end()));
+            assert_same(expected, s);
+            assert_balanced(s);
+
+            expected.clear();
+            set<int> i(a.begin(), a.end());
+            i.set_intersection(set<int>(b.begin(), b.end()));
+            std::set_intersection(a.begin(), a.end(), b.begin(), b.end(), std::inserter(expected, expected.end()));
+            assert_same(expected, i);
+            assert_balanced(i);
+
+            expected.clear();
+            set<int> d(a.begin(), a.end());
+            d.set_difference(set<int>(b.begin(), b.end()));
+            std::set_difference(a.begin(), a.end(), b.begin(), b.end(), std::inserter(expected, expected.end()));
+            assert_same(expected, d);
+            assert_balanced(d);
+        }
+}
+
+TEST(algebra, merge_keeps_duplicates_in_source)
+{
+    set<int> a, b;
+    for (int i = 0; i < 20; i += 2)
+        a.insert(i);
+    for (int i = 0; i < 30; i += 3)
+        b.insert(i);
+    int const* six = &*b.find(6);
+    int const* nine = &*b.find(9);
+
+    a.merge(b);
+    expect_eq(a, {0, 2, 3, 4, 6, 8, 9, 10, 12, 14, 15, 16, 18, 21, 24, 27});
+    expect_eq(b, {0, 6, 12, 18});
+    // Узлы не переразмещаются
+    ASSERT_EQ(six, &*b.find(6));
+    ASSERT_EQ(nine, &*a.find(9));
+    assert_bounds(a);
+    assert_bounds(b);
+
+    a.merge(set<int>());
+    a.merge(a);
+    ASSERT_EQ(16u, a.size());
+}
+
+struct throwing_less {
+    std::shared_ptr<long> budget;
+
+    throwing_less() : budget(std::make_shared<long>(-1)) {}
+
+    bool operator()(int a, int b) const {
+        if (*budget == 0)
+            throw std::runtime_error("comparison budget exhausted");
+        if (*budget > 0)
+            --*budget;
+        return a < b;
+    }
+};
+
+TEST(algebra, merge_with_throwing_comparator)
+{
+    typedef set<int, throwing_less, counting_allocator<int>> throwing_set;
+    auto fill = [](throwing_set& a, throwing_set& b) {
+        for (int i = 0; i < 200; i += 2)
+            a.insert(i);
+        for (int i = 0; i < 300; i += 3)
+            b.insert(i);
+    };
+    auto check = [](throwing_set const& s) {
+        ASSERT_EQ(s.size(), static_cast<size_t>(std::distance(s.begin(), s.end())));
+        ASSERT_TRUE(std::is_sorted(s.begin(), s.end()));
+    };
+
+    // Сколько сравнений нужно слиянию целиком
+    long total;
+    {
+        throwing_less comp;
+        counting_allocator<int> alloc;
+        throwing_set a(comp, alloc), b(comp, alloc);
+        fill(a, b);
+        *comp.budget = 1000000;
+        a.merge(b);
+        total = 1000000 - *comp.budget;
+        ASSERT_EQ(166u, a.size());
+        ASSERT_EQ(34u, b.size());
+    }
+
+    // Исключение на каждом шаге, включая возврат совпадающих ключей в source
+    for (long budget = 0; budget < total; budget++)
+    {
+        throwing_less comp;
+        counting_allocator<int> alloc;
+        {
+            throwing_set a(comp, alloc), b(comp, alloc);
+            fill(a, b);
+            *comp.budget = budget;
+            ASSERT_THROW(a.merge(b), std::runtime_error);
+            *comp.budget = -1;
+            check(a);
+            check(b);
+            ASSERT_EQ(static_cast<long>(a.size() + b.size()), *alloc.live);
+
+            // Множества остаются рабочими
+            a.insert(1);
+            b.insert(1);
+            ASSERT_TRUE(a.contains(1));
+            ASSERT_TRUE(b.contains(1));
+        }
+        ASSERT_EQ(0, *alloc.live);
+    }
+
+    for (long budget = 0; budget < 50; budget++)
+    {
+        throwing_less comp;
+        counting_allocator<int> alloc;
+        {
+            throwing_set a(comp, alloc), b(comp, alloc);
+            fill(a, b);
+            *comp.budget = budget;
+            ASSERT_THROW(a.set_union(std::move(b)), std::runtime_error);
+            *comp.budget = -1;
+            check(a);
+            ASSERT_EQ(static_cast<long>(a.size() + b.size()), *alloc.live);
+        }
+        ASSERT_EQ(0, *alloc.live);
+    }
+}
+
+TEST(algebra, small_into_large_is_sublinear)
+{
+    std::vector<int> v;
+    for (int i = 0; i < 100000; i++)
+        v.push_back(i * 2);
+    set<int, counting_less> large(v.begin(), v.end());
+    set<int, counting_less> small;
+    for (int i = 0; i < 10; i++)
+        small.insert(i * 20001);
+
+    counting_less::calls = 0;
+    large.merge(small);
+    ASSERT_LT(counting_less::calls, 2000u);
+    ASSERT_EQ(100005u, large.size());
+    ASSERT_EQ(5u, small.size());
+    assert_balanced(large);
+
+    for (int i = 0; i < 10; i++)
+        small.insert(i * 20001);
+    counting_less::calls = 0;
+    large.set_difference(std::move(small));
+    ASSERT_LT(counting_less::calls, 2000u);
+    ASSERT_EQ(99995u, large.size());
+    ASSERT_EQ(0u, large.count(20001));
+    ASSERT_EQ(1u, large.count(20002));
+}
+
+TEST(algebra, reuses_nodes)
+{
+    counting_allocator<int> a;
+    set<int, std::less<int>, counting_allocator<int>> s(a), t(a);
+    for (int i = 0; i < 100; i++)
+    {
+        s.insert(i);
+        t.insert(i + 50);
+    }
+    ASSERT_EQ(200, *a.live);
+    s.set_union(std::move(t));
+    ASSERT_EQ(150u, s.size());
+    ASSERT_EQ(150, *a.live);
+
+    counting_allocator<int> other;
+    set<int, std::less<int>, counting_allocator<int>> u(other);
+    for (int i = 140; i < 160; i++)
+        u.insert(i);
+    s.set_intersection(std::move(u));
+    expect_eq(s, {140, 141, 142, 143, 144, 145, 146, 147, 148, 149});
+    ASSERT_EQ(10, *a.live);
+    ASSERT_EQ(0, *other.live);
+}
+
+TEST(algebra, ranked_and_threaded)
+{
+    std::mt19937 gen(37);
+    std::set<int> a = random_std_set(gen, 700, 3000);
+    std::set<int> b = random_std_set(gen, 400, 3000);
+    std::set<int> expected;
+    std::set_union(a.begin(), a.end(), b.begin(), b.end(), std::inserter(expected, expected.end()));
+
+    set<int, std::less<int>, std::allocator<int>, true, true> s(a.begin(), a.end());
+    s.set_union(set<int, std::less<int>, std::allocator<int>, true, true>(b.begin(), b.end()));
+    assert_same(expected, s);
+    assert_order_statistics(expected, s);
+
+    augmented_set<int, sum_augment> x(a.begin(), a.end()), y(b.begin(), b.end());
+    x.merge(y);
+    long long sum = 0;
+    for (int k : expected)
+        sum += k;
+    ASSERT_EQ(sum, x.aggregate());
+}
+
+TEST(split_join, split_and_join_back)
+{
+    std::vector<int> v;
+    for (int i = 0; i < 1000; i++)
+        v.push_back(i);
+    set<int> s(v.begin(), v.end());
+    int const* address = &*s.find(700);
+
+    set<int> tail = s.split(600);
+    ASSERT_EQ(600u, s.size());
+    ASSERT_EQ(400u, tail.size());
+    ASSERT_EQ(599, s.back());
+    ASSERT_EQ(600, tail.front());
+    ASSERT_EQ(address, &*tail.find(700));
+    assert_balanced(s);
+    assert_balanced(tail);
+    assert_bounds(s);
+    assert_bounds(tail);
+
+    set<int> none = tail.split(5000);
+    ASSERT_TRUE(none.empty());
+    ASSERT_EQ(400u, tail.size());
+    set<int> all = tail.split(-5);
+    ASSERT_TRUE(tail.empty());
+    ASSERT_EQ(400u, all.size());
+
+    s.join(std::move(all));
+    ASSERT_EQ(1000u, s.size());
+    ASSERT_TRUE(std::equal(v.begin(), v.end(), s.begin()));
+    assert_balanced(s);
+    assert_bounds(s);
+
+    set<int> half = s.split(500);
+    set<int> joined = join(std::move(s), std::move(half));
+    ASSERT_TRUE(std::equal(v.begin(), v.end(), joined.begin()));
+}
+
+TEST(split_join, absent_key_and_modification)
+{
+    set<int> s;
+    for (int i = 0; i < 100; i += 2)
+        s.insert(i);
+    set<int> right = s.split(51);
+    ASSERT_EQ(52, *right.begin());
+    ASSERT_EQ(50, *s.rbegin());
+
+    s.insert(1);
+    right.erase(52);
+    right.insert(99);
+    ASSERT_EQ(27u, s.size());
+    ASSERT_EQ(24u, right.size());
+    ASSERT_EQ(1u, s.count(1));
+    ASSERT_EQ(0u, s.count(52));
+    s.join(right);
+    ASSERT_EQ(51u, s.size());
+    ASSERT_EQ(24u, right.size());
+}
+
+TEST(split_join, random_shards)
+{
+    std::mt19937 gen(41);
+    std::set<int> expected = random_std_set(gen, 3000, 100000);
+    set<int, std::less<int>, std::allocator<int>, true, true> s(expected.begin(), expected.end());
+    std::vector<decltype(s)> shards;
+    for (int cut = 90000; cut > 0; cut -= 10000)
+    {
+        shards.push_back(s.split(cut));
+        assert_balanced(shards.back());
+    }
+    size_t total = s.size();
+    for (auto& shard : shards)
+        total += shard.size();
+    ASSERT_EQ(expected.size(), total);
+
+    for (size_t i = shards.size(); i-- > 0; )
+        s.join(std::move(shards[i]));
+    assert_same(expected, s);
+    assert_order_statistics(expected, s);
+    assert_balanced(s);
+}
+
+TEST(split_join, unranked_sizes_are_exact)
+{
+    // Без Ranked split сразу знает размеры частей; size() ничего не пересчитывает
+    // и безопасен для одновременного вызова из нескольких потоков
+    std::mt19937 gen(43);
+    std::set<int> expected = random_std_set(gen, 3000, 100000);
+    set<int> s(expected.begin(), expected.end());
+    for (int cut : {50000, 99000, 100, 70000, -1, 200000})
+    {
+        set<int> tail = s.split(cut);
+        size_t below = static_cast<size_t>(std::distance(expected.begin(), expected.lower_bound(cut)));
+        ASSERT_EQ(below, s.size());
+        ASSERT_EQ(expected.size() - below, tail.size());
+        ASSERT_EQ(below, static_cast<size_t>(std::distance(s.begin(), s.end())));
+        s.join(std::move(tail));
+        ASSERT_EQ(expected.size(), s.size());
+    }
+
+    set<int> tail = s.split(30000);
+    set<int> const& head = s;
+    std::atomic<long> errors(0);
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 3; t++)
+        readers.emplace_back([&]() {
+            for (int i = 0; i < 1000; i++)
+                errors += head.size() + tail.size() != expected.size();
+        });
+    for (auto& reader : readers)
+        reader.join();
+    ASSERT_EQ(0, errors.load());
+    s.merge(tail);
+    assert_same(expected, s);
+}
+
+TEST(node_handle, move_between_sets_without_allocation)
+{
+    counting_allocator<int> a;
+    typedef set<int, std::less<int>, counting_allocator<int>> counted_set;
+    counted_set s(a), t(a);
+    for (int i = 0; i < 100; i++)
+        s.insert(i);
+    ASSERT_EQ(100, *a.live);
+
+    for (int i = 0; i < 100; i += 2)
+    {
+        auto result = t.insert(s.extract(i));
+        ASSERT_TRUE(result.inserted);
+        ASSERT_TRUE(result.node.empty());
+        ASSERT_EQ(i, *result.position);
+    }
+    ASSERT_EQ(100, *a.live);
+    ASSERT_EQ(50u, s.size());
+    ASSERT_EQ(50u, t.size());
+    assert_balanced(s);
+    assert_balanced(t);
+    assert_bounds(s);
+    assert_bounds(t);
+    ASSERT_EQ(1, *s.begin());
+    ASSERT_EQ(0, *t.begin());
+}
+
+TEST(node_handle, rekey_and_duplicates)
+{
+    set<int> s;
+    for (int i = 0; i < 10; i++)
+        s.insert(i);
+
+    set<int>::node_type nh = s.extract(s.find(3));
+    ASSERT_FALSE(nh.empty());
+    ASSERT_EQ(3, nh.value());
+    nh.value() = 30;
+    auto it = s.insert(s.end(), std::move(nh));
+    ASSERT_EQ(30, *it);
+    ASSERT_TRUE(nh.empty());
+    expect_eq(s, {0, 1, 2, 4, 5, 6, 7, 8, 9, 30});
+
+    nh = s.extract(5);
+    nh.value() = 7;
+    auto result = s.insert(std::move(nh));
+    ASSERT_FALSE(result.inserted);
+    ASSERT_EQ(7, *result.position);
+    ASSERT_TRUE(bool(result.node));
+    ASSERT_EQ(7, result.node.value());
+    ASSERT_EQ(9u, s.size());
+
+    ASSERT_TRUE(s.extract(100).empty());
+    auto empty = s.insert(set<int>::node_type());
+    ASSERT_FALSE(empty.inserted);
+    ASSERT_TRUE(empty.position == s.end());
+}
+
+TEST(node_handle, destructor_and_foreign_allocator)
+{
+    counting_allocator<int> a, b;
+    typedef set<int, std::less<int>, counting_allocator<int>> counted_set;
+    counted_set s(a), t(b);
+    for (int i = 0; i < 10; i++)
+        s.insert(i);
+    {
+        counted_set::node_type nh = s.extract(4);
+        ASSERT_EQ(10, *a.live);
+        ASSERT_TRUE(nh.get_allocator() == a);
+    }
+    ASSERT_EQ(9, *a.live);
+
+    auto result = t.insert(s.extract(5));
+    ASSERT_TRUE(result.inserted);
+    ASSERT_TRUE(result.node.empty());
+    ASSERT_EQ(8, *a.live);
+    ASSERT_EQ(1, *b.live);
+    ASSERT_EQ(8u, s.size());
+
+    // Неудачная вставка с подсказкой оставляет дескриптор вызывающему
+    s.insert(5);
+    counted_set::node_type duplicate = s.extract(5);
+    auto position = t.insert(t.end(), std::move(duplicate));
+    ASSERT_EQ(5, *position);
+    ASSERT_FALSE(duplicate.empty());
+    ASSERT_EQ(5, duplicate.value());
+    ASSERT_TRUE(duplicate.get_allocator() == a);
+    ASSERT_EQ(1, *b.live);
+    ASSERT_EQ(9, *a.live);
+}
+
+TEST(node_handle, threaded_ranked_random)
+{
+    std::mt19937 gen(43);
+    std::set<int> expected = random_std_set(gen, 2000, 10000), moved;
+    set<int, std::less<int>, std::allocator<int>, true, true> s(expected.begin(), expected.end()), t;
+    for (int i = 0; i < 1000; i++)
+    {
+        int x = static_cast<int>(gen() % 10000);
+        if (!expected.count(x))
+            continue;
+        expected.erase(x);
+        moved.insert(x);
+        t.insert(t.end(), s.extract(x));
+    }
+    assert_same(expected, s);
+    assert_same(moved, t);
+    assert_order_statistics(expected, s);
+    assert_order_statistics(moved, t);
+    assert_balanced(s);
+    assert_balanced(t);
+}
+
+TEST(parallel_build, matches_sequential)
+{
+    std::mt19937 gen(47);
+    std::vector<int> keys(70000);
+    for (auto& x : keys)
+        x = static_cast<int>(gen() % 50000);
+    std::set<int> expected(keys.begin(), keys.end());
+    for (unsigned threads : {1u, 3u, 0u})
+    {
+        set<int> s(parallel_build, keys.begin(), keys.end(), threads);
+        ASSERT_EQ(expected.size(), s.size());
+        assert_same(expected, s);
+        assert_bounds(s);
+        assert_balanced(s);
+    }
+}
+
+TEST(parallel_build, threaded_ranked_and_small_inputs)
+{
+    std::mt19937 gen(53);
+    std::vector<int> keys(70000);
+    for (auto& x : keys)
+        x = static_cast<int>(gen());
+    std::set<int> expected(keys.begin(), keys.end());
+    set<int, std::less<int>, std::allocator<int>, true, true> s(parallel_build, keys.begin(), keys.end(), 4);
+    assert_same(expected, s);
+    assert_order_statistics(expected, s);
+
+    std::vector<int> few = {5, 3, 5, 1};
+    set<int> t(parallel_build, few.begin(), few.end(), 8);
+    expect_eq(t, {1, 3, 5});
+    set<int> empty(parallel_build, few.begin(), few.begin());
+    ASSERT_TRUE(empty.empty());
+}
+
+TEST(parallel_build, pool_allocator_and_three_way)
+{
+    // Пул не потокобезопасен: узлы выделяются в одном потоке, сортируют все
+    std::vector<std::string> keys;
+    for (int i = 0; i < 70000; i++)
+        keys.push_back(std::to_string(i % 50000));
+    pool_allocator<std::string> alloc(std::make_shared<node_pool>(256));
+    set<std::string, three_way_compare<std::string>, pool_allocator<std::string>> s(
+            parallel_build, keys.begin(), keys.end(), 4, three_way_compare<std::string>(), alloc);
+    std::set<std::string> expected(keys.begin(), keys.end());
+    ASSERT_EQ(expected.size(), s.size());
+    ASSERT_TRUE(std::equal(expected.begin(), expected.end(), s.begin()));
+    assert_balanced(s);
+}
+
+TEST(parallel_scan, for_each_and_ranges)
+{
+    std::mt19937 gen(59);
+    std::set<int> expected = random_std_set(gen, 30000, 1000000);
+    set<int> s(expected.begin(), expected.end());
+    work_stealing_pool pool(4);
+
+    std::atomic<long long> sum(0);
+    std::atomic<size_t> visited(0);
+    s.parallel_for_each([&](int x) {
+        sum += x;
+        visited++;
+    }, pool);
+    ASSERT_EQ(expected.size(), visited.load());
+    ASSERT_EQ(std::accumulate(expected.begin(), expected.end(), 0LL), sum.load());
+
+    for (int i = 0; i < 20; i++)
+    {
+        int lo = static_cast<int>(gen() % 1000000), hi = static_cast<int>(gen() % 1000000);
+        std::atomic<size_t> in_range(0);
+        s.parallel_for_each(lo, hi, [&](int x) {
+            EXPECT_TRUE(lo <= x && x < hi);
+            in_range++;
+        }, pool);
+        size_t count = lo < hi ? static_cast<size_t>(std::distance(expected.lower_bound(lo), expected.lower_bound(hi))) : 0;
+        ASSERT_EQ(count, in_range.load());
+    }
+}
+
+TEST(parallel_scan, transform_reduce_keeps_order)
+{
+    std::mt19937 gen(61);
+    std::set<int> expected = random_std_set(gen, 20000, 100000);
+    set<int, std::less<int>, std::allocator<int>, true> s(expected.begin(), expected.end());
+    work_stealing_pool pool(3);
+
+    long long total = s.parallel_transform_reduce(5LL, std::plus<long long>(), [](int x) { return 2LL * x; }, pool);
+    ASSERT_EQ(5 + 2 * std::accumulate(expected.begin(), expected.end(), 0LL), total);
+
+    // Конкатенация не коммутативна: строка должна собраться в порядке ключей
+    std::string digits = s.parallel_transform_reduce(std::string("^"),
+            [](std::string a, std::string const& b) { return a + b; },
+            [](int x) { return std::string(1, static_cast<char>('0' + x % 10)); }, pool);
+    std::string serial = "^";
+    for (int x : expected)
+        serial += static_cast<char>('0' + x % 10);
+    ASSERT_EQ(serial, digits);
+
+    int lo = 25000, hi = 75000;
+    size_t count = s.parallel_transform_reduce(lo, hi, size_t(0), std::plus<size_t>(), [](int) { return size_t(1); }, pool);
+    ASSERT_EQ(static_cast<size_t>(std::distance(expected.lower_bound(lo), expected.lower_bound(hi))), count);
+    ASSERT_EQ(7, s.parallel_transform_reduce(hi, lo, 7, std::plus<int>(), [](int x) { return x; }, pool));
+
+    set<int> empty;
+    ASSERT_EQ(3, empty.parallel_transform_reduce(3, std::plus<int>(), [](int x) { return x; }));
+}
+
+TEST(parallel_scan, exceptions_and_shared_pool)
+{
+    set<int> s;
+    for (int i = 0; i < 50000; i++)
+        s.insert(i);
+    work_stealing_pool pool(2);
+    ASSERT_THROW(s.parallel_for_each([](int x) {
+        if (x == 31337)
+            throw std::runtime_error("stop");
+    }, pool), std::runtime_error);
+
+    std::atomic<long long> sum(0);
+    s.parallel_for_each([&sum](int x) { sum += x; });
+    ASSERT_EQ(50000LL * 49999 / 2, sum.load());
+}
+
+TEST(epoch_reclaim, retired_objects_wait_for_readers)
+{
+    static int freed;
+    freed = 0;
+    epoch_domain domain;
+    {
+        epoch_domain::guard reader = domain.pin();
+        domain.retire(new int(1), [](void* p) { delete static_cast<int*>(p); freed++; });
+        for (int i = 0; i < 10; i++)
+            domain.collect();
+        ASSERT_EQ(0, freed);
+    }
+    domain.collect();
+    domain.collect();
+    ASSERT_EQ(1, freed);
+    ASSERT_EQ(0u, domain.retired_count());
+
+    domain.retire(new int(2), [](void* p) { delete static_cast<int*>(p); freed++; });
+    epoch_domain::guard late = domain.pin();
+    domain.collect();
+    domain.collect();
+    ASSERT_EQ(1, freed);
+    late.reset();
+    domain.collect();
+    domain.collect();
+    ASSERT_EQ(2, freed);
+}
+
+TEST(epoch_reclaim, clones_and_many_guards)
+{
+    static int freed;
+    freed = 0;
+    epoch_domain domain;
+    // Копия guard держит ту же эпоху и после сброса оригинала
+    epoch_domain::guard original = domain.pin();
+    domain.collect();
+    domain.retire(new int(1), [](void* p) { delete static_cast<int*>(p); freed++; });
+    epoch_domain::guard copy = original.clone();
+    original.reset();
+    for (int i = 0; i < 10; i++)
+        domain.collect();
+    ASSERT_EQ(0, freed);
+    copy.reset();
+    domain.collect();
+    domain.collect();
+    ASSERT_EQ(1, freed);
+    ASSERT_TRUE(epoch_domain::guard().clone().get_domain() == nullptr);
+
+    // Закреплённых guard больше, чем слотов в блоке
+    std::vector<epoch_domain::guard> guards;
+    for (int i = 0; i < 1000; i++)
+        guards.push_back(domain.pin());
+    guards.push_back(guards.back().clone());
+    domain.retire(new int(2), [](void* p) { delete static_cast<int*>(p); freed++; });
+    domain.collect();
+    domain.collect();
+    ASSERT_EQ(1, freed);
+    guards.clear();
+    domain.collect();
+    domain.collect();
+    ASSERT_EQ(2, freed);
+}
+
+TEST(concurrent_set, sequential_api)
+{
+    std::mt19937 gen(67);
+    concurrent_set<int> s;
+    std::set<int> expected;
+    for (int i = 0; i < 5000; i++)
+    {
+        int x = static_cast<int>(gen() % 1000);
+        if (gen() % 3)
+        {
+            auto result = s.insert(x);
+            ASSERT_EQ(expected.insert(x).second, result.second);
+            ASSERT_EQ(x, *result.first);
+        }
+        else
+            ASSERT_EQ(expected.erase(x), s.erase(x));
+        ASSERT_EQ(expected.size(), s.size());
+    }
+    ASSERT_TRUE(std::equal(expected.begin(), expected.end(), s.begin()));
+    ASSERT_EQ(expected.size(), static_cast<size_t>(std::distance(s.begin(), s.end())));
+    for (int x = -1; x <= 1000; x++)
+    {
+        ASSERT_EQ(expected.count(x), s.count(x));
+        auto lower = expected.lower_bound(x), upper = expected.upper_bound(x);
+        auto it = s.lower_bound(x), jt = s.upper_bound(x);
+        ASSERT_EQ(lower == expected.end(), it == s.end());
+        ASSERT_EQ(upper == expected.end(), jt == s.end());
+        if (lower != expected.end())
+        {
+            ASSERT_EQ(*lower, *it);
+        }
+        if (upper != expected.end())
+        {
+            ASSERT_EQ(*upper, *jt);
+        }
+        ASSERT_EQ(expected.count(x) != 0, s.find(x) != s.end());
+    }
+}
+
+TEST(concurrent_set, iterator_copies_keep_nodes)
+{
+    concurrent_set<int> s;
+    for (int i = 0; i < 200; i++)
+        s.insert(i);
+    // Копия итератора защищает узел и после того, как оригинал разрушен
+    std::unique_ptr<concurrent_set<int>::const_iterator> it(new concurrent_set<int>::const_iterator(s.find(0)));
+    for (int i = 0; i < 64; i++)
+        s.erase(i);
+    concurrent_set<int>::const_iterator copy = *it;
+    it.reset();
+    for (int i = 64; i < 128; i++)
+        s.erase(i);
+    ASSERT_EQ(0, *copy);
+    copy = s.find(150);
+    ASSERT_EQ(150, *copy);
+
+    // Живых итераторов может быть больше, чем слотов эпох в одном блоке
+    std::vector<concurrent_set<int>::const_iterator> held;
+    for (int i = 0; i < 600; i++)
+        held.push_back(s.find(128 + i % 72));
+    ASSERT_EQ(199, *s.find(199));
+    ASSERT_EQ(128, *held[576]);
+}
+
+TEST(concurrent_set, stress)
+{
+    // Писатели меняют каждый свои ключи (x % writers == id), читатели в это время
+    // проверяют порядок обхода и то, что постоянные ключи видны всегда
+    const int writers = 4, readers = 3, operations = 20000, range = 4000;
+    concurrent_set<int> s;
+    for (int x = range; x < range + 100; x++)
+        s.insert(x);
+    std::vector<std::set<int>> expected(writers);
+    std::atomic<bool> done(false);
+    std::atomic<long> reader_errors(0);
+
+    std::vector<std::thread> threads;
+    for (int id = 0; id < writers; id++)
+        threads.emplace_back([&, id]() {
+            std::mt19937 gen(static_cast<unsigned>(id));
+            for (int i = 0; i < operations; i++)
+            {
+                int x = static_cast<int>(gen() % (range / writers)) * writers + id;
+                if (gen() % 2)
+                {
+                    if (s.insert(x).second != expected[id].insert(x).second)
+                        reader_errors++;
+                }
+                else if (s.erase(x) != expected[id].erase(x))
+                    reader_errors++;
+            }
+        });
+    for (int id = 0; id < readers; id++)
+        threads.emplace_back([&, id]() {
+            std::mt19937 gen(static_cast<unsigned>(100 + id));
+            while (!done)
+            {
+                int previous = -1, permanent = 0;
+                for (int x : s)
+                {
+                    if (x <= previous)
+                        reader_errors++;
+                    previous = x;
+                    permanent += x >= range;
+                }
+                if (permanent != 100)
+                    reader_errors++;
+                int x = range + static_cast<int>(gen() % 100);
+                if (!s.contains(x) || s.find(x) == s.end() || *s.lower_bound(x) != x)
+                    reader_errors++;
+            }
+        });
+    for (int id = 0; id < writers; id++)
+        threads[id].join();
+    done = true;
+    for (int id = writers; id < writers + readers; id++)
+        threads[id].join();
+
+    ASSERT_EQ(0, reader_errors.load());
+    std::set<int> all;
+    for (auto& part : expected)
+        all.insert(part.begin(), part.end());
+    for (int x = range; x < range + 100; x++)
+        all.insert(x);
+    ASSERT_EQ(all.size(), s.size());
+    ASSERT_TRUE(std::equal(all.begin(), all.end(), s.begin()));
+}
+
+template <typename Set>
+void assert_persistent_same(std::set<int> const& expected, Set const& s)
+{
+    ASSERT_EQ(expected.size(), s.size());
+    ASSERT_TRUE(std::equal(expected.begin(), expected.end(), s.begin()));
+    ASSERT_EQ(expected.size(), static_cast<size_t>(std::distance(s.begin(), s.end())));
+    ASSERT_LE(static_cast<double>(s.height()), 1.45 * std::log2(static_cast<double>(s.size()) + 2));
+}
+
+TEST(persistent, snapshots_are_isolated)
+{
+    std::mt19937 gen(71);
+    persistent_set<int> s;
+    std::set<int> expected;
+    std::vector<std::pair<persistent_set<int>, std::set<int>>> versions;
+    for (int i = 0; i < 4000; i++)
+    {
+        int x = static_cast<int>(gen() % 1000);
+        if (gen() % 3)
+            ASSERT_EQ(expected.insert(x).second, s.insert(x));
+        else
+            ASSERT_EQ(expected.erase(x), s.erase(x));
+        if (i % 200 == 0)
+            versions.emplace_back(s.snapshot(), expected);
+    }
+    assert_persistent_same(expected, s);
+    for (auto& version : versions)
+        assert_persistent_same(version.second, version.first);
+
+    // Снимок тоже можно менять, оригинал от этого не меняется
+    persistent_set<int> branch = versions[3].first;
+    branch.insert(-1);
+    branch.erase(*branch.begin() == -1 ? *++branch.begin() : *branch.begin());
+    assert_persistent_same(versions[3].second, versions[3].first);
+    ASSERT_TRUE(branch.contains(-1));
+}
+
+TEST(persistent, lookups)
+{
+    std::set<int> expected = {1, 5, 9, 13};
+    persistent_set<int> s(expected.begin(), expected.end());
+    ASSERT_EQ(5, *s.find(5));
+    ASSERT_TRUE(s.find(6) == s.end());
+    ASSERT_EQ(9, *s.lower_bound(6));
+    ASSERT_TRUE(s.lower_bound(14) == s.end());
+    ASSERT_EQ(1u, s.count(13));
+    ASSERT_FALSE(s.insert(9));
+    ASSERT_EQ(0u, s.erase(10));
+    s.clear();
+    ASSERT_TRUE(s.empty());
+    ASSERT_TRUE(s.begin() == s.end());
+}
+
+TEST(persistent, path_copying_allocations)
+{
+    counting_allocator<int> a;
+    {
+        persistent_set<int, std::less<int>, counting_allocator<int>> s(a);
+        for (int i = 0; i < 10000; i++)
+            s.insert(i);
+        ASSERT_EQ(10000, *a.live);
+
+        // Снимок ничего не выделяет, изменение после него копирует только путь
+        auto snapshot = s.snapshot();
+        ASSERT_EQ(10000, *a.live);
+        s.insert(10000);
+        long copied = *a.live - 10001;
+        ASSERT_GT(copied, 0);
+        ASSERT_LE(copied, static_cast<long>(s.height()) + 2);
+        s.erase(5000);
+        ASSERT_LE(*a.live - 10001, 3 * static_cast<long>(s.height()) + 4);
+
+        // Без снимков узлы меняются на месте
+        snapshot.clear();
+        long before = *a.live;
+        s.insert(20000);
+        s.erase(20000);
+        ASSERT_LE(*a.live, before + 1);
+    }
+    ASSERT_EQ(0, *a.live);
+}
+
+TEST(persistent, readers_on_other_threads)
+{
+    persistent_set<int> s;
+    for (int i = 0; i < 5000; i++)
+        s.insert(i * 2);
+    std::atomic<long> errors(0);
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 3; t++)
+        readers.emplace_back([&errors](persistent_set<int> snapshot) {
+            for (int round = 0; round < 5; round++)
+            {
+                int expected = 0;
+                for (int x : snapshot)
+                {
+                    errors += x != expected;
+                    expected += 2;
+                }
+                errors += expected != 10000;
+            }
+        }, s.snapshot());
+    std::mt19937 gen(73);
+    for (int i = 0; i < 20000; i++)
+    {
+        int x = static_cast<int>(gen() % 20000);
+        if (gen() % 2)
+            s.insert(x);
+        else
+            s.erase(x);
+    }
+    for (auto& reader : readers)
+        reader.join();
+    ASSERT_EQ(0, errors.load());
+}
+
+TEST(mvcc, views_and_reclamation)
+{
+    counting_allocator<int> a;
+    {
+        mvcc_set<int, std::less<int>, counting_allocator<int>> s((persistent_set<int, std::less<int>, counting_allocator<int>>(a)));
+        for (int i = 0; i < 1000; i++)
+            ASSERT_TRUE(s.insert(i));
+        ASSERT_FALSE(s.insert(5));
+        ASSERT_EQ(0u, s.erase(-1));
+        s.reclaim();
+        ASSERT_EQ(1000, *a.live);
+
+        // Читатель видит свою версию, пока её не отпустит
+        {
+            auto view = s.read();
+            for (int i = 0; i < 500; i++)
+                ASSERT_EQ(1u, s.erase(i));
+            s.update([](persistent_set<int, std::less<int>, counting_allocator<int>>& next) {
+                next.insert(-1);
+                next.insert(-2);
+            });
+            s.reclaim();
+            ASSERT_EQ(1000u, view->size());
+            ASSERT_TRUE(view->contains(0));
+            ASSERT_FALSE(view->contains(-1));
+            ASSERT_EQ(1000, std::distance(view.begin(), view.end()));
+            ASSERT_GT(*a.live, 502);
+        }
+        {
+            auto view = s.read();
+            ASSERT_EQ(502u, view->size());
+            ASSERT_EQ(-2, *view.begin());
+            view = s.read();
+            ASSERT_EQ(500, *view->lower_bound(0));
+        }
+        s.reclaim();
+        ASSERT_EQ(502, *a.live);
+    }
+    ASSERT_EQ(0, *a.live);
+}
+
+TEST(mvcc, readers_see_consistent_versions)
+{
+    // Писатель добавляет и удаляет ключи парами 2k, 2k + 1 одним обновлением:
+    // согласованная версия никогда не содержит половину пары
+    typedef persistent_set<int> version;
+    mvcc_set<int> s;
+    std::atomic<bool> done(false);
+    std::atomic<long> errors(0), versions_read(0);
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 3; t++)
+        readers.emplace_back([&]() {
+            while (!done)
+            {
+                auto view = s.read();
+                size_t seen = 0;
+                for (auto it = view.begin(); it != view.end(); ++it, ++seen)
+                {
+                    int x = *it;
+                    errors += x % 2 != 0;
+                    ++it;
+                    ++seen;
+                    errors += it == view.end() || *it != x + 1;
+                    if (it == view.end())
+                        break;
+                }
+                errors += seen != view->size();
+                versions_read++;
+            }
+        });
+    std::mt19937 gen(79);
+    for (int i = 0; i < 20000; i++)
+    {
+        int x = static_cast<int>(gen() % 2000) * 2;
+        s.update([x](version& next) {
+            if (next.contains(x))
+            {
+                next.erase(x);
+                next.erase(x + 1);
+            }
+            else
+            {
+                next.insert(x + 1);
+                next.insert(x);
+            }
+        });
+    }
+    done = true;
+    for (auto& reader : readers)
+        reader.join();
+    ASSERT_EQ(0, errors.load());
+    ASSERT_GT(versions_read.load(), 0);
+    version last = s.snapshot();
+    ASSERT_EQ(0u, last.size() % 2);
+}
+
+template <typename Set>
+void assert_batches_match(Set const& s, std::vector<typename Set::value_type> const& queries)
+{
+    std::vector<typename Set::const_iterator> found(queries.size()), lower;
+    auto end = s.find_batch(queries.begin(), queries.end(), found.begin());
+    ASSERT_TRUE(end == found.end());
+    s.lower_bound_batch(queries.data(), queries.data() + queries.size(), std::back_inserter(lower));
+    ASSERT_EQ(queries.size(), lower.size());
+    for (size_t i = 0; i < queries.size(); i++)
+    {
+        ASSERT_TRUE(found[i] == s.find(queries[i]));
+        ASSERT_TRUE(lower[i] == s.lower_bound(queries[i]));
+    }
+}
+
+TEST(batch_lookup, matches_single_lookups)
+{
+    std::mt19937 gen(83);
+    std::vector<int> queries;
+    // Число ключей не кратно числу одновременных спусков
+    for (int i = 0; i < 1237; i++)
+        queries.push_back(static_cast<int>(gen() % 4000) - 100);
+    set<int> empty;
+    assert_batches_match(empty, queries);
+
+    set<int> s;
+    set<int, std::less<int>, std::allocator<int>, true, true> ranked;
+    set<int, three_way_compare<int>> three_way;
+    for (int i = 0; i < 1500; i++)
+    {
+        int x = static_cast<int>(gen() % 3000) * 2;
+        s.insert(x);
+        ranked.insert(x);
+        three_way.insert(x);
+    }
+    assert_batches_match(s, queries);
+    assert_batches_match(ranked, queries);
+    assert_batches_match(three_way, queries);
+    assert_batches_match(s, std::vector<int>());
+}
+
+TEST(batch_lookup, strings)
+{
+    std::vector<std::string> keys = {"b", "d", "f"};
+    set<std::string> s(keys.begin(), keys.end());
+    assert_batches_match(s, std::vector<std::string>{"a", "b", "c", "f", "g", "d"});
+}
+
+template <typename T>
+void assert_node_search_matches(std::vector<T> keys, std::vector<T> const& queries)
+{
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    std::less<T> comp;
+    key_less<std::less<T>> cmp{comp};
+    // Все длины узла, в том числе не кратные ширине вектора
+    for (int count = 0; count <= static_cast<int>(keys.size()); count++)
+        for (T x : queries)
+        {
+            ASSERT_EQ(std::lower_bound(keys.data(), keys.data() + count, x) - keys.data(),
+                      (btree_node_search<T, std::less<T>>::lower_bound(keys.data(), count, x, cmp)));
+            ASSERT_EQ(std::upper_bound(keys.data(), keys.data() + count, x) - keys.data(),
+                      (btree_node_search<T, std::less<T>>::upper_bound(keys.data(), count, x, cmp)));
+        }
+}
+
+TEST(btree_simd, node_search_matches_binary_search)
+{
+    std::mt19937 gen(89);
+    std::vector<int32_t> small = {std::numeric_limits<int32_t>::min(), -5, -1, 0, 1, 7,
+                                  std::numeric_limits<int32_t>::max()};
+    std::vector<int32_t> keys32(small), queries32(small);
+    for (int i = 0; i < 70; i++)
+    {
+        keys32.push_back(static_cast<int32_t>(gen() % 200) - 100);
+        queries32.push_back(static_cast<int32_t>(gen() % 220) - 110);
+    }
+    assert_node_search_matches(keys32, queries32);
+
+    // Ключи со старшим битом проверяют беззнаковый порядок
+    std::vector<uint64_t> big = {0, 1, 0x7FFFFFFFFFFFFFFFull, 0x8000000000000000ull,
+                                 std::numeric_limits<uint64_t>::max()};
+    std::vector<uint64_t> keys64(big), queries64(big);
+    for (int i = 0; i < 40; i++)
+    {
+        uint64_t high = gen() % 2 ? 0x8000000000000000ull : 0;
+        keys64.push_back(high | gen() % 100);
+        queries64.push_back(high | gen() % 110);
+    }
+    assert_node_search_matches(keys64, queries64);
+}
+
+template <typename T>
+void assert_btree_matches_with(std::vector<T> const& values, std::mt19937& gen)
+{
+    btree_set<T> b;
+    std::set<T> s;
+    for (int i = 0; i < 20000; i++)
+    {
+        T x = values[gen() % values.size()];
+        if (gen() % 3 != 0)
+            ASSERT_EQ(s.insert(x).second, b.insert(x).second);
+        else if (s.erase(x))
+            b.erase(b.find(x));
+        else
+            ASSERT_TRUE(b.find(x) == b.end());
+    }
+    ASSERT_EQ(s.size(), b.size());
+    ASSERT_TRUE(std::equal(s.begin(), s.end(), b.begin()));
+    for (T x : values)
+    {
+        ASSERT_EQ(s.count(x), b.count(x));
+        ASSERT_EQ(s.lower_bound(x) == s.end(), b.lower_bound(x) == b.end());
+        if (s.lower_bound(x) != s.end())
+        {
+            ASSERT_EQ(*s.lower_bound(x), *b.lower_bound(x));
+        }
+        ASSERT_EQ(s.upper_bound(x) == s.end(), b.upper_bound(x) == b.end());
+        if (s.upper_bound(x) != s.end())
+        {
+            ASSERT_EQ(*s.upper_bound(x), *b.upper_bound(x));
+        }
+    }
+}
+
+TEST(btree_simd, sets_match_std_set)
+{
+    std::mt19937 gen(97);
+    std::vector<int32_t> values32 = {std::numeric_limits<int32_t>::min(), std::numeric_limits<int32_t>::max()};
+    std::vector<uint64_t> values64 = {0, std::numeric_limits<uint64_t>::max()};
+    for (int i = 0; i < 8000; i++)
+    {
+        values32.push_back(static_cast<int32_t>(gen() % 10000) - 5000);
+        values64.push_back((gen() % 2 ? 0x8000000000000000ull : 0) | gen() % 5000);
+    }
+    assert_btree_matches_with(values32, gen);
+    assert_btree_matches_with(values64, gen);
+}
@@ -0,0 +1,1463 @@
+#ifndef MY_BTREE_SET_H
+#define MY_BTREE_SET_H
+
+#include "my_set.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <new>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE4_2__)
+#include <nmmintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Поиск позиции внутри узла B-дерева: бинарный поиск по отсортированному массиву.
+// Для конкретных типов ключей может быть специализирован более быстрым поиском.
+template <typename T, typename Compare>
+struct btree_node_search
+{
+    // Индекс первого ключа, не меньшего x
+    template <typename K>
+    static int lower_bound(T const* keys, int count, K const& x, key_less<Compare> const& less);
+
+    // Индекс первого ключа, большего x
+    template <typename K>
+    static int upper_bound(T const* keys, int count, K const& x, key_less<Compare> const& less);
+};
+
+// Для int32_t и uint64_t с обычным порядком ключи отсортированы, так что позиция --
+// это просто число ключей перед x. Оно считается по всему узлу без ветвлений:
+// сравнения блоками по 8 (int32_t, AVX2) или 4 (SSE2) ключа, для uint64_t -- по 4
+// (AVX2) или 2 (SSE4.2), маски сравнений складываются в векторе. Без нужных
+// инструкций -- обычный бинарный поиск
+template <>
+struct btree_node_search<int32_t, std::less<int32_t>>
+{
+    template <typename K>
+    static int lower_bound(int32_t const* keys, int count, K const& x, key_less<std::less<int32_t>> const&);
+    template <typename K>
+    static int upper_bound(int32_t const* keys, int count, K const& x, key_less<std::less<int32_t>> const&);
+
+private:
+    // Число первых ключей, меньших x (при inclusive -- не больших)
+    static int count_before(int32_t const* keys, int count, int32_t x, bool inclusive);
+};
+
+template <>
+struct btree_node_search<uint64_t, std::less<uint64_t>>
+{
+    template <typename K>
+    static int lower_bound(uint64_t const* keys, int count, K const& x, key_less<std::less<uint64_t>> const&);
+    template <typename K>
+    static int upper_bound(uint64_t const* keys, int count, K const& x, key_less<std::less<uint64_t>> const&);
+
+private:
+    static int count_before(uint64_t const* keys, int count, uint64_t x, bool inclusive);
+};
+
+// B+-дерево: все ключи лежат в листьях, листья связаны в двусвязный список,
+// во внутренних узлах хранятся копии разделяющих ключей. Узел занимает
+// несколько кэш-линий, так что на уровень приходится один-два промаха кэша
+// вместо промаха на каждое сравнение.
+//
+// В отличие от set, вставка и удаление инвалидируют итераторы
+// (ключи перемещаются внутри узлов и между ними).
+template <typename T, typename Compare = std::less<T>, typename Allocator = std::allocator<T>>
+class btree_set
+{
+public:
+    typedef T key_type;
+    typedef T value_type;
+    typedef Compare key_compare;
+    typedef Compare value_compare;
+
+private:
+    static const size_t node_bytes = 256;
+    static const int capacity = node_bytes / sizeof(T) > 4 ? static_cast<int>(node_bytes / sizeof(T)) : 4;
+    static const int min_count = capacity / 2;
+
+    typedef typename std::aligned_storage<sizeof(T), alignof(T)>::type slot;
+
+    struct InnerNode;
+
+    struct NodeBase
+    {
+        InnerNode* parent;
+        int count;
+        bool leaf;
+        // Лишний слот позволяет сначала вставить ключ в полный узел, а потом разделить его
+        slot slots[capacity + 1];
+
+        explicit NodeBase(bool leaf);
+
+        T* keys();
+        T const* keys() const;
+    };
+
+    struct LeafNode : public NodeBase
+    {
+        LeafNode *prev, *next;
+
+        LeafNode();
+    };
+
+    struct InnerNode : public NodeBase
+    {
+        NodeBase* children[capacity + 2];
+
+        InnerNode();
+    };
+
+    template <typename U>
+    class Iterator : public std::iterator<std::bidirectional_iterator_tag, U>
+    {
+        friend class btree_set;
+
+    private:
+        LeafNode* leaf;
+        int pos;
+
+    public:
+        Iterator();
+        Iterator(LeafNode* leaf, int pos);
+
+        template <typename V>
+        Iterator(Iterator<V> const& other);
+
+        U& operator*() const;
+        U* operator->() const;
+
+        template <typename V>
+        bool operator==(Iterator<V> const& other) const;
+        template <typename V>
+        bool operator!=(Iterator<V> const& other) const;
+
+        Iterator& operator++();
+        Iterator operator++(int);
+        Iterator& operator--();
+        Iterator operator--(int);
+    };
+
+    typedef typename std::allocator_traits<Allocator>::template rebind_alloc<LeafNode> leaf_allocator;
+    typedef typename std::allocator_traits<Allocator>::template rebind_alloc<InnerNode> inner_allocator;
+    typedef std::allocator_traits<leaf_allocator> leaf_traits;
+    typedef std::allocator_traits<inner_allocator> inner_traits;
+
+public:
+    using allocator_type = Allocator;
+    using iterator = Iterator<T const>;
+    using const_iterator = Iterator<T const>;
+    using reverse_iterator = std::reverse_iterator<iterator>;
+    using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+private:
+    size_t siz;
+    NodeBase* root;
+    LeafNode* head;
+    LeafNode* tail;
+    leaf_allocator leaf_alloc;
+    inner_allocator inner_alloc;
+    Compare comp;
+
+    key_less<Compare> less() const;
+
+    LeafNode* create_leaf();
+    InnerNode* create_inner();
+    void destroy_node(NodeBase* node);
+    void destroy_tree(NodeBase* node);
+    NodeBase* clone(NodeBase const* node, InnerNode* parent);
+    void link_leaves(NodeBase* node, LeafNode*& last_leaf);
+
+    template <typename... Args>
+    static void insert_key(T* keys, int count, int pos, Args&&... args);
+    static void erase_key(T* keys, int count, int pos);
+    static void move_keys(T* from, int count, T* to);
+    static void insert_child(InnerNode* node, int pos, NodeBase* child);
+    static void erase_child(InnerNode* node, int pos);
+    static int child_index(InnerNode const* parent, NodeBase const* child);
+
+    template <typename K>
+    LeafNode* find_leaf(K const& x) const;
+    static iterator normalize(LeafNode* leaf, int pos);
+
+    template <typename V>
+    std::pair<iterator, bool> insert_unique(V&& x);
+    template <typename V>
+    iterator insert_into_leaf(LeafNode* leaf, int pos, V&& x);
+    void insert_into_parent(NodeBase* left, T separator, NodeBase* right);
+    void split_inner(InnerNode* node);
+    void rebalance_leaf(LeafNode* leaf, LeafNode*& next_leaf, int& next_pos);
+    void rebalance_inner(InnerNode* node);
+
+    template <typename K>
+    const_iterator find_impl(K const& x) const;
+    template <typename K>
+    const_iterator lower_bound_impl(K const& x) const;
+    template <typename K>
+    const_iterator upper_bound_impl(K const& x) const;
+    template <typename K>
+    std::pair<const_iterator, const_iterator> equal_range_impl(K const& x) const;
+
+    void swap_trees(btree_set& other);
+
+public:
+    btree_set();
+    explicit btree_set(Compare const& comp, Allocator const& allocator = Allocator());
+    explicit btree_set(Allocator const& allocator);
+    btree_set(btree_set const& other);
+    btree_set(btree_set const& other, Allocator const& allocator);
+    btree_set(btree_set&& other) noexcept;
+    template <typename ForwardIt>
+    btree_set(sorted_unique_t, ForwardIt first, ForwardIt last,
+              Compare const& comp = Compare(), Allocator const& allocator = Allocator());
+
+    ~btree_set();
+
+    btree_set& operator=(btree_set const& other);
+    btree_set& operator=(btree_set&& other) noexcept(leaf_traits::propagate_on_container_move_assignment::value);
+
+    allocator_type get_allocator() const;
+    key_compare key_comp() const;
+    value_compare value_comp() const;
+
+    std::pair<iterator, bool> insert(value_type const& x);
+    std::pair<iterator, bool> insert(value_type&& x);
+    template <typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args);
+    iterator erase(const_iterator iter);
+
+    const_iterator find(value_type const& x) const;
+    template <typename K, typename C = Compare, typename = typename C::is_transparent>
+    const_iterator find(K const& x) const;
+    const_iterator lower_bound(value_type const& x) const;
+    template <typename K, typename C = Compare, typename = typename C::is_transparent>
+    const_iterator lower_bound(K const& x) const;
+    const_iterator upper_bound(value_type const& x) const;
+    template <typename K, typename C = Compare, typename = typename C::is_transparent>
+    const_iterator upper_bound(K const& x) const;
+    std::pair<const_iterator, const_iterator> equal_range(value_type const& x) const;
+    template <typename K, typename C = Compare, typename = typename C::is_transparent>
+    std::pair<const_iterator, const_iterator> equal_range(K const& x) const;
+    size_t count(value_type const& x) const;
+    template <typename K, typename C = Compare, typename = typename C::is_transparent>
+    size_t count(K const& x) const;
+    bool contains(value_type const& x) const;
+    template <typename K, typename C = Compare, typename = typename C::is_transparent>
+    bool contains(K const& x) const;
+
+    bool empty() const;
+    size_t size() const;
+    size_t height() const;
+    void clear();
+
+    iterator begin() const;
+    iterator end() const;
+    const_iterator cbegin() const;
+    const_iterator cend() const;
+    reverse_iterator rbegin() const;
+    reverse_iterator rend() const;
+    const_reverse_iterator crbegin() const;
+    const_reverse_iterator crend() const;
+
+    void swap(btree_set& other);
+};
+
+
+/// NODE SEARCH IMPLEMENTATION ===============================================================
+
+template <typename T, typename Compare>
+template <typename K>
+int btree_node_search<T, Compare>::lower_bound(T const* keys, int count, K const& x, key_less<Compare> const& less)
+{
+    int lo = 0;
+    while (count > 0)
+    {
+        int half = count / 2;
+        if (less(keys[lo + half], x))
+        {
+            lo += half + 1;
+            count -= half + 1;
+        }
+        else
+            count = half;
+    }
+    return lo;
+}
+
+template <typename T, typename Compare>
+template <typename K>
+int btree_node_search<T, Compare>::upper_bound(T const* keys, int count, K const& x, key_less<Compare> const& less)
+{
+    int lo = 0;
+    while (count > 0)
+    {
+        int half = count / 2;
+        if (!less(x, keys[lo + half]))
+        {
+            lo += half + 1;
+            count -= half + 1;
+        }
+        else
+            count = half;
+    }
+    return lo;
+}
+
+
+/// SIMD NODE SEARCH IMPLEMENTATION ==========================================================
+
+template <typename K>
+int btree_node_search<int32_t, std::less<int32_t>>::lower_bound(int32_t const* keys, int count, K const& x,
+                                                                key_less<std::less<int32_t>> const&)
+{
+    return count_before(keys, count, static_cast<int32_t>(x), false);
+}
+
+template <typename K>
+int btree_node_search<int32_t, std::less<int32_t>>::upper_bound(int32_t const* keys, int count, K const& x,
+                                                                key_less<std::less<int32_t>> const&)
+{
+    return count_before(keys, count, static_cast<int32_t>(x), true);
+}
+
+inline int btree_node_search<int32_t, std::less<int32_t>>::count_before(int32_t const* keys, int count, int32_t x,
+                                                                        bool inclusive)
+{
+    // Маска сравнения -- -1 в совпавших дорожках. При inclusive считаются ключи
+    // больше x и вычитаются из числа просмотренных
+    int i = 0;
+    int result = 0;
+#if defined(__AVX2__)
+    __m256i bound = _mm256_set1_epi32(x);
+    __m256i sum = _mm256_setzero_si256();
+    if (inclusive)
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256i block = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(keys + i));
+            sum = _mm256_add_epi32(sum, _mm256_cmpgt_epi32(block, bound));
+        }
+    else
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256i block = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(keys + i));
+            sum = _mm256_sub_epi32(sum, _mm256_cmpgt_epi32(bound, block));
+        }
+    __m128i total = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    total = _mm_add_epi32(total, _mm_shuffle_epi32(total, 0x4E));
+    total = _mm_add_epi32(total, _mm_shuffle_epi32(total, 0xB1));
+    result = (inclusive ? i : 0) + _mm_cvtsi128_si32(total);
+#elif defined(__SSE2__)
+    __m128i bound = _mm_set1_epi32(x);
+    __m128i sum = _mm_setzero_si128();
+    if (inclusive)
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128i block = _mm_loadu_si128(reinterpret_cast<__m128i const*>(keys + i));
+            sum = _mm_add_epi32(sum, _mm_cmpgt_epi32(block, bound));
+        }
+    else
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128i block = _mm_loadu_si128(reinterpret_cast<__m128i const*>(keys + i));
+            sum = _mm_sub_epi32(sum, _mm_cmpgt_epi32(bound, block));
+        }
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4E));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xB1));
+    result = (inclusive ? i : 0) + _mm_cvtsi128_si32(sum);
+#else
+    // Подсчёт по одному ключу медленнее бинарного поиска
+    return static_cast<int>((inclusive ? std::upper_bound(keys, keys + count, x)
+                                       : std::lower_bound(keys, keys + count, x)) - keys);
+#endif
+    for (; i < count; i++)
+        result += inclusive ? keys[i] <= x : keys[i] < x;
+    return result;
+}
+
+template <typename K>
+int btree_node_search<uint64_t, std::less<uint64_t>>::lower_bound(uint64_t const* keys, int count, K const& x,
+                                                                  key_less<std::less<uint64_t>> const&)
+{
+    return count_before(keys, count, static_cast<uint64_t>(x), false);
+}
+
+template <typename K>
+int btree_node_search<uint64_t, std::less<uint64_t>>::upper_bound(uint64_t const* keys, int count, K const& x,
+                                                                  key_less<std::less<uint64_t>> const&)
+{
+    return count_before(keys, count, static_cast<uint64_t>(x), true);
+}
+
+inline int btree_node_search<uint64_t, std::less<uint64_t>>::count_before(uint64_t const* keys, int count, uint64_t x,
+                                                                          bool inclusive)
+{
+    // Векторные сравнения 64-битных чисел знаковые: сдвиг на 2^63 сохраняет беззнаковый порядок
+    int i = 0;
+    int result = 0;
+#if defined(__AVX2__)
+    __m256i sign = _mm256_set1_epi64x(static_cast<long long>(0x8000000000000000ull));
+    __m256i bound = _mm256_xor_si256(_mm256_set1_epi64x(static_cast<long long>(x)), sign);
+    __m256i sum = _mm256_setzero_si256();
+    if (inclusive)
+        for (; i + 4 <= count; i += 4)
+        {
+            __m256i block = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<__m256i const*>(keys + i)), sign);
+            sum = _mm256_add_epi64(sum, _mm256_cmpgt_epi64(block, bound));
+        }
+    else
+        for (; i + 4 <= count; i += 4)
+        {
+            __m256i block = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<__m256i const*>(keys + i)), sign);
+            sum = _mm256_sub_epi64(sum, _mm256_cmpgt_epi64(bound, block));
+        }
+    __m128i total = _mm_add_epi64(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    total = _mm_add_epi64(total, _mm_unpackhi_epi64(total, total));
+    result = (inclusive ? i : 0) + static_cast<int>(_mm_cvtsi128_si64(total));
+#elif defined(__SSE4_2__)
+    __m128i sign = _mm_set1_epi64x(static_cast<long long>(0x8000000000000000ull));
+    __m128i bound = _mm_xor_si128(_mm_set1_epi64x(static_cast<long long>(x)), sign);
+    __m128i sum = _mm_setzero_si128();
+    if (inclusive)
+        for (; i + 2 <= count; i += 2)
+        {
+            __m128i block = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<__m128i const*>(keys + i)), sign);
+            sum = _mm_add_epi64(sum, _mm_cmpgt_epi64(block, bound));
+        }
+    else
+        for (; i + 2 <= count; i += 2)
+        {
+            __m128i block = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<__m128i const*>(keys + i)), sign);
+            sum = _mm_sub_epi64(sum, _mm_cmpgt_epi64(bound, block));
+        }
+    sum = _mm_add_epi64(sum, _mm_unpackhi_epi64(sum, sum));
+    result = (inclusive ? i : 0) + static_cast<int>(_mm_cvtsi128_si64(sum));
+#else
+    return static_cast<int>((inclusive ? std::upper_bound(keys, keys + count, x)
+                                       : std::lower_bound(keys, keys + count, x)) - keys);
+#endif
+    for (; i < count; i++)
+        result += inclusive ? keys[i] <= x : keys[i] < x;
+    return result;
+}
+
+/// NODES IMPLEMENTATION =====================================================================
+
+template <typename T, typename Compare, typename Allocator>
+btree_set<T, Compare, Allocator>::NodeBase::NodeBase(bool leaf)
+        : parent(nullptr),
+          count(0),
+          leaf(leaf)
+{}
+
+template <typename T, typename Compare, typename Allocator>
+T* btree_set<T, Compare, Allocator>::NodeBase::keys()
+{
+    return reinterpret_cast<T*>(slots);
+}
+
+template <typename T, typename Compare, typename Allocator>
+T const* btree_set<T, Compare, Allocator>::NodeBase::keys() const
+{
+    return reinterpret_cast<T const*>(slots);
+}
+
+template <typename T, typename Compare, typename Allocator>
+btree_set<T, Compare, Allocator>::LeafNode::LeafNode()
+        : NodeBase(true),
+          prev(nullptr),
+          next(nullptr)
+{}
+
+template <typename T, typename Compare, typename Allocator>
+btree_set<T, Compare, Allocator>::InnerNode::InnerNode()
+        : NodeBase(false)
+{}
+
+/// ITERATORS IMPLEMENTATION =================================================================
+
+template <typename T, typename Compare, typename Allocator>
+template <typename U>
+btree_set<T, Compare, Allocator>::Iterator<U>::Iterator()
+        : leaf(nullptr),
+          pos(0)
+{}
+
+template <typename T, typename Compare, typename Allocator>
+template <typename U>
+btree_set<T, Compare, Allocator>::Iterator<U>::Iterator(LeafNode* leaf, int pos)
+        : leaf(leaf),
+          pos(pos)
+{}
+
+template <typename T, typename Compare, typename Allocator>
+template <typename U>
+template <typename V>
+btree_set<T, Compare, Allocator>::Iterator<U>::Iterator(Iterator<V> const& other)
+        : leaf(other.leaf),
+          pos(other.pos)
+{}
+
+template <typename T, typename Compare, typename Allocator>
+template <typename U>
+U& btree_set<T, Compare, Allocator>::Iterator<U>::operator*() const
+{
+    return leaf->keys()[pos];
+}
+
+template <typename T, typename Compare, typename Allocator>
+template <typename U>
+U* btree_set<T, Compare, Allocator>::Iterator<U>::operator->() const
+{
+    return leaf->keys() + pos;
+}
+
+template <typename T, typename Compare, typename Allocator>
+template <typename U>
+template <typename V>
+bool btree_set<T, Compare, Allocator>::Iterator<U>::operator==(Iterator<V> const& other) const
+{
+    return leaf == other.leaf && pos == other.pos;
+}
+
+template <typename T, typename Compare, typename Allocator>
+template <typename U>
+template <typename V>
+bool btree_set<T, Compare, Allocator>::Iterator<U>::operator!=(Iterator<V> const& other) const
+{
+    return !(*this == other);
+}
+
+template <typename T, typename Compare, typename Allocator>
+template <typename U>
+typename btree_set<T, Compare, Allocator>::template Iterator<U>& btree_set<T, Compare, Allocator>::Iterator<U>::operator++()
+{
+    // end() -- это позиция за последним ключом последнего листа
+    if (++pos == leaf->count && leaf->next)
+    {
+        leaf = leaf->next;
+        pos = 0;
+    }
+    return *this;
+}
+
+template <typename T, typename Compare, typename Allocator>
+template <typename U>
+typename btree_set<T, Compare, Allocator>::template Iterator<U>& btree_set<T, Compare, Allocator>::Iterator<U>::operator--()
+{
+    if (pos == 0)
+    {
+        leaf = leaf->prev;
+        pos = leaf->count;
+    }
+    --pos;
+    return *this;
+}
+
+template <typename T, typename Compare, typename Allocator>
+template <typename U>
+typename btree_set<T, Compare, Allocator>::template Iterator<U> btree_set<T, Compare, Allocator>::Iterator<U>::operator++(int)
+{
+    auto tmp(*this);
+    ++(*this);
+    return tmp;
+}
+
+template <typename T, typename Compare, typename Allocator>
+template <typename U>
+typename btree_set<T, Compare, Allocator>::template Iterator<U> btree_set<T, Compare, Allocator>::Iterator<U>::operator--(int)
+{
+    auto tmp(*this);
+    --(*this);
+    return tmp;
+}
+
+/// BTREE SET IMPLEMENTATION =================================================================
+
+template <typename T, typename Compare, typename Allocator>
+btree_set<T, Compare, Allocator>::btree_set()
+        : siz(0),
+          root(nullptr),
+          head(nullptr),
+          tail(nullptr),
+          leaf_alloc(),
+          inner_alloc(),
+          comp()
+{}
+
+template <typename T, typename Compare, typename Allocator>
+btree_set<T, Compare, Allocator>::btree_set(Compare const& comp, Allocator const& allocator)
+        : siz(0),
+          root(nullptr),
+          head(nullptr),
+          tail(nullptr),
+          leaf_alloc(allocator),
+          inner_alloc(allocator),
+          comp(comp)
+{}
+
+template <typename T, typename Compare, typename Allocator>
+btree_set<T, Compare, Allocator>::btree_set(Allocator const& allocator)
+        : siz(0),
+          root(nullptr),
+          head(nullptr),
+          tail(nullptr),
+          leaf_alloc(allocator),
+          inner_alloc(allocator),
+          comp()
+{}
+
+template <typename T, typename Compare, typename Allocator>
+btree_set<T, Compare, Allocator>::btree_set(btree_set const& other)
+        : siz(0),
+          root(nullptr),
+          head(nullptr),
+          tail(nullptr),
+          leaf_alloc(leaf_traits::select_on_container_copy_construction(other.leaf_alloc)),
+          inner_alloc(inner_traits::select_on_container_copy_construction(other.inner_alloc)),
+          comp(other.comp)
+{
+    root = clone(other.root, nullptr);
+    link_leaves(root, tail);
+    siz = other.siz;
+}
+
+template <typename T, typename Compare, typename Allocator>
+btree_set<T, Compare, Allocator>::btree_set(btree_set const& other, Allocator const& allocator)
+        : siz(0),
+          root(nullptr),
+          head(nullptr),
+          tail(nullptr),
+          leaf_alloc(allocator),
+          inner_alloc(allocator),
+          comp(other.comp)
+{
+    root = clone(other.root, nullptr);
+    link_leaves(root, tail);
+    siz = other.siz;
+}
+
+template <typename T, typename Compare, typename Allocator>
+btree_set<T, Compare, Allocator>::btree_set(btree_set&& other) noexcept
+        : siz(0),
+          root(nullptr),
+          head(nullptr),
+          tail(nullptr),
+          leaf_alloc(std::move(other.leaf_alloc)),
+          inner_alloc(std::move(other.inner_alloc)),
+          comp(other.comp)
+{
+    swap_trees(other);
+}
+
+template <typename T, typename Compare, typename Allocator>
+template <typename ForwardIt>
+btree_set<T, Compare, Allocator>::btree_set(sorted_unique_t, ForwardIt first, ForwardIt last,
+                                            Compare const& comp, Allocator const& allocator)
+        : siz(0),
+          root(nullptr),
+          head(nullptr),
+          tail(nullptr),
+          leaf_alloc(allocator),
+          inner_alloc(allocator),
+          comp(comp)
+{
+    // Ключи отсортированы, поэтому каждый следующий попадает в конец последнего листа
+    try
+    {
+        for (; first != last; ++first)
+        {
+            if (!tail)
+                insert_unique(*first);
+            else
+                insert_into_leaf(tail, tail->count, *first);
+        }
+    }
+    catch (...)
+    {
+        destroy_tree(root);
+        throw;
+    }
+}
+
+template <typename T, typename Compare, typename Allocator>
+btree_set<T, Compare, Allocator>::~btree_set()
+{
+    destroy_tree(root);
+}
+
+template <typename T, typename Compare, typename Allocator>
+btree_set<T, Compare, Allocator>& btree_set<T, Compare, Allocator>::operator=(btree_set const& other)
+{
+    if (this != &other)
+    {
+        bool propagate = leaf_traits::propagate_on_container_copy_assignment::value;
+        btree_set tmp(other, propagate ? other.get_allocator() : get_allocator());
+        swap_trees(tmp);
+        std::swap(leaf_alloc, tmp.leaf_alloc);
+        std::swap(inner_alloc, tmp.inner_alloc);
+        std::swap(comp, tmp.comp);
+    }
+    return *this;
+}
+
+template <typename T, typename Compare, typename Allocator>
+btree_set<T, Compare, Allocator>& btree_set<T, Compare, Allocator>::operator=(btree_set&& other)
+        noexcept(leaf_traits::propagate_on_container_move_assignment::value)
+{
+    if (this == &other)
+        return *this;
+
+    if (leaf_traits::propagate_on_container_move_assignment::value || leaf_alloc == other.leaf_alloc)
+    {
+        clear();
+        swap_trees(other);
+        leaf_alloc = other.leaf_alloc;
+        inner_alloc = other.inner_alloc;
+    }
+    else
+    {
+        btree_set tmp(other, get_allocator());
+        swap_trees(tmp);
+    }
+    comp = other.comp;
+    return *this;
+}
+
+template <typename T, typename Compare, typename Allocator>
+typename btree_set<T, Compare, Allocator>::allocator_type btree_set<T, Compare, Allocator>::get_allocator() const
+{
+    return allocator_type(leaf_alloc);
+}
+
+template <typename T, typename Compare, typename Allocator>
+typename btree_set<T, Compare, Allocator>::key_compare btree_set<T, Compare, Allocator>::key_comp() const
+{
+    return comp;
+}
+
+template <typename T, typename Compare, typename Allocator>
+typename btree_set<T, Compare, Allocator>::value_compare btree_set<T, Compare, Allocator>::value_comp() const
+{
+    return comp;
+}
+
+template <typename T, typename Compare, typename Allocator>
+key_less<Compare> btree_set<T, Compare, Allocator>::less() const
+{
+    return key_less<Compare>{comp};
+}
+
+template <typename T, typename Compare, typename Allocator>
+typename btree_set<T, Compare, Allocator>::LeafNode* btree_set<T, Compare, Allocator>::create_leaf()
+{
+    LeafNode* node = leaf_traits::allocate(leaf_alloc, 1);
+    leaf_traits::construct(leaf_alloc, node);
+    return node;
+}
+
+template <typename T, typename Compare, typename Allocator>
+typename btree_set<T, Compare, Allocator>::InnerNode* btree_set<T, Compare, Allocator>::create_inner()
+{
+    InnerNode* node = inner_traits::allocate(inner_alloc, 1);
+    inner_traits::construct(inner_alloc, node);
+    return node;
+}
+
+template <typename T, typename Compare, typename Allocator>
+void btree_set<T, Compare, Allocator>::destroy_node(NodeBase* node)
+{
+    for (int i = 0; i < node->count; i++)
+        node->keys()[i].~T();
+    if (node->leaf)
+    {
+        LeafNode* leaf = static_cast<LeafNode*>(node);
+        leaf_traits::destroy(leaf_alloc, leaf);
+        leaf_traits::deallocate(leaf_alloc, leaf, 1);
+    }
+    else
+    {
+        InnerNode* inner = static_cast<InnerNode*>(node);
+        inner_traits::destroy(inner_alloc, inner);
+        inner_traits::deallocate(inner_alloc, inner, 1);
+    }
+}
+
+template <typename T, typename Compare, typename Allocator>
+void btree_set<T, Compare, Allocator>::destroy_tree(NodeBase* node)
+{
+    // Глубина B-дерева -- единицы уровней, рекурсия безопасна
+    if (!node)
+        return;
+    if (!node->leaf)
+    {
+        InnerNode* inner = static_cast<InnerNode*>(node);
+        for (int i = 0; i <= inner->count; i++)
+            destroy_tree(inner->children[i]);
+    }
+    destroy_node(node);
+}
+
+template <typename T, typename Compare, typename Allocator>
+typename btree_set<T, Compare, Allocator>::NodeBase*
+btree_set<T, Compare, Allocator>::clone(NodeBase const* node, InnerNode* parent)
+{
+    // Копирует поддерево вместе с разделителями; список листьев связывается отдельно
+    if (!node)
+        return nullptr;
+
+    NodeBase* copy;
+    if (node->leaf)
+        copy = create_leaf();
+    else
+        copy = create_inner();
+    copy->parent = parent;
+
+    int children = 0;
+    try
+    {
+        for (; copy->count < node->count; copy->count++)
+            ::new (copy->keys() + copy->count) T(node->keys()[copy->count]);
+        if (!node->leaf)
+        {
+            InnerNode const* inner = static_cast<InnerNode const*>(node);
+            InnerNode* inner_copy = static_cast<InnerNode*>(copy);
+            for (; children <= inner->count; children++)
+                inner_copy->children[children] = clone(inner->children[children], inner_copy);
+        }
+    }
+    catch (...)
+    {
+        for (int i = 0; i < children; i++)
+            destroy_tree(static_cast<InnerNode*>(copy)->children[i]);
+        destroy_node(copy);
+        throw;
+    }
+    return copy;
+}
+
+template <typename T, typename Compare, typename Allocator>
+void btree_set<T, Compare, Allocator>::link_leaves(NodeBase* node, LeafNode*& last_leaf)
+{
+    if (!node)
+        return;
+    if (!node->leaf)
+    {
+        InnerNode* inner = static_cast<InnerNode*>(node);
+        for (int i = 0; i <= inner->count; i++)
+            link_leaves(inner->children[i], last_leaf);
+        return;
+    }
+
+    LeafNode* leaf = static_cast<LeafNode*>(node);
+    leaf->prev = last_leaf;
+    leaf->next = nullptr;
+    if (last_leaf)
+        last_leaf->next = leaf;
+    else
+        head = leaf;
+    last_leaf = leaf;
+}
+
+template <typename T, typename Compare, typename Allocator>
+template <typename... Args>
+void btree_set<T, Compare, Allocator>::insert_key(T* keys, int count, int pos, Args&&... args)
+{
+    // В keys[count] ещё нет объекта: сдвигаем хвост на одну позицию вправо
+    if (pos == count)
+    {
+        ::new (keys + count) T(std::forward<Args>(args)...);
+        return;
+    }
+    T value(std::forward<Args>(args)...);
+    ::new (keys + count) T(std::move(keys[count - 1]));
+    std::move_backward(keys + pos, keys + count - 1, keys + count);
+    keys[pos] = std::move(value);
+}
+
+template <typename T, typename Compare, typename Allocator>
+void btree_set<T, Compare, Allocator>::erase_key(T* keys, int count, int pos)
+{
+    std::move(keys + pos + 1, keys + count, keys + pos);
+    keys[count - 1].~T();
+}
+
+template <typename T, typename Compare, typename Allocator>
+void btree_set<T, Compare, Allocator>::move_keys(T* from, int count, T* to)
+{
+    // to -- неинициализированная память, from после переноса разрушается
+    for (int i = 0; i < count; i++)
+    {
+        ::new (to + i) T(std::move(from[i]));
+        from[i].~T();
+    }
+}
+
+template <typename T, typename Compare, typename Allocator>
+void btree_set<T, Compare, Allocator>::insert_child(InnerNode* node, int pos, NodeBase* child)
+{
+    std::copy_backward(node->children + pos, node->children + node->count + 1, node->children + node->count + 2);
+    node->children[pos] = child;
+    child->parent = node;
+}
+
+template <typename T, typename Compare, typename Allocator>
+void btree_set<T, Compare, Allocator>::erase_child(InnerNode* node, int pos)
+{
+    std::copy(node->children + pos + 1, node->children + node->count + 1, node->children + pos);
+}
+
+template <typename T, typename Compare, typename Allocator>
+int btree_set<T, Compare, Allocator>::child_index(InnerNode const* parent, NodeBase const* child)
+{
+    int i = 0;
+    while (parent->children[i] != child)
+        i++;
+    return i;
+}
+
+template <typename T, typename Compare, typename Allocator>
+template <typename K>
+typename btree_set<T, Compare, Allocator>::LeafNode* btree_set<T, Compare, Allocator>::find_leaf(K const& x) const
+{
+    // Во внутреннем узле ключ x лежит в поддереве children[i], где i -- число разделителей <= x
+    NodeBase* cur = root;
+    key_less<Compare> cmp = less();
+    while (!cur->leaf)
+    {
+        InnerNode* inner = static_cast<InnerNode*>(cur);
+        cur = inner->children[btree_node_search<T, Compare>::upper_bound(inner->keys(), inner->count, x, cmp)];
+    }
+    return static_cast<LeafNode*>(cur);
+}
+
+template <typename T, typename Compare, typename Allocator>
+typename btree_set<T, Compare, Allocator>::iterator btree_set<T, Compare, Allocator>::normalize(LeafNode* leaf, int pos)
+{
+    // Позиция за концом листа, если лист не последний, -- это начало следующего листа
+    if (pos == leaf->count && leaf->next)
+        return iterator(leaf->next, 0);
+    return iterator(leaf, pos);
+}
+
+template <typename T, typename Compare, typename Allocator>
+template <typename V>
+std::pair<typename btree_set<T, Compare, Allocator>::iterator, bool> btree_set<T, Compare, Allocator>::insert_unique(V&& x)
+{
+    if (!root)
+    {
+        LeafNode* leaf = create_leaf();
+        root = head = tail = leaf;
+        return { insert_into_leaf(leaf, 0, std::forward<V>(x)), true };
+    }
+
+    LeafNode* leaf = find_leaf(x);
+    key_less<Compare> cmp = less();
+    int pos = btree_node_search<T, Compare>::lower_bound(leaf->keys(), leaf->count, x, cmp);
+    if (pos < leaf->count && !cmp(x, leaf->keys()[pos]))
+        return { iterator(leaf, pos), false };
+    return { insert_into_leaf(leaf, pos, std::forward<V>(x)), true };
+}
+
+template <typename T, typename Compare, typename Allocator>
+template <typename V>
+typename btree_set<T, Compare, Allocator>::iterator btree_set<T, Compare, Allocator>::insert_into_leaf(LeafNode* leaf, int pos, V&& x)
+{
+    insert_key(leaf->keys(), leaf->count, pos, std::forward<V>(x));
+    leaf->count++;
+    siz++;
+    if (leaf->count <= capacity)
+        return iterator(leaf, pos);
+
+    // Переполнение: правая половина уходит в новый лист, копия её первого
+    // ключа становится разделителем в родителе
+    LeafNode* right;
+    try
+    {
+        right = create_leaf();
+    }
+    catch (...)
+    {
+        erase_key(leaf->keys(), leaf->count, pos);
+        leaf->count--;
+        siz--;
+        throw;
+    }
+    int mid = (capacity + 1) / 2;
+    move_keys(leaf->keys() + mid, leaf->count - mid, right->keys());
+    right->count = leaf->count - mid;
+    leaf->count = mid;
+
+    right->prev = leaf;
+    right->next = leaf->next;
+    if (leaf->next)
+        leaf->next->prev = right;
+    else
+        tail = right;
+    leaf->next = right;
+
+    insert_into_parent(leaf, right->keys()[0], right);
+    return pos < mid ? iterator(leaf, pos) : iterator(right, pos - mid);
+}
+
+template <typename T, typename Compare, typename Allocator>
+void btree_set<T, Compare, Allocator>::insert_into_parent(NodeBase* left, T separator, NodeBase* right)
+{
+    InnerNode* parent = left->parent;
+    if (!parent)
+    {
+        InnerNode* new_root = create_inner();
+        ::new (new_root->keys()) T(std::move(separator));
+        new_root->count = 1;
+        new_root->children[0] = left;
+        new_root->children[1] = right;
+        left->parent = new_root;
+        right->parent = new_root;
+        root = new_root;
+        return;
+    }
+
+    int idx = child_index(parent, left);
+    insert_key(parent->keys(), parent->count, idx, std::move(separator));
+    insert_child(parent, idx + 1, right);
+    parent->count++;
+    if (parent->count > capacity)
+        split_inner(parent);
+}
+
+template <typename T, typename Compare, typename Allocator>
+void btree_set<T, Compare, Allocator>::split_inner(InnerNode* node)
+{
+    // Средний ключ поднимается в родителя, правая половина уходит в новый узел
+    InnerNode* right = create_inner();
+    int mid = node->count / 2;
+    T separator(std::move(node->keys()[mid]));
+    node->keys()[mid].~T();
+
+    int right_count = node->count - mid - 1;
+    move_keys(node->keys() + mid + 1, right_count, right->keys());
+    for (int i = 0; i <= right_count; i++)
+    {
+        right->children[i] = node->children[mid + 1 + i];
+        right->children[i]->parent = right;
+    }
+    right->count = right_count;
+    node->count = mid;
+
+    insert_into_parent(node, std::move(separator), right);
+}
+
+template <typename T, typename Compare, typename Allocator>
+void btree_set<T, Compare, Allocator>::rebalance_leaf(LeafNode* leaf, LeafNode*& next_leaf, int& next_pos)
+{
+    // После удаления ключа из leaf: заём у соседа или слияние с ним.
+    // (next_leaf, next_pos) -- позиция следующего за удалённым ключа, её сдвигаем вслед за ключами
+    if (leaf == root)
+    {
+        if (leaf->count == 0)
+        {
+            destroy_node(leaf);
+            root = head = tail = nullptr;
+            next_leaf = nullptr;
+            next_pos = 0;
+        }
+        return;
+    }
+    if (leaf->count >= min_count)
+        return;
+
+    InnerNode* parent = leaf->parent;
+    int idx = child_index(parent, leaf);
+    LeafNode* left = idx > 0 ? static_cast<LeafNode*>(parent->children[idx - 1]) : nullptr;
+    LeafNode* right = idx < parent->count ? static_cast<LeafNode*>(parent->children[idx + 1]) : nullptr;
+
+    if (left && left->count > min_count)
+    {
+        insert_key(leaf->keys(), leaf->count, 0, std::move(left->keys()[left->count - 1]));
+        left->keys()[left->count - 1].~T();
+        left->count--;
+        leaf->count++;
+        parent->keys()[idx - 1] = leaf->keys()[0];
+        next_pos++;
+        return;
+    }
+    if (right && right->count > min_count)
+    {
+        ::new (leaf->keys() + leaf->count) T(std::move(right->keys()[0]));
+        leaf->count++;
+        erase_key(right->keys(), right->count, 0);
+        right->count--;
+        parent->keys()[idx] = right->keys()[0];
+        return;
+    }
+
+    if (left)
+    {
+        next_leaf = left;
+        next_pos += left->count;
+        move_keys(leaf->keys(), leaf->count, left->keys() + left->count);
+        left->count += leaf->count;
+        leaf->count = 0;
+        left->next = leaf->next;
+        if (leaf->next)
+            leaf->next->prev = left;
+        else
+            tail = left;
+        erase_key(parent->keys(), parent->count, idx - 1);
+        erase_child(parent, idx);
+        destroy_node(leaf);
+    }
+    else
+    {
+        move_keys(right->keys(), right->count, leaf->keys() + leaf->count);
+        leaf->count += right->count;
+        right->count = 0;
+        leaf->next = right->next;
+        if (right->next)
+            right->next->prev = leaf;
+        else
+            tail = leaf;
+        erase_key(parent->keys(), parent->count, idx);
+        erase_child(parent, idx + 1);
+        destroy_node(right);
+    }
+    parent->count--;
+    rebalance_inner(parent);
+}
+
+template <typename T, typename Compare, typename Allocator>
+void btree_set<T, Compare, Allocator>::rebalance_inner(InnerNode* node)
+{
+    if (node == root)
+    {
+        if (node->count == 0)
+        {
+            root = node->children[0];
+            root->parent = nullptr;
+            destroy_node(node);
+        }
+        return;
+    }
+    if (node->count >= min_count)
+        return;
+
+    InnerNode* parent = node->parent;
+    int idx = child_index(parent, node);
+    InnerNode* left = idx > 0 ? static_cast<InnerNode*>(parent->children[idx - 1]) : nullptr;
+    InnerNode* right = idx < parent->count ? static_cast<InnerNode*>(parent->children[idx + 1]) : nullptr;
+
+    if (left && left->count > min_count)
+    {
+        // Поворот вправо через разделитель в родителе
+        insert_key(node->keys(), node->count, 0, std::move(parent->keys()[idx - 1]));
+        insert_child(node, 0, left->children[left->count]);
+        node->count++;
+        parent->keys()[idx - 1] = std::move(left->keys()[left->count - 1]);
+        left->keys()[left->count - 1].~T();
+        left->count--;
+        return;
+    }
+    if (right && right->count > min_count)
+    {
+        ::new (node->keys() + node->count) T(std::move(parent->keys()[idx]));
+        node->children[node->count + 1] = right->children[0];
+        right->children[0]->parent = node;
+        node->count++;
+        parent->keys()[idx] = std::move(right->keys()[0]);
+        erase_key(right->keys(), right->count, 0);
+        erase_child(right, 0);
+        right->count--;
+        return;
+    }
+
+    // Слияние: left + разделитель + right в левый узел
+    InnerNode* into = left ? left : node;
+    InnerNode* from = left ? node : right;
+    int sep = left ? idx - 1 : idx;
+    ::new (into->keys() + into->count) T(std::move(parent->keys()[sep]));
+    move_keys(from->keys(), from->count, into->keys() + into->count + 1);
+    for (int i = 0; i <= from->count; i++)
+    {
+        into->children[into->count + 1 + i] = from->children[i];
+        from->children[i]->parent = into;
+    }
+    into->count += from->count + 1;
+    from->count = 0;
+    erase_key(parent->keys(), parent->count, sep);
+    erase_child(parent, sep + 1);
+    parent->count--;
+    destroy_node(from);
+    rebalance_inner(parent);
+}
+
+template <typename T, typename Compare, typename Allocator>
+std::pair<typename btree_set<T, Compare, Allocator>::iterator, bool> btree_set<T, Compare, Allocator>::insert(value_type const& x)
+{
+    return insert_unique(x);
+}
+
+template <typename T, typename Compare, typename Allocator>
+std::pair<typename btree_set<T, Compare, Allocator>::iterator, bool> btree_set<T, Compare, Allocator>::insert(value_type&& x)
+{
+    return insert_unique(std::move(x));
+}
+
+template <typename T, typename Compare, typename Allocator>
+template <typename... Args>
+std::pair<typename btree_set<T, Compare, Allocator>::iterator, bool> btree_set<T, Compare, Allocator>::emplace(Args&&... args)
+{
+    // Ключ нужен для спуска, поэтому он строится до поиска и затем перемещается в лист
+    return insert_unique(value_type(std::forward<Args>(args)...));
+}
+
+template <typename T, typename Compare, typename Allocator>
+typename btree_set<T, Compare, Allocator>::iterator btree_set<T, Compare, Allocator>::erase(const_iterator iter)
+{
+    LeafNode* leaf = iter.leaf;
+    erase_key(leaf->keys(), leaf->count, iter.pos);
+    leaf->count--;
+    siz--;
+
+    LeafNode* next_leaf = leaf;
+    int next_pos = iter.pos;
+    rebalance_leaf(leaf, next_leaf, next_pos);
+    if (!next_leaf)
+        return end();
+    return normalize(next_leaf, next_pos);
+}
+
+template <typename T, typename Compare, typename Allocator>
+template <typename K>
+typename btree_set<T, Compare, Allocator>::const_iterator btree_set<T, Compare, Allocator>::lower_bound_impl(K const& x) const
+{
+    if (!root)
+        return end();
+    LeafNode* leaf = find_leaf(x);
+    return normalize(leaf, btree_node_search<T, Compare>::lower_bound(leaf->keys(), leaf->count, x, less()));
+}
+
+template <typename T, typename Compare, typename Allocator>
+template <typename K>
+typename btree_set<T, Compare, Allocator>::const_iterator btree_set<T, Compare, Allocator>::upper_bound_impl(K const& x) const
+{
+    if (!root)
+        return end();
+    LeafNode* leaf = find_leaf(x);
+    return normalize(leaf, btree_node_search<T, Compare>::upper_bound(leaf->keys(), leaf->count, x, less()));
+}
+
+template <typename T, typename Compare, typename Allocator>
+template <typename K>
+typename btree_set<T, Compare, Allocator>::const_iterator btree_set<T, Compare, Allocator>::find_impl(K const& x) const
+{
+    if (!root)
+        return end();
+    LeafNode* leaf = find_leaf(x);
+    key_less<Compare> cmp = less();
+    int pos = btree_node_search<T, Compare>::lower_bound(leaf->keys(), leaf->count, x, cmp);
+    if (pos < leaf->count && !cmp(x, leaf->keys()[pos]))
+        return const_iterator(leaf, pos);
+    return end();
+}
+
+template <typename T, typename Compare, typename Allocator>
+template <typename K>
+std::pair<typename btree_set<T, Compare, Allocator>::const_iterator, typename btree_set<T, Compare, Allocator>::const_iterator>
+btree_set<T, Compare, Allocator>::equal_range_impl(K const& x) const
+{
+    const_iterator first = lower_bound_impl(x);
+    const_iterator last = first;
+    if (first != end() && !less()(x, *first))
+        ++last;
+    return { first, last };
+}
+
+template <typename T, typename Compare, typename Allocator>
+typename btree_set<T, Compare, Allocator>::const_iterator btree_set<T, Compare, Allocator>::find(value_type const& x) const
+{
+    return find_impl(x);
+}
+
+template <typename T, typename Compare, typename Allocator>
+template <typename K, typename C, typename>
+typename btree_set<T, Compare, Allocator>::const_iterator btree_set<T, Compare, Allocator>::find(K const& x) const
+{
+    return find_impl(x);
+}
+
+template <typename T, typename Compare, typename Allocator>
+typename btree_set<T, Compare, Allocator>::const_iterator btree_set<T, Compare, Allocator>::lower_bound(value_type const& x) const
+{
+    return lower_bound_impl(x);
+}
+
+template <typename T, typename Compare, typename Allocator>
+template <typename K, typename C, typename>
+typename btree_set<T, Compare, Allocator>::const_iterator btree_set<T, Compare, Allocator>::lower_bound(K const& x) const
+{
+    return lower_bound_impl(x);
+}
+
+template <typename T, typename Compare, typename Allocator>
+typename btree_set<T, Compare, Allocator>::const_iterator btree_set<T, Compare, Allocator>::upper_bound(value_type const& x) const
+{
+    return upper_bound_impl(x);
+}
+
+template <typename T, typename Compare, typename Allocator>
+template <typename K, typename C, typename>
+typename btree_set<T, Compare, Allocator>::const_iterator btree_set<T, Compare, Allocator>::upper_bound(K const& x) const
+{
+    return upper_bound_impl(x);
+}
+
+template <typename T, typename Compare, typename Allocator>
+std::pair<typename btree_set<T, Compare, Allocator>::const_iterator, typename btree_set<T, Compare, Allocator>::const_iterator>
+btree_set<T, Compare, Allocator>::equal_range(value_type const& x) const
+{
+    return equal_range_impl(x);
+}
+
+template <typename T, typename Compare, typename Allocator>
+template <typename K, typename C, typename>
+std::pair<typename btree_set<T, Compare, Allocator>::const_iterator, typename btree_set<T, Compare, Allocator>::const_iterator>
+btree_set<T, Compare, Allocator>::equal_range(K const& x) const
+{
+    return equal_range_impl(x);
+}
+
+template <typename T, typename Compare, typename Allocator>
+size_t btree_set<T, Compare, Allocator>::count(value_type const& x) const
+{
+    return find_impl(x) != end() ? 1 : 0;
+}
+
+template <typename T, typename Compare, typename Allocator>
+template <typename K, typename C, typename>
+size_t btree_set<T, Compare, Allocator>::count(K const& x) const
+{
+    return find_impl(x) != end() ? 1 : 0;
+}
+
+template <typename T, typename Compare, typename Allocator>
+bool btree_set<T, Compare, Allocator>::contains(value_type const& x) const
+{
+    return find_impl(x) != end();
+}
+
+template <typename T, typename Compare, typename Allocator>
+template <typename K, typename C, typename>
+bool btree_set<T, Compare, Allocator>::contains(K const& x) const
+{
+    return find_impl(x) != end();
+}
+
+template <typename T, typename Compare, typename Allocator>
+bool btree_set<T, Compare, Allocator>::empty() const
+{
+    return siz == 0;
+}
+
+template <typename T, typename Compare, typename Allocator>
+size_t btree_set<T, Compare, Allocator>::size() const
+{
+    return siz;
+}
+
+template <typename T, typename Compare, typename Allocator>
+size_t btree_set<T, Compare, Allocator>::height() const
+{
+    size_t result = 0;
+    for (NodeBase* cur = root; cur; cur = cur->leaf ? nullptr : static_cast<InnerNode*>(cur)->children[0])
+        result++;
+    return result;
+}
+
+template <typename T, typename Compare, typename Allocator>
+void btree_set<T, Compare, Allocator>::clear()
+{
+    destroy_tree(root);
+    root = nullptr;
+    head = tail = nullptr;
+    siz = 0;
+}
+
+template <typename T, typename Compare, typename Allocator>
+typename btree_set<T, Compare, Allocator>::iterator btree_set<T, Compare, Allocator>::begin() const
+{
+    return head ? iterator(head, 0) : end();
+}
+
+template <typename T, typename Compare, typename Allocator>
+typename btree_set<T, Compare, Allocator>::iterator btree_set<T, Compare, Allocator>::end() const
+{
+    return tail ? iterator(tail, tail->count) : iterator();
+}
+
+template <typename T, typename Compare, typename Allocator>
+typename btree_set<T, Compare, Allocator>::const_iterator btree_set<T, Compare, Allocator>::cbegin() const
+{
+    return begin();
+}
+
+template <typename T, typename Compare, typename Allocator>
+typename btree_set<T, Compare, Allocator>::const_iterator btree_set<T, Compare, Allocator>::cend() const
+{
+    return end();
+}
+
+template <typename T, typename Compare, typename Allocator>
+typename btree_set<T, Compare, Allocator>::reverse_iterator btree_set<T, Compare, Allocator>::rbegin() const
+{
+    return reverse_iterator(end());
+}
+
+template <typename T, typename Compare, typename Allocator>
+typename btree_set<T, Compare, Allocator>::reverse_iterator btree_set<T, Compare, Allocator>::rend() const
+{
+    return reverse_iterator(begin());
+}
+
+template <typename T, typename Compare, typename Allocator>
+typename btree_set<T, Compare, Allocator>::const_reverse_iterator btree_set<T, Compare, Allocator>::crbegin() const
+{
+    return const_reverse_iterator(end());
+}
+
+template <typename T, typename Compare, typename Allocator>
+typename btree_set<T, Compare, Allocator>::const_reverse_iterator btree_set<T, Compare, Allocator>::crend() const
+{
+    return const_reverse_iterator(begin());
+}
+
+template <typename T, typename Compare, typename Allocator>
+void btree_set<T, Compare, Allocator>::swap_trees(btree_set& other)
+{
+    std::swap(siz, other.siz);
+    std::swap(root, other.root);
+    std::swap(head, other.head);
+    std::swap(tail, other.tail);
+}
+
+template <typename T, typename Compare, typename Allocator>
+void btree_set<T, Compare, Allocator>::swap(btree_set& other)
+{
+    swap_trees(other);
+    std::swap(comp, other.comp);
+    if (leaf_traits::propagate_on_container_swap::value)
+    {
+        std::swap(leaf_alloc, other.leaf_alloc);
+        std::swap(inner_alloc, other.inner_alloc);
+    }
+}
+
+template <typename T, typename Compare, typename Allocator>
+void swap(btree_set<T, Compare, Allocator>& a, btree_set<T, Compare, Allocator>& b)
+{
+    a.swap(b);
+}
+
+#endif //MY_BTREE_SET_H
@@ -0,0 +1,618 @@
+#ifndef MY_CONCURRENT_SET_H
+#define MY_CONCURRENT_SET_H
+
+#include "my_set.h"
+#include "epoch_reclaim.h"
+
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <random>
+#include <thread>
+
+// Упорядоченное множество для одновременной работы многих потоков: ленивый
+// список с пропусками (Herlihy, Lev, Luchangco, Shavit). Поиск и обход не берут
+// блокировок и не пишут в общую память, кроме слота своей эпохи. insert и erase
+// блокируют только узлы-предшественники на своих уровнях. Удаление сначала
+// помечает узел, затем вырезает его со всех уровней; память узла освобождается
+// через epoch_domain, когда его уже не может видеть ни один читатель.
+//
+// Итераторы слабо согласованы: обход видит каждый ключ, который был в множестве
+// всё время обхода, и может видеть или не видеть ключи, вставленные и удалённые
+// по ходу. Пока итератор жив, он держит свою эпоху закреплённой.
+// Узлы выделяются operator new: аллокатор должен был бы быть потокобезопасным
+template <typename T, typename Compare = std::less<T>>
+class concurrent_set
+{
+public:
+    typedef T key_type;
+    typedef T value_type;
+    typedef Compare key_compare;
+    typedef Compare value_compare;
+
+private:
+    static const int max_level = 16;
+
+    struct BaseNode
+    {
+        // next[0..top] -- ссылки на следующие узлы уровней, хранятся сразу за узлом
+        std::atomic<BaseNode*>* next;
+        int top;
+        // marked -- узел логически удалён, linked -- вставлен на всех своих уровнях
+        std::atomic<bool> marked;
+        std::atomic<bool> linked;
+        std::mutex lock;
+
+        BaseNode(std::atomic<BaseNode*>* next, int top);
+    };
+
+    struct Node : public BaseNode
+    {
+        value_type key;
+
+        template <typename... Args>
+        Node(std::atomic<BaseNode*>* next, int top, Args&&... args);
+    };
+
+    class Iterator : public std::iterator<std::forward_iterator_tag, T const>
+    {
+        friend class concurrent_set;
+
+    private:
+        BaseNode* ptr;
+        epoch_domain::guard pin;
+
+        Iterator(BaseNode* ptr, epoch_domain::guard&& pin);
+        void skip_removed();
+
+    public:
+        Iterator();
+        Iterator(Iterator const& other);
+        Iterator(Iterator&& other) noexcept;
+        Iterator& operator=(Iterator other);
+
+        T const& operator*() const;
+        T const* operator->() const;
+
+        bool operator==(Iterator const& other) const;
+        bool operator!=(Iterator const& other) const;
+
+        Iterator& operator++();
+        Iterator operator++(int);
+    };
+
+public:
+    using iterator = Iterator;
+    using const_iterator = Iterator;
+
+private:
+    mutable epoch_domain epochs;
+    std::atomic<BaseNode*> head_links[max_level];
+    BaseNode head;
+    std::atomic<size_t> siz;
+    Compare comp;
+
+    key_less<Compare> less() const;
+
+    static int random_level();
+    template <typename... Args>
+    static Node* create_node(int top, Args&&... args);
+    static void destroy_node(void* node);
+
+    static value_type const& key_of(BaseNode* node);
+    template <typename K>
+    int find_links(K const& x, BaseNode** preds, BaseNode** succs) const;
+    template <typename K>
+    BaseNode* lower_bound_node(K const& x) const;
+    template <typename K>
+    BaseNode* upper_bound_node(K const& x) const;
+    template <typename V>
+    std::pair<iterator, bool> insert_unique(V&& x);
+
+public:
+    concurrent_set();
+    explicit concurrent_set(Compare const& comp);
+    ~concurrent_set();
+
+    concurrent_set(concurrent_set const&) = delete;
+    concurrent_set& operator=(concurrent_set const&) = delete;
+
+    key_compare key_comp() const;
+    value_compare value_comp() const;
+
+    std::pair<iterator, bool> insert(value_type const& x);
+    std::pair<iterator, bool> insert(value_type&& x);
+    size_t erase(value_type const& x);
+
+    const_iterator find(value_type const& x) const;
+    const_iterator lower_bound(value_type const& x) const;
+    const_iterator upper_bound(value_type const& x) const;
+    size_t count(value_type const& x) const;
+    bool contains(value_type const& x) const;
+
+    // Размер на момент вызова; при одновременных изменениях он сразу устаревает
+    bool empty() const;
+    size_t size() const;
+
+    iterator begin() const;
+    iterator end() const;
+    const_iterator cbegin() const;
+    const_iterator cend() const;
+};
+
+
+/// NODE IMPLEMENTATION ======================================================================
+
+template <typename T, typename Compare>
+concurrent_set<T, Compare>::BaseNode::BaseNode(std::atomic<BaseNode*>* next, int top)
+        : next(next),
+          top(top),
+          marked(false),
+          linked(false),
+          lock()
+{}
+
+template <typename T, typename Compare>
+template <typename... Args>
+concurrent_set<T, Compare>::Node::Node(std::atomic<BaseNode*>* next, int top, Args&&... args)
+        : BaseNode(next, top),
+          key(std::forward<Args>(args)...)
+{}
+
+/// ITERATOR IMPLEMENTATION ==================================================================
+
+template <typename T, typename Compare>
+concurrent_set<T, Compare>::Iterator::Iterator()
+        : ptr(nullptr),
+          pin()
+{}
+
+template <typename T, typename Compare>
+concurrent_set<T, Compare>::Iterator::Iterator(BaseNode* ptr, epoch_domain::guard&& pin)
+        : ptr(ptr),
+          pin(ptr ? std::move(pin) : epoch_domain::guard())
+{}
+
+template <typename T, typename Compare>
+concurrent_set<T, Compare>::Iterator::Iterator(Iterator const& other)
+        : ptr(other.ptr),
+          pin(other.pin.clone())
+{}
+
+template <typename T, typename Compare>
+concurrent_set<T, Compare>::Iterator::Iterator(Iterator&& other) noexcept
+        : ptr(other.ptr),
+          pin(std::move(other.pin))
+{
+    other.ptr = nullptr;
+}
+
+template <typename T, typename Compare>
+typename concurrent_set<T, Compare>::Iterator& concurrent_set<T, Compare>::Iterator::operator=(Iterator other)
+{
+    std::swap(ptr, other.ptr);
+    std::swap(pin, other.pin);
+    return *this;
+}
+
+template <typename T, typename Compare>
+T const& concurrent_set<T, Compare>::Iterator::operator*() const
+{
+    return static_cast<Node*>(ptr)->key;
+}
+
+template <typename T, typename Compare>
+T const* concurrent_set<T, Compare>::Iterator::operator->() const
+{
+    return &static_cast<Node*>(ptr)->key;
+}
+
+template <typename T, typename Compare>
+bool concurrent_set<T, Compare>::Iterator::operator==(Iterator const& other) const
+{
+    return ptr == other.ptr;
+}
+
+template <typename T, typename Compare>
+bool concurrent_set<T, Compare>::Iterator::operator!=(Iterator const& other) const
+{
+    return ptr != other.ptr;
+}
+
+template <typename T, typename Compare>
+void concurrent_set<T, Compare>::Iterator::skip_removed()
+{
+    // Удалённые и ещё не вставленные до конца узлы пропускаются
+    while (ptr && (ptr->marked || !ptr->linked))
+        ptr = ptr->next[0];
+    if (!ptr)
+        pin.reset();
+}
+
+template <typename T, typename Compare>
+typename concurrent_set<T, Compare>::Iterator& concurrent_set<T, Compare>::Iterator::operator++()
+{
+    ptr = ptr->next[0];
+    skip_removed();
+    return *this;
+}
+
+template <typename T, typename Compare>
+typename concurrent_set<T, Compare>::Iterator concurrent_set<T, Compare>::Iterator::operator++(int)
+{
+    Iterator old(*this);
+    ++*this;
+    return old;
+}
+
+/// CONCURRENT SET IMPLEMENTATION ============================================================
+
+template <typename T, typename Compare>
+const int concurrent_set<T, Compare>::max_level;
+
+template <typename T, typename Compare>
+concurrent_set<T, Compare>::concurrent_set()
+        : epochs(),
+          head(head_links, max_level - 1),
+          siz(0),
+          comp()
+{
+    for (auto& link : head_links)
+        link = nullptr;
+    head.linked = true;
+}
+
+template <typename T, typename Compare>
+concurrent_set<T, Compare>::concurrent_set(Compare const& comp)
+        : epochs(),
+          head(head_links, max_level - 1),
+          siz(0),
+          comp(comp)
+{
+    for (auto& link : head_links)
+        link = nullptr;
+    head.linked = true;
+}
+
+template <typename T, typename Compare>
+concurrent_set<T, Compare>::~concurrent_set()
+{
+    BaseNode* node = head.next[0];
+    while (node)
+    {
+        BaseNode* next = node->next[0];
+        destroy_node(node);
+        node = next;
+    }
+}
+
+template <typename T, typename Compare>
+key_less<Compare> concurrent_set<T, Compare>::less() const
+{
+    return key_less<Compare>{comp};
+}
+
+template <typename T, typename Compare>
+typename concurrent_set<T, Compare>::key_compare concurrent_set<T, Compare>::key_comp() const
+{
+    return comp;
+}
+
+template <typename T, typename Compare>
+typename concurrent_set<T, Compare>::value_compare concurrent_set<T, Compare>::value_comp() const
+{
+    return comp;
+}
+
+template <typename T, typename Compare>
+int concurrent_set<T, Compare>::random_level()
+{
+    // Уровень растёт с вероятностью 1/4, своё состояние генератора в каждом потоке
+    static thread_local std::minstd_rand gen(
+            static_cast<std::minstd_rand::result_type>(std::hash<std::thread::id>()(std::this_thread::get_id())));
+    int level = 0;
+    while (level < max_level - 1 && gen() % 4 == 0)
+        level++;
+    return level;
+}
+
+template <typename T, typename Compare>
+template <typename... Args>
+typename concurrent_set<T, Compare>::Node* concurrent_set<T, Compare>::create_node(int top, Args&&... args)
+{
+    // Узел и его массив ссылок -- одно выделение памяти
+    void* memory = ::operator new(sizeof(Node) + sizeof(std::atomic<BaseNode*>) * static_cast<size_t>(top + 1));
+    auto* next = reinterpret_cast<std::atomic<BaseNode*>*>(static_cast<char*>(memory) + sizeof(Node));
+    for (int level = 0; level <= top; level++)
+        new (next + level) std::atomic<BaseNode*>(nullptr);
+    try
+    {
+        return new (memory) Node(next, top, std::forward<Args>(args)...);
+    }
+    catch (...)
+    {
+        ::operator delete(memory);
+        throw;
+    }
+}
+
+template <typename T, typename Compare>
+void concurrent_set<T, Compare>::destroy_node(void* node)
+{
+    static_cast<Node*>(node)->~Node();
+    ::operator delete(node);
+}
+
+template <typename T, typename Compare>
+typename concurrent_set<T, Compare>::value_type const& concurrent_set<T, Compare>::key_of(BaseNode* node)
+{
+    return static_cast<Node*>(node)->key;
+}
+
+template <typename T, typename Compare>
+template <typename K>
+int concurrent_set<T, Compare>::find_links(K const& x, BaseNode** preds, BaseNode** succs) const
+{
+    // На каждом уровне -- последний узел с ключом меньше x и следующий за ним.
+    // Возвращает старший уровень, на котором найден узел с ключом x, или -1
+    key_less<Compare> cmp = less();
+    int found = -1;
+    BaseNode* pred = const_cast<BaseNode*>(&head);
+    for (int level = max_level - 1; level >= 0; level--)
+    {
+        BaseNode* curr = pred->next[level];
+        while (curr && cmp(key_of(curr), x))
+        {
+            pred = curr;
+            curr = pred->next[level];
+        }
+        if (found == -1 && curr && !cmp(x, key_of(curr)))
+            found = level;
+        preds[level] = pred;
+        succs[level] = curr;
+    }
+    return found;
+}
+
+template <typename T, typename Compare>
+template <typename K>
+typename concurrent_set<T, Compare>::BaseNode* concurrent_set<T, Compare>::lower_bound_node(K const& x) const
+{
+    key_less<Compare> cmp = less();
+    BaseNode* pred = const_cast<BaseNode*>(&head);
+    BaseNode* curr = nullptr;
+    for (int level = max_level - 1; level >= 0; level--)
+    {
+        curr = pred->next[level];
+        while (curr && cmp(key_of(curr), x))
+        {
+            pred = curr;
+            curr = pred->next[level];
+        }
+    }
+    return curr;
+}
+
+template <typename T, typename Compare>
+template <typename K>
+typename concurrent_set<T, Compare>::BaseNode* concurrent_set<T, Compare>::upper_bound_node(K const& x) const
+{
+    key_less<Compare> cmp = less();
+    BaseNode* pred = const_cast<BaseNode*>(&head);
+    BaseNode* curr = nullptr;
+    for (int level = max_level - 1; level >= 0; level--)
+    {
+        curr = pred->next[level];
+        while (curr && !cmp(x, key_of(curr)))
+        {
+            pred = curr;
+            curr = pred->next[level];
+        }
+    }
+    return curr;
+}
+
+template <typename T, typename Compare>
+template <typename V>
+std::pair<typename concurrent_set<T, Compare>::iterator, bool> concurrent_set<T, Compare>::insert_unique(V&& x)
+{
+    epoch_domain::guard pin = epochs.pin();
+    int top = random_level();
+    BaseNode* preds[max_level];
+    BaseNode* succs[max_level];
+    while (true)
+    {
+        int found = find_links(x, preds, succs);
+        if (found != -1)
+        {
+            BaseNode* node = succs[found];
+            if (!node->marked)
+            {
+                // Узел с таким ключом вставляется другим потоком: ждём, пока он появится целиком
+                while (!node->linked)
+                    std::this_thread::yield();
+                return { iterator(node, std::move(pin)), false };
+            }
+            // Узел удаляется -- повторяем, когда его вырежут
+            continue;
+        }
+
+        // Предшественники блокируются снизу вверх, то есть по убыванию ключей,
+        // как и в erase, поэтому взаимных блокировок нет
+        std::unique_lock<std::mutex> locks[max_level];
+        bool valid = true;
+        BaseNode* prev = nullptr;
+        for (int level = 0; valid && level <= top; level++)
+        {
+            BaseNode* pred = preds[level];
+            BaseNode* succ = succs[level];
+            if (pred != prev)
+            {
+                locks[level] = std::unique_lock<std::mutex>(pred->lock);
+                prev = pred;
+            }
+            valid = !pred->marked && (!succ || !succ->marked) && pred->next[level] == succ;
+        }
+        if (!valid)
+            continue;
+
+        Node* node = create_node(top, std::forward<V>(x));
+        for (int level = 0; level <= top; level++)
+            node->next[level] = succs[level];
+        for (int level = 0; level <= top; level++)
+            preds[level]->next[level] = node;
+        node->linked = true;
+        siz++;
+        return { iterator(node, std::move(pin)), true };
+    }
+}
+
+template <typename T, typename Compare>
+std::pair<typename concurrent_set<T, Compare>::iterator, bool> concurrent_set<T, Compare>::insert(value_type const& x)
+{
+    return insert_unique(x);
+}
+
+template <typename T, typename Compare>
+std::pair<typename concurrent_set<T, Compare>::iterator, bool> concurrent_set<T, Compare>::insert(value_type&& x)
+{
+    return insert_unique(std::move(x));
+}
+
+template <typename T, typename Compare>
+size_t concurrent_set<T, Compare>::erase(value_type const& x)
+{
+    epoch_domain::guard pin = epochs.pin();
+    BaseNode* preds[max_level];
+    BaseNode* succs[max_level];
+    BaseNode* victim = nullptr;
+    std::unique_lock<std::mutex> victim_lock;
+    while (true)
+    {
+        int found = find_links(x, preds, succs);
+        if (!victim)
+        {
+            // Удалять можно только полностью вставленный узел, найденный на своём верхнем уровне
+            if (found == -1)
+                return 0;
+            BaseNode* node = succs[found];
+            if (!node->linked || node->top != found || node->marked)
+                return 0;
+            victim_lock = std::unique_lock<std::mutex>(node->lock);
+            if (node->marked)
+                return 0;
+            node->marked = true;
+            victim = node;
+        }
+
+        std::unique_lock<std::mutex> locks[max_level];
+        bool valid = true;
+        BaseNode* prev = nullptr;
+        for (int level = 0; valid && level <= victim->top; level++)
+        {
+            BaseNode* pred = preds[level];
+            if (pred != prev)
+            {
+                locks[level] = std::unique_lock<std::mutex>(pred->lock);
+                prev = pred;
+            }
+            valid = !pred->marked && pred->next[level] == victim;
+        }
+        if (!valid)
+            continue;
+
+        for (int level = victim->top; level >= 0; level--)
+            preds[level]->next[level] = victim->next[level].load();
+        siz--;
+        victim_lock.unlock();
+        epochs.retire(static_cast<Node*>(victim), &concurrent_set::destroy_node);
+        return 1;
+    }
+}
+
+template <typename T, typename Compare>
+typename concurrent_set<T, Compare>::const_iterator concurrent_set<T, Compare>::find(value_type const& x) const
+{
+    epoch_domain::guard pin = epochs.pin();
+    BaseNode* preds[max_level];
+    BaseNode* succs[max_level];
+    int found = find_links(x, preds, succs);
+    if (found == -1 || !succs[found]->linked || succs[found]->marked)
+        return end();
+    return const_iterator(succs[found], std::move(pin));
+}
+
+template <typename T, typename Compare>
+typename concurrent_set<T, Compare>::const_iterator concurrent_set<T, Compare>::lower_bound(value_type const& x) const
+{
+    epoch_domain::guard pin = epochs.pin();
+    const_iterator result(lower_bound_node(x), std::move(pin));
+    result.skip_removed();
+    return result;
+}
+
+template <typename T, typename Compare>
+typename concurrent_set<T, Compare>::const_iterator concurrent_set<T, Compare>::upper_bound(value_type const& x) const
+{
+    epoch_domain::guard pin = epochs.pin();
+    const_iterator result(upper_bound_node(x), std::move(pin));
+    result.skip_removed();
+    return result;
+}
+
+template <typename T, typename Compare>
+size_t concurrent_set<T, Compare>::count(value_type const& x) const
+{
+    return contains(x) ? 1 : 0;
+}
+
+template <typename T, typename Compare>
+bool concurrent_set<T, Compare>::contains(value_type const& x) const
+{
+    epoch_domain::guard pin = epochs.pin();
+    BaseNode* preds[max_level];
+    BaseNode* succs[max_level];
+    int found = find_links(x, preds, succs);
+    return found != -1 && succs[found]->linked && !succs[found]->marked;
+}
+
+template <typename T, typename Compare>
+bool concurrent_set<T, Compare>::empty() const
+{
+    return siz == 0;
+}
+
+template <typename T, typename Compare>
+size_t concurrent_set<T, Compare>::size() const
+{
+    return siz;
+}
+
+template <typename T, typename Compare>
+typename concurrent_set<T, Compare>::iterator concurrent_set<T, Compare>::begin() const
+{
+    epoch_domain::guard pin = epochs.pin();
+    iterator result(head.next[0], std::move(pin));
+    result.skip_removed();
+    return result;
+}
+
+template <typename T, typename Compare>
+typename concurrent_set<T, Compare>::iterator concurrent_set<T, Compare>::end() const
+{
+    return iterator();
+}
+
+template <typename T, typename Compare>
+typename concurrent_set<T, Compare>::const_iterator concurrent_set<T, Compare>::cbegin() const
+{
+    return begin();
+}
+
+template <typename T, typename Compare>
+typename concurrent_set<T, Compare>::const_iterator concurrent_set<T, Compare>::cend() const
+{
+    return end();
+}
+
+#endif //MY_CONCURRENT_SET_H
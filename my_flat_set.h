@@ -0,0 +1,449 @@
+#ifndef MY_FLAT_SET_H
+#define MY_FLAT_SET_H
+
+#include "my_set.h"
+
+#include <algorithm>
+#include <vector>
+
+// Множество поверх отсортированного непрерывного массива: для наборов, которые
+// строятся один раз и затем много раз читаются. Поиск -- бинарный без ветвлений,
+// вставка и удаление -- O(n) из-за сдвига хвоста массива.
+// Как и у std::vector, изменения инвалидируют итераторы.
+template <typename T, typename Compare = std::less<T>, typename Allocator = std::allocator<T>>
+class flat_set
+{
+public:
+    typedef T key_type;
+    typedef T value_type;
+    typedef Compare key_compare;
+    typedef Compare value_compare;
+
+private:
+    typedef std::vector<T, Allocator> storage;
+
+public:
+    using allocator_type = Allocator;
+    using iterator = typename storage::const_iterator;
+    using const_iterator = typename storage::const_iterator;
+    using reverse_iterator = std::reverse_iterator<iterator>;
+    using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+private:
+    storage data;
+    Compare comp;
+
+    key_less<Compare> less() const;
+    void sort_and_unique();
+
+    template <typename K>
+    size_t lower_bound_index(K const& x) const;
+    template <typename K>
+    size_t upper_bound_index(K const& x) const;
+    template <typename K>
+    const_iterator find_impl(K const& x) const;
+    template <typename K>
+    std::pair<const_iterator, const_iterator> equal_range_impl(K const& x) const;
+    template <typename V>
+    std::pair<iterator, bool> insert_unique(V&& x);
+
+public:
+    flat_set();
+    explicit flat_set(Compare const& comp, Allocator const& allocator = Allocator());
+    explicit flat_set(Allocator const& allocator);
+    template <typename InputIt>
+    flat_set(InputIt first, InputIt last,
+             Compare const& comp = Compare(), Allocator const& allocator = Allocator());
+    template <typename InputIt>
+    flat_set(sorted_unique_t, InputIt first, InputIt last,
+             Compare const& comp = Compare(), Allocator const& allocator = Allocator());
+
+    allocator_type get_allocator() const;
+    key_compare key_comp() const;
+    value_compare value_comp() const;
+
+    std::pair<iterator, bool> insert(value_type const& x);
+    std::pair<iterator, bool> insert(value_type&& x);
+    template <typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args);
+    iterator erase(const_iterator iter);
+
+    const_iterator find(value_type const& x) const;
+    template <typename K, typename C = Compare, typename = typename C::is_transparent>
+    const_iterator find(K const& x) const;
+    const_iterator lower_bound(value_type const& x) const;
+    template <typename K, typename C = Compare, typename = typename C::is_transparent>
+    const_iterator lower_bound(K const& x) const;
+    const_iterator upper_bound(value_type const& x) const;
+    template <typename K, typename C = Compare, typename = typename C::is_transparent>
+    const_iterator upper_bound(K const& x) const;
+    std::pair<const_iterator, const_iterator> equal_range(value_type const& x) const;
+    template <typename K, typename C = Compare, typename = typename C::is_transparent>
+    std::pair<const_iterator, const_iterator> equal_range(K const& x) const;
+    size_t count(value_type const& x) const;
+    template <typename K, typename C = Compare, typename = typename C::is_transparent>
+    size_t count(K const& x) const;
+    bool contains(value_type const& x) const;
+    template <typename K, typename C = Compare, typename = typename C::is_transparent>
+    bool contains(K const& x) const;
+
+    bool empty() const;
+    size_t size() const;
+    void clear();
+    void reserve(size_t n);
+    void shrink_to_fit();
+
+    iterator begin() const;
+    iterator end() const;
+    const_iterator cbegin() const;
+    const_iterator cend() const;
+    reverse_iterator rbegin() const;
+    reverse_iterator rend() const;
+    const_reverse_iterator crbegin() const;
+    const_reverse_iterator crend() const;
+
+    void swap(flat_set& other);
+};
+
+
+/// FLAT SET IMPLEMENTATION ==================================================================
+
+template <typename T, typename Compare, typename Allocator>
+flat_set<T, Compare, Allocator>::flat_set()
+        : data(),
+          comp()
+{}
+
+template <typename T, typename Compare, typename Allocator>
+flat_set<T, Compare, Allocator>::flat_set(Compare const& comp, Allocator const& allocator)
+        : data(allocator),
+          comp(comp)
+{}
+
+template <typename T, typename Compare, typename Allocator>
+flat_set<T, Compare, Allocator>::flat_set(Allocator const& allocator)
+        : data(allocator),
+          comp()
+{}
+
+template <typename T, typename Compare, typename Allocator>
+template <typename InputIt>
+flat_set<T, Compare, Allocator>::flat_set(InputIt first, InputIt last, Compare const& comp, Allocator const& allocator)
+        : data(first, last, allocator),
+          comp(comp)
+{
+    sort_and_unique();
+}
+
+template <typename T, typename Compare, typename Allocator>
+template <typename InputIt>
+flat_set<T, Compare, Allocator>::flat_set(sorted_unique_t, InputIt first, InputIt last,
+                                          Compare const& comp, Allocator const& allocator)
+        : data(first, last, allocator),
+          comp(comp)
+{}
+
+template <typename T, typename Compare, typename Allocator>
+key_less<Compare> flat_set<T, Compare, Allocator>::less() const
+{
+    return key_less<Compare>{comp};
+}
+
+template <typename T, typename Compare, typename Allocator>
+void flat_set<T, Compare, Allocator>::sort_and_unique()
+{
+    // O(n log n): сортировка, затем из каждой группы равных остаётся первый ключ
+    key_less<Compare> cmp = less();
+    std::sort(data.begin(), data.end(), cmp);
+    data.erase(std::unique(data.begin(), data.end(), [&cmp](T const& a, T const& b) {
+        return !cmp(a, b);
+    }), data.end());
+}
+
+template <typename T, typename Compare, typename Allocator>
+template <typename K>
+size_t flat_set<T, Compare, Allocator>::lower_bound_index(K const& x) const
+{
+    // Бинарный поиск без ветвлений: диапазон всегда сокращается на half,
+    // а выбор половины компилируется в условную пересылку
+    if (data.empty())
+        return 0;
+
+    key_less<Compare> cmp = less();
+    T const* first = data.data();
+    T const* base = first;
+    size_t n = data.size();
+    while (n > 1)
+    {
+        size_t half = n / 2;
+        base = cmp(base[half], x) ? base + half : base;
+        n -= half;
+    }
+    return static_cast<size_t>(base - first) + cmp(*base, x);
+}
+
+template <typename T, typename Compare, typename Allocator>
+template <typename K>
+size_t flat_set<T, Compare, Allocator>::upper_bound_index(K const& x) const
+{
+    if (data.empty())
+        return 0;
+
+    key_less<Compare> cmp = less();
+    T const* first = data.data();
+    T const* base = first;
+    size_t n = data.size();
+    while (n > 1)
+    {
+        size_t half = n / 2;
+        base = !cmp(x, base[half]) ? base + half : base;
+        n -= half;
+    }
+    return static_cast<size_t>(base - first) + !cmp(x, *base);
+}
+
+template <typename T, typename Compare, typename Allocator>
+template <typename K>
+typename flat_set<T, Compare, Allocator>::const_iterator flat_set<T, Compare, Allocator>::find_impl(K const& x) const
+{
+    size_t i = lower_bound_index(x);
+    if (i < data.size() && !less()(x, data[i]))
+        return data.begin() + i;
+    return data.end();
+}
+
+template <typename T, typename Compare, typename Allocator>
+template <typename K>
+std::pair<typename flat_set<T, Compare, Allocator>::const_iterator, typename flat_set<T, Compare, Allocator>::const_iterator>
+flat_set<T, Compare, Allocator>::equal_range_impl(K const& x) const
+{
+    size_t i = lower_bound_index(x);
+    size_t j = i < data.size() && !less()(x, data[i]) ? i + 1 : i;
+    return { data.begin() + i, data.begin() + j };
+}
+
+template <typename T, typename Compare, typename Allocator>
+template <typename V>
+std::pair<typename flat_set<T, Compare, Allocator>::iterator, bool> flat_set<T, Compare, Allocator>::insert_unique(V&& x)
+{
+    size_t i = lower_bound_index(x);
+    if (i < data.size() && !less()(x, data[i]))
+        return { data.begin() + i, false };
+    return { data.insert(data.begin() + i, std::forward<V>(x)), true };
+}
+
+template <typename T, typename Compare, typename Allocator>
+typename flat_set<T, Compare, Allocator>::allocator_type flat_set<T, Compare, Allocator>::get_allocator() const
+{
+    return data.get_allocator();
+}
+
+template <typename T, typename Compare, typename Allocator>
+typename flat_set<T, Compare, Allocator>::key_compare flat_set<T, Compare, Allocator>::key_comp() const
+{
+    return comp;
+}
+
+template <typename T, typename Compare, typename Allocator>
+typename flat_set<T, Compare, Allocator>::value_compare flat_set<T, Compare, Allocator>::value_comp() const
+{
+    return comp;
+}
+
+template <typename T, typename Compare, typename Allocator>
+std::pair<typename flat_set<T, Compare, Allocator>::iterator, bool> flat_set<T, Compare, Allocator>::insert(value_type const& x)
+{
+    return insert_unique(x);
+}
+
+template <typename T, typename Compare, typename Allocator>
+std::pair<typename flat_set<T, Compare, Allocator>::iterator, bool> flat_set<T, Compare, Allocator>::insert(value_type&& x)
+{
+    return insert_unique(std::move(x));
+}
+
+template <typename T, typename Compare, typename Allocator>
+template <typename... Args>
+std::pair<typename flat_set<T, Compare, Allocator>::iterator, bool> flat_set<T, Compare, Allocator>::emplace(Args&&... args)
+{
+    return insert_unique(value_type(std::forward<Args>(args)...));
+}
+
+template <typename T, typename Compare, typename Allocator>
+typename flat_set<T, Compare, Allocator>::iterator flat_set<T, Compare, Allocator>::erase(const_iterator iter)
+{
+    return data.erase(iter);
+}
+
+template <typename T, typename Compare, typename Allocator>
+typename flat_set<T, Compare, Allocator>::const_iterator flat_set<T, Compare, Allocator>::find(value_type const& x) const
+{
+    return find_impl(x);
+}
+
+template <typename T, typename Compare, typename Allocator>
+template <typename K, typename C, typename>
+typename flat_set<T, Compare, Allocator>::const_iterator flat_set<T, Compare, Allocator>::find(K const& x) const
+{
+    return find_impl(x);
+}
+
+template <typename T, typename Compare, typename Allocator>
+typename flat_set<T, Compare, Allocator>::const_iterator flat_set<T, Compare, Allocator>::lower_bound(value_type const& x) const
+{
+    return data.begin() + lower_bound_index(x);
+}
+
+template <typename T, typename Compare, typename Allocator>
+template <typename K, typename C, typename>
+typename flat_set<T, Compare, Allocator>::const_iterator flat_set<T, Compare, Allocator>::lower_bound(K const& x) const
+{
+    return data.begin() + lower_bound_index(x);
+}
+
+template <typename T, typename Compare, typename Allocator>
+typename flat_set<T, Compare, Allocator>::const_iterator flat_set<T, Compare, Allocator>::upper_bound(value_type const& x) const
+{
+    return data.begin() + upper_bound_index(x);
+}
+
+template <typename T, typename Compare, typename Allocator>
+template <typename K, typename C, typename>
+typename flat_set<T, Compare, Allocator>::const_iterator flat_set<T, Compare, Allocator>::upper_bound(K const& x) const
+{
+    return data.begin() + upper_bound_index(x);
+}
+
+template <typename T, typename Compare, typename Allocator>
+std::pair<typename flat_set<T, Compare, Allocator>::const_iterator, typename flat_set<T, Compare, Allocator>::const_iterator>
+flat_set<T, Compare, Allocator>::equal_range(value_type const& x) const
+{
+    return equal_range_impl(x);
+}
+
+template <typename T, typename Compare, typename Allocator>
+template <typename K, typename C, typename>
+std::pair<typename flat_set<T, Compare, Allocator>::const_iterator, typename flat_set<T, Compare, Allocator>::const_iterator>
+flat_set<T, Compare, Allocator>::equal_range(K const& x) const
+{
+    return equal_range_impl(x);
+}
+
+template <typename T, typename Compare, typename Allocator>
+size_t flat_set<T, Compare, Allocator>::count(value_type const& x) const
+{
+    return find_impl(x) != end() ? 1 : 0;
+}
+
+template <typename T, typename Compare, typename Allocator>
+template <typename K, typename C, typename>
+size_t flat_set<T, Compare, Allocator>::count(K const& x) const
+{
+    return find_impl(x) != end() ? 1 : 0;
+}
+
+template <typename T, typename Compare, typename Allocator>
+bool flat_set<T, Compare, Allocator>::contains(value_type const& x) const
+{
+    return find_impl(x) != end();
+}
+
+template <typename T, typename Compare, typename Allocator>
+template <typename K, typename C, typename>
+bool flat_set<T, Compare, Allocator>::contains(K const& x) const
+{
+    return find_impl(x) != end();
+}
+
+template <typename T, typename Compare, typename Allocator>
+bool flat_set<T, Compare, Allocator>::empty() const
+{
+    return data.empty();
+}
+
+template <typename T, typename Compare, typename Allocator>
+size_t flat_set<T, Compare, Allocator>::size() const
+{
+    return data.size();
+}
+
+template <typename T, typename Compare, typename Allocator>
+void flat_set<T, Compare, Allocator>::clear()
+{
+    data.clear();
+}
+
+template <typename T, typename Compare, typename Allocator>
+void flat_set<T, Compare, Allocator>::reserve(size_t n)
+{
+    data.reserve(n);
+}
+
+template <typename T, typename Compare, typename Allocator>
+void flat_set<T, Compare, Allocator>::shrink_to_fit()
+{
+    data.shrink_to_fit();
+}
+
+template <typename T, typename Compare, typename Allocator>
+typename flat_set<T, Compare, Allocator>::iterator flat_set<T, Compare, Allocator>::begin() const
+{
+    return data.begin();
+}
+
+template <typename T, typename Compare, typename Allocator>
+typename flat_set<T, Compare, Allocator>::iterator flat_set<T, Compare, Allocator>::end() const
+{
+    return data.end();
+}
+
+template <typename T, typename Compare, typename Allocator>
+typename flat_set<T, Compare, Allocator>::const_iterator flat_set<T, Compare, Allocator>::cbegin() const
+{
+    return data.cbegin();
+}
+
+template <typename T, typename Compare, typename Allocator>
+typename flat_set<T, Compare, Allocator>::const_iterator flat_set<T, Compare, Allocator>::cend() const
+{
+    return data.cend();
+}
+
+template <typename T, typename Compare, typename Allocator>
+typename flat_set<T, Compare, Allocator>::reverse_iterator flat_set<T, Compare, Allocator>::rbegin() const
+{
+    return reverse_iterator(end());
+}
+
+template <typename T, typename Compare, typename Allocator>
+typename flat_set<T, Compare, Allocator>::reverse_iterator flat_set<T, Compare, Allocator>::rend() const
+{
+    return reverse_iterator(begin());
+}
+
+template <typename T, typename Compare, typename Allocator>
+typename flat_set<T, Compare, Allocator>::const_reverse_iterator flat_set<T, Compare, Allocator>::crbegin() const
+{
+    return const_reverse_iterator(end());
+}
+
+template <typename T, typename Compare, typename Allocator>
+typename flat_set<T, Compare, Allocator>::const_reverse_iterator flat_set<T, Compare, Allocator>::crend() const
+{
+    return const_reverse_iterator(begin());
+}
+
+template <typename T, typename Compare, typename Allocator>
+void flat_set<T, Compare, Allocator>::swap(flat_set& other)
+{
+    data.swap(other.data);
+    std::swap(comp, other.comp);
+}
+
+template <typename T, typename Compare, typename Allocator>
+void swap(flat_set<T, Compare, Allocator>& a, flat_set<T, Compare, Allocator>& b)
+{
+    a.swap(b);
+}
+
+#endif //MY_FLAT_SET_H
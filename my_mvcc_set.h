@@ -0,0 +1,241 @@
+#ifndef MY_MVCC_SET_H
+#define MY_MVCC_SET_H
+
+#include "my_persistent_set.h"
+#include "epoch_reclaim.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+// Изоляция снимков для одного писателя и многих читателей. Читатель закрепляет
+// эпоху и получает опубликованную версию: её можно обходить без блокировок,
+// пока писатель готовит следующие. Версии -- persistent_set: новая версия
+// разделяет с предыдущей все узлы, кроме скопированных путей. Старая версия
+// откладывается в epoch_domain и освобождается, когда её не может читать ни
+// один читатель; вместе с ней освобождаются узлы, которых нет в новых версиях.
+// Изменения сериализуются мьютексом писателя
+template <typename T, typename Compare = std::less<T>, typename Allocator = std::allocator<T>>
+class mvcc_set
+{
+public:
+    typedef T key_type;
+    typedef T value_type;
+    typedef persistent_set<T, Compare, Allocator> version_type;
+    typedef typename version_type::const_iterator const_iterator;
+
+    // Версия, закреплённая читателем. Пока вид жив, версия и её узлы не освобождаются;
+    // держать его долго не стоит: память старых версий копится
+    class read_view
+    {
+        friend class mvcc_set;
+
+    private:
+        epoch_domain::guard pin;
+        version_type const* version;
+
+        read_view(epoch_domain::guard&& pin, version_type const* version);
+
+    public:
+        read_view(read_view&& other) noexcept;
+        read_view& operator=(read_view&& other) noexcept;
+
+        version_type const& get() const;
+        version_type const* operator->() const;
+
+        const_iterator begin() const;
+        const_iterator end() const;
+    };
+
+private:
+    mutable epoch_domain epochs;
+    std::atomic<version_type const*> current;
+    std::mutex writer_lock;
+
+    static void destroy_version(void* version);
+    void publish(version_type* version);
+
+public:
+    mvcc_set();
+    explicit mvcc_set(version_type initial);
+    ~mvcc_set();
+
+    mvcc_set(mvcc_set const&) = delete;
+    mvcc_set& operator=(mvcc_set const&) = delete;
+
+    read_view read() const;
+    // Снимок текущей версии, не привязанный к эпохам: узлы держит счётчик ссылок
+    version_type snapshot() const;
+
+    bool insert(value_type const& x);
+    bool insert(value_type&& x);
+    size_t erase(value_type const& x);
+    // f(version_type&) меняет новую версию, которая публикуется целиком после
+    // возврата: читатели видят либо все изменения f, либо ни одного
+    template <typename F>
+    void update(F f);
+
+    // Освобождает отложенные версии, которые уже никто не читает
+    void reclaim();
+};
+
+
+/// READ VIEW IMPLEMENTATION =================================================================
+
+template <typename T, typename Compare, typename Allocator>
+mvcc_set<T, Compare, Allocator>::read_view::read_view(epoch_domain::guard&& pin, version_type const* version)
+        : pin(std::move(pin)),
+          version(version)
+{}
+
+template <typename T, typename Compare, typename Allocator>
+mvcc_set<T, Compare, Allocator>::read_view::read_view(read_view&& other) noexcept
+        : pin(std::move(other.pin)),
+          version(other.version)
+{
+    other.version = nullptr;
+}
+
+template <typename T, typename Compare, typename Allocator>
+typename mvcc_set<T, Compare, Allocator>::read_view& mvcc_set<T, Compare, Allocator>::read_view::operator=(read_view&& other) noexcept
+{
+    pin = std::move(other.pin);
+    version = other.version;
+    other.version = nullptr;
+    return *this;
+}
+
+template <typename T, typename Compare, typename Allocator>
+typename mvcc_set<T, Compare, Allocator>::version_type const& mvcc_set<T, Compare, Allocator>::read_view::get() const
+{
+    return *version;
+}
+
+template <typename T, typename Compare, typename Allocator>
+typename mvcc_set<T, Compare, Allocator>::version_type const* mvcc_set<T, Compare, Allocator>::read_view::operator->() const
+{
+    return version;
+}
+
+template <typename T, typename Compare, typename Allocator>
+typename mvcc_set<T, Compare, Allocator>::const_iterator mvcc_set<T, Compare, Allocator>::read_view::begin() const
+{
+    return version->begin();
+}
+
+template <typename T, typename Compare, typename Allocator>
+typename mvcc_set<T, Compare, Allocator>::const_iterator mvcc_set<T, Compare, Allocator>::read_view::end() const
+{
+    return version->end();
+}
+
+/// MVCC SET IMPLEMENTATION ==================================================================
+
+template <typename T, typename Compare, typename Allocator>
+mvcc_set<T, Compare, Allocator>::mvcc_set()
+        : epochs(),
+          current(new version_type()),
+          writer_lock()
+{}
+
+template <typename T, typename Compare, typename Allocator>
+mvcc_set<T, Compare, Allocator>::mvcc_set(version_type initial)
+        : epochs(),
+          current(new version_type(std::move(initial))),
+          writer_lock()
+{}
+
+template <typename T, typename Compare, typename Allocator>
+mvcc_set<T, Compare, Allocator>::~mvcc_set()
+{
+    // Отложенные версии освободит деструктор epochs
+    delete current.load();
+}
+
+template <typename T, typename Compare, typename Allocator>
+void mvcc_set<T, Compare, Allocator>::destroy_version(void* version)
+{
+    delete static_cast<version_type*>(version);
+}
+
+template <typename T, typename Compare, typename Allocator>
+void mvcc_set<T, Compare, Allocator>::publish(version_type* version)
+{
+    // Вызывается под writer_lock. Читатель, закрепивший эпоху до замены, ещё может
+    // держать старую версию, поэтому она не удаляется, а откладывается
+    version_type const* old = current.exchange(version);
+    epochs.retire(const_cast<version_type*>(old), &mvcc_set::destroy_version);
+}
+
+template <typename T, typename Compare, typename Allocator>
+typename mvcc_set<T, Compare, Allocator>::read_view mvcc_set<T, Compare, Allocator>::read() const
+{
+    epoch_domain::guard pin = epochs.pin();
+    return read_view(std::move(pin), current.load());
+}
+
+template <typename T, typename Compare, typename Allocator>
+typename mvcc_set<T, Compare, Allocator>::version_type mvcc_set<T, Compare, Allocator>::snapshot() const
+{
+    read_view view = read();
+    return view.get();
+}
+
+template <typename T, typename Compare, typename Allocator>
+template <typename F>
+void mvcc_set<T, Compare, Allocator>::update(F f)
+{
+    std::lock_guard<std::mutex> guard(writer_lock);
+    std::unique_ptr<version_type> next(new version_type(*current.load()));
+    f(*next);
+    publish(next.release());
+}
+
+template <typename T, typename Compare, typename Allocator>
+bool mvcc_set<T, Compare, Allocator>::insert(value_type const& x)
+{
+    // Повторный ключ не порождает новой версии
+    std::lock_guard<std::mutex> guard(writer_lock);
+    if (current.load()->contains(x))
+        return false;
+    std::unique_ptr<version_type> next(new version_type(*current.load()));
+    next->insert(x);
+    publish(next.release());
+    return true;
+}
+
+template <typename T, typename Compare, typename Allocator>
+bool mvcc_set<T, Compare, Allocator>::insert(value_type&& x)
+{
+    std::lock_guard<std::mutex> guard(writer_lock);
+    if (current.load()->contains(x))
+        return false;
+    std::unique_ptr<version_type> next(new version_type(*current.load()));
+    next->insert(std::move(x));
+    publish(next.release());
+    return true;
+}
+
+template <typename T, typename Compare, typename Allocator>
+size_t mvcc_set<T, Compare, Allocator>::erase(value_type const& x)
+{
+    std::lock_guard<std::mutex> guard(writer_lock);
+    if (!current.load()->contains(x))
+        return 0;
+    std::unique_ptr<version_type> next(new version_type(*current.load()));
+    next->erase(x);
+    publish(next.release());
+    return 1;
+}
+
+template <typename T, typename Compare, typename Allocator>
+void mvcc_set<T, Compare, Allocator>::reclaim()
+{
+    // Отложенное освобождается, когда эпоха уйдёт на две вперёд
+    std::lock_guard<std::mutex> guard(writer_lock);
+    epochs.collect();
+    epochs.collect();
+}
+
+#endif //MY_MVCC_SET_H
@@ -0,0 +1,661 @@
+#ifndef MY_PERSISTENT_SET_H
+#define MY_PERSISTENT_SET_H
+
+#include "my_set.h"
+
+#include <atomic>
+#include <iterator>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// Персистентное AVL-дерево с копированием путей. Копия множества (snapshot)
+// делается за O(1): версии разделяют узлы, у каждого узла счётчик ссылок.
+// insert и erase копируют только разделяемые узлы на пути от корня, O(log n)
+// узлов, а узлы, которыми версия владеет одна, меняют на месте.
+//
+// Разные версии можно читать и менять из разных потоков, одну версию --
+// как обычный контейнер. Узлы освобождаются той версией, которая отпустила
+// последнюю ссылку, поэтому при передаче версий между потоками аллокатор
+// должен быть потокобезопасным.
+//
+// Узлы не хранят родителей (у узла их может быть много), поэтому итератор
+// хранит путь от корня и только прямой. По той же причине insert и erase
+// не возвращают итераторов
+template <typename T, typename Compare = std::less<T>, typename Allocator = std::allocator<T>>
+class persistent_set
+{
+public:
+    typedef T key_type;
+    typedef T value_type;
+    typedef Compare key_compare;
+    typedef Compare value_compare;
+
+private:
+    struct Node
+    {
+        Node *left_child, *right_child;
+        std::atomic<size_t> refs;
+        int height;
+        value_type key;
+
+        template <typename... Args>
+        explicit Node(Args&&... args);
+    };
+
+    class Iterator : public std::iterator<std::forward_iterator_tag, T const>
+    {
+        friend class persistent_set;
+
+    private:
+        // Путь от корня до текущего узла по узлам, из которых ещё предстоит выйти
+        // вправо: вершина -- текущий узел
+        std::vector<Node const*> path;
+
+        void descend_left(Node const* node);
+
+    public:
+        Iterator();
+
+        T const& operator*() const;
+        T const* operator->() const;
+
+        bool operator==(Iterator const& other) const;
+        bool operator!=(Iterator const& other) const;
+
+        Iterator& operator++();
+        Iterator operator++(int);
+    };
+
+    typedef typename std::allocator_traits<Allocator>::template rebind_alloc<Node> node_allocator;
+    typedef std::allocator_traits<node_allocator> node_traits;
+
+public:
+    using allocator_type = Allocator;
+    using iterator = Iterator;
+    using const_iterator = Iterator;
+
+private:
+    Node* root;
+    size_t siz;
+    node_allocator alloc;
+    Compare comp;
+
+    key_less<Compare> less() const;
+
+    template <typename... Args>
+    Node* create_node(Args&&... args);
+    static Node* acquire(Node* node);
+    void release(Node* node);
+    void own(Node*& link);
+
+    static int height(Node const* node);
+    static void update_height(Node* node);
+    void rotate_left(Node*& link);
+    void rotate_right(Node*& link);
+    void balance(Node*& link);
+
+    template <typename V>
+    void insert_node(Node*& link, V&& x);
+    void erase_node(Node*& link, value_type const& x);
+
+    template <typename K>
+    Node const* find_node(K const& x) const;
+
+public:
+    persistent_set();
+    explicit persistent_set(Compare const& comp, Allocator const& allocator = Allocator());
+    explicit persistent_set(Allocator const& allocator);
+    template <typename InputIt>
+    persistent_set(InputIt first, InputIt last, Compare const& comp = Compare(), Allocator const& allocator = Allocator());
+    // Копирование -- тот же снимок за O(1)
+    persistent_set(persistent_set const& other);
+    persistent_set(persistent_set&& other) noexcept;
+
+    ~persistent_set();
+
+    persistent_set& operator=(persistent_set const& other);
+    persistent_set& operator=(persistent_set&& other) noexcept;
+
+    // Неизменяемая версия на текущий момент; дальнейшие изменения *this её не затрагивают
+    persistent_set snapshot() const;
+
+    allocator_type get_allocator() const;
+    key_compare key_comp() const;
+    value_compare value_comp() const;
+
+    bool insert(value_type const& x);
+    bool insert(value_type&& x);
+    size_t erase(value_type const& x);
+
+    const_iterator find(value_type const& x) const;
+    const_iterator lower_bound(value_type const& x) const;
+    size_t count(value_type const& x) const;
+    bool contains(value_type const& x) const;
+
+    bool empty() const;
+    size_t size() const;
+    size_t height() const;
+    void clear();
+
+    iterator begin() const;
+    iterator end() const;
+    const_iterator cbegin() const;
+    const_iterator cend() const;
+
+    void swap(persistent_set& other) noexcept;
+};
+
+
+/// NODE IMPLEMENTATION ======================================================================
+
+template <typename T, typename Compare, typename Allocator>
+template <typename... Args>
+persistent_set<T, Compare, Allocator>::Node::Node(Args&&... args)
+        : left_child(nullptr),
+          right_child(nullptr),
+          refs(1),
+          height(1),
+          key(std::forward<Args>(args)...)
+{}
+
+/// ITERATOR IMPLEMENTATION ==================================================================
+
+template <typename T, typename Compare, typename Allocator>
+persistent_set<T, Compare, Allocator>::Iterator::Iterator()
+        : path()
+{}
+
+template <typename T, typename Compare, typename Allocator>
+void persistent_set<T, Compare, Allocator>::Iterator::descend_left(Node const* node)
+{
+    for (; node; node = node->left_child)
+        path.push_back(node);
+}
+
+template <typename T, typename Compare, typename Allocator>
+T const& persistent_set<T, Compare, Allocator>::Iterator::operator*() const
+{
+    return path.back()->key;
+}
+
+template <typename T, typename Compare, typename Allocator>
+T const* persistent_set<T, Compare, Allocator>::Iterator::operator->() const
+{
+    return &path.back()->key;
+}
+
+template <typename T, typename Compare, typename Allocator>
+bool persistent_set<T, Compare, Allocator>::Iterator::operator==(Iterator const& other) const
+{
+    return path.empty() ? other.path.empty() : !other.path.empty() && path.back() == other.path.back();
+}
+
+template <typename T, typename Compare, typename Allocator>
+bool persistent_set<T, Compare, Allocator>::Iterator::operator!=(Iterator const& other) const
+{
+    return !(*this == other);
+}
+
+template <typename T, typename Compare, typename Allocator>
+typename persistent_set<T, Compare, Allocator>::Iterator& persistent_set<T, Compare, Allocator>::Iterator::operator++()
+{
+    Node const* node = path.back();
+    path.pop_back();
+    descend_left(node->right_child);
+    return *this;
+}
+
+template <typename T, typename Compare, typename Allocator>
+typename persistent_set<T, Compare, Allocator>::Iterator persistent_set<T, Compare, Allocator>::Iterator::operator++(int)
+{
+    Iterator old(*this);
+    ++*this;
+    return old;
+}
+
+/// PERSISTENT SET IMPLEMENTATION ============================================================
+
+template <typename T, typename Compare, typename Allocator>
+persistent_set<T, Compare, Allocator>::persistent_set()
+        : root(nullptr),
+          siz(0),
+          alloc(),
+          comp()
+{}
+
+template <typename T, typename Compare, typename Allocator>
+persistent_set<T, Compare, Allocator>::persistent_set(Compare const& comp, Allocator const& allocator)
+        : root(nullptr),
+          siz(0),
+          alloc(allocator),
+          comp(comp)
+{}
+
+template <typename T, typename Compare, typename Allocator>
+persistent_set<T, Compare, Allocator>::persistent_set(Allocator const& allocator)
+        : root(nullptr),
+          siz(0),
+          alloc(allocator),
+          comp()
+{}
+
+template <typename T, typename Compare, typename Allocator>
+template <typename InputIt>
+persistent_set<T, Compare, Allocator>::persistent_set(InputIt first, InputIt last, Compare const& comp, Allocator const& allocator)
+        : root(nullptr),
+          siz(0),
+          alloc(allocator),
+          comp(comp)
+{
+    try
+    {
+        for (; first != last; ++first)
+            insert(*first);
+    }
+    catch (...)
+    {
+        release(root);
+        throw;
+    }
+}
+
+template <typename T, typename Compare, typename Allocator>
+persistent_set<T, Compare, Allocator>::persistent_set(persistent_set const& other)
+        : root(acquire(other.root)),
+          siz(other.siz),
+          alloc(other.alloc),
+          comp(other.comp)
+{}
+
+template <typename T, typename Compare, typename Allocator>
+persistent_set<T, Compare, Allocator>::persistent_set(persistent_set&& other) noexcept
+        : root(other.root),
+          siz(other.siz),
+          alloc(other.alloc),
+          comp(other.comp)
+{
+    other.root = nullptr;
+    other.siz = 0;
+}
+
+template <typename T, typename Compare, typename Allocator>
+persistent_set<T, Compare, Allocator>::~persistent_set()
+{
+    release(root);
+}
+
+template <typename T, typename Compare, typename Allocator>
+persistent_set<T, Compare, Allocator>& persistent_set<T, Compare, Allocator>::operator=(persistent_set const& other)
+{
+    persistent_set copy(other);
+    swap(copy);
+    return *this;
+}
+
+template <typename T, typename Compare, typename Allocator>
+persistent_set<T, Compare, Allocator>& persistent_set<T, Compare, Allocator>::operator=(persistent_set&& other) noexcept
+{
+    persistent_set moved(std::move(other));
+    swap(moved);
+    return *this;
+}
+
+template <typename T, typename Compare, typename Allocator>
+persistent_set<T, Compare, Allocator> persistent_set<T, Compare, Allocator>::snapshot() const
+{
+    return *this;
+}
+
+template <typename T, typename Compare, typename Allocator>
+typename persistent_set<T, Compare, Allocator>::allocator_type persistent_set<T, Compare, Allocator>::get_allocator() const
+{
+    return allocator_type(alloc);
+}
+
+template <typename T, typename Compare, typename Allocator>
+typename persistent_set<T, Compare, Allocator>::key_compare persistent_set<T, Compare, Allocator>::key_comp() const
+{
+    return comp;
+}
+
+template <typename T, typename Compare, typename Allocator>
+typename persistent_set<T, Compare, Allocator>::value_compare persistent_set<T, Compare, Allocator>::value_comp() const
+{
+    return comp;
+}
+
+template <typename T, typename Compare, typename Allocator>
+key_less<Compare> persistent_set<T, Compare, Allocator>::less() const
+{
+    return key_less<Compare>{comp};
+}
+
+template <typename T, typename Compare, typename Allocator>
+template <typename... Args>
+typename persistent_set<T, Compare, Allocator>::Node* persistent_set<T, Compare, Allocator>::create_node(Args&&... args)
+{
+    Node* node = node_traits::allocate(alloc, 1);
+    try
+    {
+        node_traits::construct(alloc, node, std::forward<Args>(args)...);
+    }
+    catch (...)
+    {
+        node_traits::deallocate(alloc, node, 1);
+        throw;
+    }
+    return node;
+}
+
+template <typename T, typename Compare, typename Allocator>
+typename persistent_set<T, Compare, Allocator>::Node* persistent_set<T, Compare, Allocator>::acquire(Node* node)
+{
+    if (node)
+        node->refs.fetch_add(1, std::memory_order_relaxed);
+    return node;
+}
+
+template <typename T, typename Compare, typename Allocator>
+void persistent_set<T, Compare, Allocator>::release(Node* node)
+{
+    // Последняя ссылка освобождает узел и отпускает его детей. Спуск только
+    // по освобождаемым узлам, так что глубина рекурсии не больше высоты дерева
+    while (node && node->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        Node* right = node->right_child;
+        release(node->left_child);
+        node_traits::destroy(alloc, node);
+        node_traits::deallocate(alloc, node, 1);
+        node = right;
+    }
+}
+
+template <typename T, typename Compare, typename Allocator>
+void persistent_set<T, Compare, Allocator>::own(Node*& link)
+{
+    // Узел, на который ссылается только эта версия, меняется на месте; разделяемый
+    // заменяется копией, и копия забирает ссылку версии на него. Вызывается по пути
+    // от корня, так что link уже лежит в узле, принадлежащем версии.
+    // Ссылки меняются только после копирования: если копирование ключа бросит
+    // исключение, дерево останется целым
+    if (link->refs.load(std::memory_order_acquire) == 1)
+        return;
+    Node* node = link;
+    Node* copy = create_node(node->key);
+    copy->left_child = acquire(node->left_child);
+    copy->right_child = acquire(node->right_child);
+    copy->height = node->height;
+    link = copy;
+    release(node);
+}
+
+template <typename T, typename Compare, typename Allocator>
+int persistent_set<T, Compare, Allocator>::height(Node const* node)
+{
+    return node ? node->height : 0;
+}
+
+template <typename T, typename Compare, typename Allocator>
+void persistent_set<T, Compare, Allocator>::update_height(Node* node)
+{
+    node->height = std::max(height(node->left_child), height(node->right_child)) + 1;
+}
+
+template <typename T, typename Compare, typename Allocator>
+void persistent_set<T, Compare, Allocator>::rotate_left(Node*& link)
+{
+    Node* node = link;
+    own(node->right_child);
+    Node* right = node->right_child;
+    node->right_child = right->left_child;
+    right->left_child = node;
+    update_height(node);
+    update_height(right);
+    link = right;
+}
+
+template <typename T, typename Compare, typename Allocator>
+void persistent_set<T, Compare, Allocator>::rotate_right(Node*& link)
+{
+    Node* node = link;
+    own(node->left_child);
+    Node* left = node->left_child;
+    node->left_child = left->right_child;
+    left->right_child = node;
+    update_height(node);
+    update_height(left);
+    link = left;
+}
+
+template <typename T, typename Compare, typename Allocator>
+void persistent_set<T, Compare, Allocator>::balance(Node*& link)
+{
+    // link уже принадлежит версии; при поворотах копируются только задетые дети
+    Node* node = link;
+    update_height(node);
+    int factor = height(node->left_child) - height(node->right_child);
+    if (factor > 1)
+    {
+        if (height(node->left_child->right_child) > height(node->left_child->left_child))
+        {
+            own(node->left_child);
+            rotate_left(node->left_child);
+        }
+        rotate_right(link);
+    }
+    else if (factor < -1)
+    {
+        if (height(node->right_child->left_child) > height(node->right_child->right_child))
+        {
+            own(node->right_child);
+            rotate_right(node->right_child);
+        }
+        rotate_left(link);
+    }
+}
+
+template <typename T, typename Compare, typename Allocator>
+template <typename V>
+void persistent_set<T, Compare, Allocator>::insert_node(Node*& link, V&& x)
+{
+    // Ключа x в дереве нет
+    if (!link)
+    {
+        link = create_node(std::forward<V>(x));
+        siz++;
+        return;
+    }
+    own(link);
+    if (less()(x, link->key))
+        insert_node(link->left_child, std::forward<V>(x));
+    else
+        insert_node(link->right_child, std::forward<V>(x));
+    balance(link);
+}
+
+template <typename T, typename Compare, typename Allocator>
+void persistent_set<T, Compare, Allocator>::erase_node(Node*& link, value_type const& x)
+{
+    // Ключ x в дереве есть
+    own(link);
+    Node* node = link;
+    if (less()(x, node->key))
+        erase_node(node->left_child, x);
+    else if (less()(node->key, x))
+        erase_node(node->right_child, x);
+    else if (!node->left_child || !node->right_child)
+    {
+        link = node->left_child ? node->left_child : node->right_child;
+        node->left_child = node->right_child = nullptr;
+        release(node);
+        siz--;
+        return;
+    }
+    else
+    {
+        // Узел заменяется новым узлом с ключом-последователем, а сам последователь
+        // удаляется из правого поддерева: у него не больше одного ребёнка
+        Node const* next = node->right_child;
+        while (next->left_child)
+            next = next->left_child;
+        Node* replacement = create_node(next->key);
+        replacement->left_child = node->left_child;
+        replacement->right_child = node->right_child;
+        replacement->height = node->height;
+        node->left_child = node->right_child = nullptr;
+        link = replacement;
+        release(node);
+        erase_node(replacement->right_child, replacement->key);
+    }
+    balance(link);
+}
+
+template <typename T, typename Compare, typename Allocator>
+bool persistent_set<T, Compare, Allocator>::insert(value_type const& x)
+{
+    // Сначала поиск: повторный ключ не должен копировать путь
+    if (find_node(x))
+        return false;
+    insert_node(root, x);
+    return true;
+}
+
+template <typename T, typename Compare, typename Allocator>
+bool persistent_set<T, Compare, Allocator>::insert(value_type&& x)
+{
+    if (find_node(x))
+        return false;
+    insert_node(root, std::move(x));
+    return true;
+}
+
+template <typename T, typename Compare, typename Allocator>
+size_t persistent_set<T, Compare, Allocator>::erase(value_type const& x)
+{
+    if (!find_node(x))
+        return 0;
+    erase_node(root, x);
+    return 1;
+}
+
+template <typename T, typename Compare, typename Allocator>
+template <typename K>
+typename persistent_set<T, Compare, Allocator>::Node const* persistent_set<T, Compare, Allocator>::find_node(K const& x) const
+{
+    key_less<Compare> cmp = less();
+    Node const* node = root;
+    while (node)
+    {
+        if (cmp(x, node->key))
+            node = node->left_child;
+        else if (cmp(node->key, x))
+            node = node->right_child;
+        else
+            return node;
+    }
+    return nullptr;
+}
+
+template <typename T, typename Compare, typename Allocator>
+typename persistent_set<T, Compare, Allocator>::const_iterator persistent_set<T, Compare, Allocator>::find(value_type const& x) const
+{
+    const_iterator result = lower_bound(x);
+    if (result != end() && less()(x, *result))
+        return end();
+    return result;
+}
+
+template <typename T, typename Compare, typename Allocator>
+typename persistent_set<T, Compare, Allocator>::const_iterator persistent_set<T, Compare, Allocator>::lower_bound(value_type const& x) const
+{
+    // На пути остаются только узлы не меньше x: из них предстоит выйти вправо
+    const_iterator result;
+    key_less<Compare> cmp = less();
+    for (Node const* node = root; node; )
+    {
+        if (cmp(node->key, x))
+            node = node->right_child;
+        else
+        {
+            result.path.push_back(node);
+            node = node->left_child;
+        }
+    }
+    return result;
+}
+
+template <typename T, typename Compare, typename Allocator>
+size_t persistent_set<T, Compare, Allocator>::count(value_type const& x) const
+{
+    return find_node(x) ? 1 : 0;
+}
+
+template <typename T, typename Compare, typename Allocator>
+bool persistent_set<T, Compare, Allocator>::contains(value_type const& x) const
+{
+    return find_node(x) != nullptr;
+}
+
+template <typename T, typename Compare, typename Allocator>
+bool persistent_set<T, Compare, Allocator>::empty() const
+{
+    return siz == 0;
+}
+
+template <typename T, typename Compare, typename Allocator>
+size_t persistent_set<T, Compare, Allocator>::size() const
+{
+    return siz;
+}
+
+template <typename T, typename Compare, typename Allocator>
+size_t persistent_set<T, Compare, Allocator>::height() const
+{
+    return static_cast<size_t>(height(root));
+}
+
+template <typename T, typename Compare, typename Allocator>
+void persistent_set<T, Compare, Allocator>::clear()
+{
+    release(root);
+    root = nullptr;
+    siz = 0;
+}
+
+template <typename T, typename Compare, typename Allocator>
+typename persistent_set<T, Compare, Allocator>::iterator persistent_set<T, Compare, Allocator>::begin() const
+{
+    iterator result;
+    result.descend_left(root);
+    return result;
+}
+
+template <typename T, typename Compare, typename Allocator>
+typename persistent_set<T, Compare, Allocator>::iterator persistent_set<T, Compare, Allocator>::end() const
+{
+    return iterator();
+}
+
+template <typename T, typename Compare, typename Allocator>
+typename persistent_set<T, Compare, Allocator>::const_iterator persistent_set<T, Compare, Allocator>::cbegin() const
+{
+    return begin();
+}
+
+template <typename T, typename Compare, typename Allocator>
+typename persistent_set<T, Compare, Allocator>::const_iterator persistent_set<T, Compare, Allocator>::cend() const
+{
+    return end();
+}
+
+template <typename T, typename Compare, typename Allocator>
+void persistent_set<T, Compare, Allocator>::swap(persistent_set& other) noexcept
+{
+    std::swap(root, other.root);
+    std::swap(siz, other.siz);
+    std::swap(alloc, other.alloc);
+    std::swap(comp, other.comp);
+}
+
+#endif //MY_PERSISTENT_SET_H
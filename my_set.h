@@ -1,33 +1,190 @@
 #ifndef MY_SET_H
 #define MY_SET_H
 
+#include <algorithm>
 #include <cstddef>
-#include <utility>
+#include <exception>
+#include <functional>
 #include <iterator>
+#include <memory>
+#include <new>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "work_stealing_pool.h"
+
+// Тег для конструирования из уже отсортированного диапазона без повторов
+struct sorted_unique_t {};
+constexpr sorted_unique_t sorted_unique{};
 
+// Тег для параллельного построения из большого неотсортированного диапазона
+struct parallel_build_t {};
+constexpr parallel_build_t parallel_build{};
+
+// Трёхсторонний компаратор возвращает отрицательное число, ноль или
+// положительное число (как strcmp) и помечается вложенным типом is_three_way.
+// С ним спуск по дереву делает ровно одно сравнение на узел и останавливается
+// на равном ключе.
 template <typename T>
+struct three_way_compare
+{
+    typedef void is_three_way;
+
+    int operator()(T const& a, T const& b) const
+    {
+        return a < b ? -1 : (b < a ? 1 : 0);
+    }
+};
+
+template <typename CharT, typename Traits, typename Alloc>
+struct three_way_compare<std::basic_string<CharT, Traits, Alloc>>
+{
+    typedef void is_three_way;
+
+    int operator()(std::basic_string<CharT, Traits, Alloc> const& a,
+                   std::basic_string<CharT, Traits, Alloc> const& b) const
+    {
+        return a.compare(b);
+    }
+};
+
+// Прозрачный компаратор: сравнивает ключи разных типов оператором <,
+// например std::string с const char* без построения временной строки
+struct transparent_less
+{
+    typedef void is_transparent;
+
+    template <typename A, typename B>
+    bool operator()(A const& a, B const& b) const
+    {
+        return a < b;
+    }
+};
+
+template <typename Compare, typename = void>
+struct is_three_way_compare : std::false_type {};
+
+template <typename Compare>
+struct is_three_way_compare<Compare, typename std::conditional<true, void, typename Compare::is_three_way>::type>
+        : std::true_type {};
+
+// Сравнение "меньше" поверх любого компаратора множества, в том числе трёхстороннего;
+// нужно контейнерам, которые работают только с предикатом "меньше"
+template <typename Compare, bool = is_three_way_compare<Compare>::value>
+struct key_less
+{
+    Compare const& comp;
+
+    template <typename A, typename B>
+    bool operator()(A const& a, B const& b) const
+    {
+        return comp(a, b);
+    }
+};
+
+template <typename Compare>
+struct key_less<Compare, true>
+{
+    Compare const& comp;
+
+    template <typename A, typename B>
+    bool operator()(A const& a, B const& b) const
+    {
+        return comp(a, b) < 0;
+    }
+};
+
+// Прошивка узлов: при Threaded узлы связаны ещё и в кольцевой двусвязный список
+// в порядке обхода, замкнутый через заголовок. Без прошивки лишних полей нет
+template <typename Node, bool Threaded>
+struct inorder_links
+{
+    Node *prev, *next;
+
+    inorder_links() : prev(nullptr), next(nullptr) {}
+};
+
+template <typename Node>
+struct inorder_links<Node, false> {};
+
+// Размер поддерева в узле для порядковых статистик при Ranked
+template <bool Ranked>
+struct subtree_size
+{
+    size_t size;
+
+    subtree_size() : size(1) {}
+};
+
+template <>
+struct subtree_size<false> {};
+
+// Политика агрегата по поддереву. Она задаёт моноид над ключами:
+//     typedef ... value_type;
+//     static value_type identity();                        -- нейтральный элемент
+//     static value_type make(Key const& key);              -- значение одного ключа
+//     static value_type combine(value_type const& a, value_type const& b);
+// combine должна быть ассоциативной, коммутативность не нужна.
+// no_augment -- без агрегата и без лишних полей в узлах
+struct no_augment {};
+
+template <typename Augment>
+struct subtree_aggregate
+{
+    typename Augment::value_type aggregate;
+
+    subtree_aggregate() : aggregate(Augment::identity()) {}
+};
+
+template <>
+struct subtree_aggregate<no_augment> {};
+
+// Threaded = true: ++ и -- у итераторов -- один переход по указателю вместо
+// подъёма по родителям, ценой двух указателей в каждом узле.
+// Ranked = true: узлы хранят размеры поддеревьев, и rank, nth, count_range
+// и distance работают за O(log n), ценой одного size_t в каждом узле.
+// Augment: узлы хранят агрегат политики по своему поддереву, и aggregate(lo, hi)
+// сворачивает любой диапазон ключей за O(log n)
+template <typename T, typename Compare = std::less<T>, typename Allocator = std::allocator<T>, bool Threaded = false, bool Ranked = false, typename Augment = no_augment>
 class set
 {
+public:
+    typedef T key_type;
     typedef T value_type;
+    typedef Compare key_compare;
+    typedef Compare value_compare;
+
+private:
 
-    struct BaseNode
+    struct BaseNode : public inorder_links<BaseNode, Threaded>, public subtree_size<Ranked>,
+                      public subtree_aggregate<Augment>
     {
         BaseNode *parent, *left_child, *right_child;
+        int height;
 
         BaseNode() ;
         BaseNode(BaseNode* parent);
         BaseNode(BaseNode* parent, BaseNode* left, BaseNode* right);
-
-        virtual ~BaseNode();
     };
 
     struct Node : public BaseNode
     {
         value_type key;
 
-        Node(value_type const& key) ;
-        Node(value_type const& key, BaseNode* parent) ;
-        Node(value_type const& key, BaseNode* parent, BaseNode* left, BaseNode* right) ;
+        template <typename... Args>
+        explicit Node(Args&&... args);
+    };
+
+    // Фиктивный узел, он же end(): left_child -- корень дерева, parent всегда nullptr.
+    // leftmost и rightmost -- первый и последний узлы, в пустом дереве сам заголовок
+    struct Header : public BaseNode
+    {
+        BaseNode *leftmost, *rightmost;
+
+        Header();
     };
 
     template <typename U>
@@ -61,39 +218,328 @@ class set
         Iterator operator--(int);
     };
 
+    typedef std::integral_constant<bool, Threaded> threaded_tag;
+    typedef std::integral_constant<bool, Ranked> ranked_tag;
+    typedef std::integral_constant<bool, !std::is_same<Augment, no_augment>::value> augmented_tag;
+    // Есть ли в узлах сводки (размер или агрегат), которые меняются до самого корня
+    typedef std::integral_constant<bool, Ranked || augmented_tag::value> summary_tag;
+
+    typedef typename std::allocator_traits<Allocator>::template rebind_alloc<Node> node_allocator;
+    typedef std::allocator_traits<node_allocator> node_traits;
+
+    // Владеющий дескриптор отцепленного узла, как node_type у std::set.
+    // Аллокатор хранится вместе с узлом и конструируется, только пока узел есть
+    class NodeHandle
+    {
+        friend class set;
+
+    private:
+        Node* ptr;
+        typename std::aligned_storage<sizeof(node_allocator), alignof(node_allocator)>::type alloc_storage;
+
+        NodeHandle(Node* ptr, node_allocator const& alloc);
+
+        node_allocator& alloc() const;
+        Node* release();
+        void reset();
+
+    public:
+        typedef T value_type;
+        typedef Allocator allocator_type;
+
+        NodeHandle() noexcept;
+        NodeHandle(NodeHandle&& other) noexcept;
+        NodeHandle& operator=(NodeHandle&& other) noexcept;
+        ~NodeHandle();
+
+        NodeHandle(NodeHandle const&) = delete;
+        NodeHandle& operator=(NodeHandle const&) = delete;
+
+        bool empty() const noexcept;
+        explicit operator bool() const noexcept;
+        // Ключ можно менять: узел вне дерева
+        value_type& value() const;
+        allocator_type get_allocator() const;
+        void swap(NodeHandle& other) noexcept;
+    };
+
 public:
+    using allocator_type = Allocator;
     using iterator = Iterator<T const>;
     using const_iterator = Iterator<T const>;
     using reverse_iterator = std::reverse_iterator<iterator>;
     using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+    using node_type = NodeHandle;
+
+    struct insert_return_type
+    {
+        iterator position;
+        bool inserted;
+        node_type node;
+    };
 
 private:
     size_t siz;
-    BaseNode root;
+    Header root;
+    node_allocator alloc;
+    Compare comp;
+
+    template <typename A, typename B>
+    bool less(A const& a, B const& b) const;
+    template <typename A, typename B>
+    int probe(A const& key, B const& x) const;
+    template <typename A, typename B>
+    int probe(A const& key, B const& x, std::true_type) const;
+    template <typename A, typename B>
+    int probe(A const& key, B const& x, std::false_type) const;
+
+    template <typename... Args>
+    Node* create_node(Args&&... args);
+    void destroy_node(BaseNode* node);
+    size_t destroy_subtree(BaseNode* node);
 
     const_iterator detach(const_iterator iter);
+    iterator unlink(const_iterator iter);
     BaseNode* get_root_pointer() const;
+    void update_bounds();
+
+    // Перегрузки для прошитого дерева -- шаблоны, чтобы они инстанцировались
+    // только при вызове: у непрошитых узлов нет полей prev и next
+    static BaseNode* successor(BaseNode* node);
+    template <typename N>
+    static N* successor(N* node, std::true_type);
+    static BaseNode* successor(BaseNode* node, std::false_type);
+    static BaseNode* predecessor(BaseNode* node);
+    template <typename N>
+    static N* predecessor(N* node, std::true_type);
+    static BaseNode* predecessor(BaseNode* node, std::false_type);
+    template <typename N>
+    static void thread_insert(N* node, bool to_left, std::true_type);
+    static void thread_insert(BaseNode*, bool, std::false_type) {}
+    template <typename N>
+    static void thread_erase(N* first, N* last, std::true_type);
+    static void thread_erase(BaseNode*, BaseNode*, std::false_type) {}
+    template <typename H>
+    static void thread_nodes(H& header, std::true_type);
+    static void thread_nodes(Header&, std::false_type) {}
+    template <typename H>
+    static void close_threads(H& header, std::true_type);
+    static void close_threads(Header&, std::false_type) {}
+
+    static int height(BaseNode* node);
+    static void update_node(BaseNode* node);
+    template <typename N>
+    static size_t subtree_count(N* node);
+    template <typename N>
+    static void update_size(N* node, std::true_type);
+    static void update_size(BaseNode*, std::false_type) {}
+    template <typename N>
+    static void update_aggregate(N* node, std::true_type);
+    static void update_aggregate(BaseNode*, std::false_type) {}
+    static void update_summary(BaseNode* node);
+    template <typename N>
+    static void update_ancestors(N* node, std::true_type);
+    static void update_ancestors(BaseNode*, std::false_type) {}
+    template <typename A, typename K>
+    typename A::value_type aggregate_range(K const& lo, K const& hi) const;
+    template <typename N>
+    size_t index_of(N* node) const;
+    static void replace_child(BaseNode* parent, BaseNode* old_child, BaseNode* new_child);
+    static BaseNode* rotate_left(BaseNode* node);
+    static BaseNode* rotate_right(BaseNode* node);
+    static void rebalance(BaseNode* node);
+    static BaseNode* join_trees(BaseNode* left, BaseNode* mid, BaseNode* right);
+    static BaseNode* join_trees(BaseNode* left, BaseNode* right);
+    static void split_before(BaseNode* node, BaseNode* less_holder, BaseNode* rest_holder);
+    template <typename K>
+    BaseNode* split_tree(BaseNode* tree, K const& x, BaseNode*& less_part, BaseNode*& greater_part) const;
+    BaseNode* union_trees(BaseNode* a, BaseNode* b, BaseNode*& duplicates, size_t& duplicate_count,
+                          BaseNode*& spilled) const;
+    static void spill(BaseNode* tree, BaseNode*& spilled);
+    BaseNode* union_or_destroy(BaseNode* a, BaseNode* b, BaseNode*& duplicates, size_t& duplicate_count);
+    BaseNode* intersect_trees(BaseNode* a, BaseNode* b, size_t& removed);
+    BaseNode* subtract_trees(BaseNode* a, BaseNode* b, size_t& removed);
+    BaseNode* release_tree();
+    void attach_tree(BaseNode* tree, size_t count);
+    // Число узлов в less_part, если в обеих частях total узлов
+    template <typename N>
+    static size_t part_size(N* less_part, N* greater_part, size_t total, std::true_type);
+    static size_t part_size(BaseNode* less_part, BaseNode* greater_part, size_t total, std::false_type);
+    static BaseNode* subtree_first(BaseNode* top);
+    static BaseNode* subtree_next(BaseNode* node, BaseNode* top);
+    template <typename N>
+    static void thread_seam(N* left, N* right, std::true_type);
+    static void thread_seam(BaseNode*, BaseNode*, std::false_type) {}
+
+    BaseNode* find_position(value_type const& x, BaseNode*& parent, bool& to_left) const;
+    BaseNode* find_position(const_iterator hint, value_type const& x, BaseNode*& parent, bool& to_left) const;
+    template <typename K>
+    BaseNode* find_node(K const& x) const;
+    template <typename K>
+    BaseNode* lower_bound_node(K const& x) const;
+    template <typename K>
+    BaseNode* upper_bound_node(K const& x) const;
+    template <typename K>
+    std::pair<const_iterator, const_iterator> equal_range_nodes(K const& x) const;
+    iterator link_node(BaseNode* node, BaseNode* parent, bool to_left);
+
+    template <typename V>
+    void insert_after_max(BaseNode*& finger, V&& x);
+    template <typename InputIt>
+    void insert_range(InputIt first, InputIt last, std::input_iterator_tag);
+    template <typename ForwardIt>
+    void insert_range(ForwardIt first, ForwardIt last, std::forward_iterator_tag);
+
+    BaseNode* clone(BaseNode const* node, BaseNode* parent);
+    template <typename ForwardIt>
+    BaseNode* build(ForwardIt& first, size_t count, BaseNode* parent);
+
+    // Узлы выделяются из нескольких потоков, только если аллокатор это заведомо
+    // допускает: pool_allocator, например, не потокобезопасен
+    static const bool concurrent_allocation = std::is_same<Allocator, std::allocator<T>>::value;
+    template <typename F>
+    static void run_in_threads(unsigned count, F const& f);
+    template <typename RandomIt>
+    void build_parallel(RandomIt first, RandomIt last, unsigned threads);
+
+    // Кусок параллельного обхода: одиночный узел или поддерево целиком, с
+    // границами диапазона, которые ещё нужно проверять (nullptr -- не нужно)
+    struct ScanPiece
+    {
+        BaseNode* node;
+        bool whole;
+        value_type const* lo;
+        value_type const* hi;
+    };
+
+    static const int scan_grain_height = 11;
+    void collect_pieces(BaseNode* node, value_type const* lo, value_type const* hi, std::vector<ScanPiece>& pieces) const;
+    template <typename F>
+    void scan_subtree(BaseNode* node, value_type const* lo, value_type const* hi, F& f) const;
+    template <typename F>
+    void scan_piece(ScanPiece const& piece, F& f) const;
+    template <typename F>
+    static void run_pieces(work_stealing_pool::task_group& group, size_t first, size_t last, F const& f);
+    template <typename F>
+    void for_each_in(value_type const* lo, value_type const* hi, F f, work_stealing_pool& pool) const;
+    template <typename R, typename Reduce, typename Transform>
+    R transform_reduce_in(value_type const* lo, value_type const* hi, R init, Reduce reduce, Transform transform,
+                          work_stealing_pool& pool) const;
+
+    // Сколько спусков пакетного поиска идут одновременно
+    static const size_t batch_lanes = 16;
+    static void prefetch(void const* address);
+    template <typename ForwardIt, typename OutputIt>
+    OutputIt descend_batch(ForwardIt first, ForwardIt last, OutputIt out, bool exact) const;
 
 public:
 
     set();
+    explicit set(Compare const& comp, Allocator const& allocator = Allocator());
+    explicit set(Allocator const& allocator);
     set(set const& other) ;
+    set(set const& other, Allocator const& allocator);
+    set(set&& other) noexcept;
+    template <typename InputIt>
+    set(InputIt first, InputIt last, Compare const& comp = Compare(), Allocator const& allocator = Allocator());
+    template <typename ForwardIt>
+    set(sorted_unique_t, ForwardIt first, ForwardIt last,
+        Compare const& comp = Compare(), Allocator const& allocator = Allocator());
+    // Сортировка кусков, их слияние и построение поддеревьев идут в threads
+    // потоках (0 -- по числу ядер). Компаратор вызывается из нескольких потоков
+    template <typename RandomIt>
+    set(parallel_build_t, RandomIt first, RandomIt last, unsigned threads = 0,
+        Compare const& comp = Compare(), Allocator const& allocator = Allocator());
 
     ~set();
 
-    set& operator=(set other);
+    set& operator=(set const& other);
+    set& operator=(set&& other) noexcept(node_traits::propagate_on_container_move_assignment::value);
+
+    allocator_type get_allocator() const;
+    key_compare key_comp() const;
+    value_compare value_comp() const;
 
 
     std::pair<iterator, bool> insert(value_type const& x);
+    std::pair<iterator, bool> insert(value_type&& x);
+    template <typename InputIt>
+    void insert(InputIt first, InputIt last);
+    iterator insert(const_iterator hint, value_type const& x);
+    iterator insert(const_iterator hint, value_type&& x);
+    template <typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args);
+    template <typename... Args>
+    iterator emplace_hint(const_iterator hint, Args&&... args);
     iterator erase(const_iterator iter);
+    iterator erase(const_iterator first, const_iterator last);
+    size_t erase(value_type const& x);
+
+    // Перенос узлов между множествами без выделения памяти и копирования ключа.
+    // Аллокатор дескриптора должен совпадать с аллокатором множества, иначе
+    // ключ переносится в новый узел
+    node_type extract(const_iterator iter);
+    node_type extract(value_type const& x);
+    insert_return_type insert(node_type&& node);
+    iterator insert(const_iterator hint, node_type&& node);
+
+    // Перегрузки с шаблонным K доступны при прозрачном компараторе
+    // (Compare::is_transparent) и не конструируют временный value_type
     const_iterator find(value_type const& x) const;
+    template <typename K, typename C = Compare, typename = typename C::is_transparent>
+    const_iterator find(K const& x) const;
     const_iterator lower_bound(value_type const& x) const;
+    template <typename K, typename C = Compare, typename = typename C::is_transparent>
+    const_iterator lower_bound(K const& x) const;
     const_iterator upper_bound(value_type const& x) const;
+    template <typename K, typename C = Compare, typename = typename C::is_transparent>
+    const_iterator upper_bound(K const& x) const;
+    std::pair<const_iterator, const_iterator> equal_range(value_type const& x) const;
+    template <typename K, typename C = Compare, typename = typename C::is_transparent>
+    std::pair<const_iterator, const_iterator> equal_range(K const& x) const;
+    size_t count(value_type const& x) const;
+    template <typename K, typename C = Compare, typename = typename C::is_transparent>
+    size_t count(K const& x) const;
+    bool contains(value_type const& x) const;
+    template <typename K, typename C = Compare, typename = typename C::is_transparent>
+    bool contains(K const& x) const;
+    // Пакетные find и lower_bound: в out пишется по итератору на каждый ключ
+    // [first, last). Спуски для нескольких ключей чередуются, и узел, к которому
+    // спуск перейдёт, заранее запрашивается в кэш: промахи разных спусков
+    // перекрываются, а не ждутся по очереди
+    template <typename ForwardIt, typename OutputIt>
+    OutputIt find_batch(ForwardIt first, ForwardIt last, OutputIt out) const;
+    template <typename ForwardIt, typename OutputIt>
+    OutputIt lower_bound_batch(ForwardIt first, ForwardIt last, OutputIt out) const;
 
     bool empty() const;
     size_t size() const;
+    size_t height() const;
     void clear();
 
+    // Порядковые статистики, только при Ranked. rank -- число ключей меньше x,
+    // nth -- итератор на k-й по возрастанию ключ (с нуля) или end()
+    template <bool R = Ranked, typename = typename std::enable_if<R>::type>
+    size_t rank(value_type const& x) const;
+    template <bool R = Ranked, typename = typename std::enable_if<R>::type>
+    const_iterator nth(size_t k) const;
+    template <bool R = Ranked, typename = typename std::enable_if<R>::type>
+    size_t count_range(value_type const& lo, value_type const& hi) const;
+    template <bool R = Ranked, typename = typename std::enable_if<R>::type>
+    std::ptrdiff_t distance(const_iterator first, const_iterator last) const;
+
+    // Свёртка политики Augment по всем ключам и по ключам из [lo, hi), в порядке возрастания
+    template <typename A = Augment, typename = typename std::enable_if<!std::is_same<A, no_augment>::value>::type>
+    typename A::value_type aggregate() const;
+    template <typename A = Augment, typename = typename std::enable_if<!std::is_same<A, no_augment>::value>::type>
+    typename A::value_type aggregate(value_type const& lo, value_type const& hi) const;
+
+    // Минимум и максимум за O(1); на пустом множестве поведение не определено
+    value_type const& front() const;
+    value_type const& back() const;
+    void pop_front();
+    void pop_back();
+
     iterator begin() const;
     iterator end() const;
     const_iterator cbegin() const;
@@ -103,303 +549,779 @@ public:
     const_reverse_iterator crbegin() const;
     const_reverse_iterator crend() const;
 
-    void swap(set<T> &other);
+    void swap(set<T, Compare, Allocator, Threaded, Ranked, Augment> &other);
+
+    // Как std::set::merge: недостающие ключи переезжают из source вместе с узлами,
+    // совпадающие остаются в source. Если компаратор бросит исключение, оба
+    // множества остаются корректными, но могут потерять ключи: узлы, которые
+    // не удалось вернуть в деревья, освобождаются
+    void merge(set& source);
+    void merge(set&& source);
+
+    // *this становится объединением, пересечением или разностью с other.
+    // Узлы other переиспользуются, результат собирается разрезами и склейками
+    // деревьев за O(m log(n/m + 1)) сравнений, m <= n -- размеры множеств.
+    // other лучше передавать через std::move, иначе он сначала копируется.
+    // Исключение из компаратора в set_union оставляет *this пустым без утечек;
+    // в set_intersection и set_difference компаратор не должен бросать исключений
+    void set_union(set other);
+    void set_intersection(set other);
+    void set_difference(set other);
+
+    // Перевешивание узлов за O(log n): split оставляет в *this ключи меньше x и
+    // возвращает множество ключей не меньше x; join дописывает right в конец,
+    // все ключи right должны быть больше ключей *this. Без Ranked split ещё
+    // пересчитывает узлы меньшей из частей: O(log n + min(|<x|, |>=x|))
+    set split(value_type const& x);
+    void join(set right);
+
+    // Параллельный обход всех ключей или ключей из [lo, hi) в пуле с перехватом
+    // работы: дерево режется на поддеревья, которые разбирают потоки пула.
+    // f вызывается из разных потоков в неопределённом порядке, каждый поток
+    // работает со своей копией f. В transform_reduce reduce должна быть
+    // ассоциативной: частичные результаты сворачиваются в порядке возрастания
+    // ключей, и init -- самый левый операнд. Множество нельзя менять во время обхода
+    template <typename F>
+    void parallel_for_each(F f, work_stealing_pool& pool = work_stealing_pool::shared()) const;
+    template <typename F>
+    void parallel_for_each(value_type const& lo, value_type const& hi, F f,
+                           work_stealing_pool& pool = work_stealing_pool::shared()) const;
+    template <typename R, typename Reduce, typename Transform>
+    R parallel_transform_reduce(R init, Reduce reduce, Transform transform,
+                                work_stealing_pool& pool = work_stealing_pool::shared()) const;
+    template <typename R, typename Reduce, typename Transform>
+    R parallel_transform_reduce(value_type const& lo, value_type const& hi, R init, Reduce reduce, Transform transform,
+                                work_stealing_pool& pool = work_stealing_pool::shared()) const;
+
+private:
+    void swap_trees(set<T, Compare, Allocator, Threaded, Ranked, Augment> &other);
 };
 
 
+template <typename T, typename Compare = std::less<T>, typename Allocator = std::allocator<T>>
+using threaded_set = set<T, Compare, Allocator, true>;
+
+template <typename T, typename Compare = std::less<T>, typename Allocator = std::allocator<T>>
+using ranked_set = set<T, Compare, Allocator, false, true>;
+
+template <typename T, typename Augment, typename Compare = std::less<T>, typename Allocator = std::allocator<T>>
+using augmented_set = set<T, Compare, Allocator, false, false, Augment>;
+
+
 /// BASE NODE IMPLEMENTATION =================================================================
 
-template <typename T>
-set<T>::BaseNode::BaseNode()
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+set<T, Compare, Allocator, Threaded, Ranked, Augment>::BaseNode::BaseNode()
         : parent(nullptr),
           left_child(nullptr),
-          right_child(nullptr)
+          right_child(nullptr),
+          height(1)
 {}
 
-template <typename T>
-set<T>::BaseNode::BaseNode(BaseNode *parent, BaseNode *left, BaseNode *right)
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+set<T, Compare, Allocator, Threaded, Ranked, Augment>::BaseNode::BaseNode(BaseNode *parent, BaseNode *left, BaseNode *right)
         : parent(parent),
           left_child(left),
-          right_child(right)
+          right_child(right),
+          height(1)
 {}
 
-template <typename T>
-set<T>::BaseNode::BaseNode(BaseNode *parent)
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+set<T, Compare, Allocator, Threaded, Ranked, Augment>::BaseNode::BaseNode(BaseNode *parent)
         : parent(parent),
           left_child(nullptr),
-          right_child(nullptr)
+          right_child(nullptr),
+          height(1)
 {}
 
-template <typename T>
-set<T>::BaseNode::~BaseNode()
-{
-    if (left_child)
-        delete left_child;
-    if (right_child)
-        delete right_child;
-}
-
-template <typename T>
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
 template <typename U>
 template <typename V>
-bool set<T>::Iterator<U>::operator==(Iterator<V> const &other) const
+bool set<T, Compare, Allocator, Threaded, Ranked, Augment>::Iterator<U>::operator==(Iterator<V> const &other) const
 {
     return ptr == other.ptr;
 }
 
 
-template <typename T>
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
 template <typename U>
 template <typename V>
-bool set<T>::Iterator<U>::operator!=(Iterator<V> const &other) const
+bool set<T, Compare, Allocator, Threaded, Ranked, Augment>::Iterator<U>::operator!=(Iterator<V> const &other) const
 {
     return ptr != other.ptr;
 }
 
-/// NODE IMPLEMENTATION ======================================================================
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+set<T, Compare, Allocator, Threaded, Ranked, Augment>::Header::Header()
+        : BaseNode(),
+          leftmost(this),
+          rightmost(this)
+{
+    set::close_threads(*this, threaded_tag());
+}
 
-template <typename T>
-set<T>::Node::Node(set::value_type const& key)
-        : set::BaseNode(),
-          key(key)
-{}
+/// NODE HANDLE IMPLEMENTATION ===============================================================
 
-template <typename T>
-set<T>::Node::Node(set::value_type const& key, BaseNode* parent)
-        : set::BaseNode(parent),
-          key(key)
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+set<T, Compare, Allocator, Threaded, Ranked, Augment>::NodeHandle::NodeHandle() noexcept
+        : ptr(nullptr)
 {}
 
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+set<T, Compare, Allocator, Threaded, Ranked, Augment>::NodeHandle::NodeHandle(Node* ptr, node_allocator const& alloc)
+        : ptr(ptr)
+{
+    new (&alloc_storage) node_allocator(alloc);
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+set<T, Compare, Allocator, Threaded, Ranked, Augment>::NodeHandle::NodeHandle(NodeHandle&& other) noexcept
+        : ptr(nullptr)
+{
+    swap(other);
+}
 
-template <typename T>
-set<T>::Node::Node(set::value_type const& key, BaseNode* parent, BaseNode* left_child, BaseNode* right_child)
-        : set::BaseNode(parent, left_child, right_child),
-          key(key)
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::NodeHandle&
+set<T, Compare, Allocator, Threaded, Ranked, Augment>::NodeHandle::operator=(NodeHandle&& other) noexcept
+{
+    reset();
+    swap(other);
+    return *this;
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+set<T, Compare, Allocator, Threaded, Ranked, Augment>::NodeHandle::~NodeHandle()
+{
+    reset();
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::node_allocator&
+set<T, Compare, Allocator, Threaded, Ranked, Augment>::NodeHandle::alloc() const
+{
+    return *reinterpret_cast<node_allocator*>(const_cast<typename std::remove_const<decltype(alloc_storage)>::type*>(&alloc_storage));
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::Node* set<T, Compare, Allocator, Threaded, Ranked, Augment>::NodeHandle::release()
+{
+    // Узел уходит в дерево, дескриптор становится пустым
+    Node* node = ptr;
+    alloc().~node_allocator();
+    ptr = nullptr;
+    return node;
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+void set<T, Compare, Allocator, Threaded, Ranked, Augment>::NodeHandle::reset()
+{
+    if (!ptr)
+        return;
+    node_traits::destroy(alloc(), ptr);
+    node_traits::deallocate(alloc(), ptr, 1);
+    release();
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+bool set<T, Compare, Allocator, Threaded, Ranked, Augment>::NodeHandle::empty() const noexcept
+{
+    return !ptr;
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+set<T, Compare, Allocator, Threaded, Ranked, Augment>::NodeHandle::operator bool() const noexcept
+{
+    return ptr != nullptr;
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::NodeHandle::value_type&
+set<T, Compare, Allocator, Threaded, Ranked, Augment>::NodeHandle::value() const
+{
+    return ptr->key;
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::NodeHandle::allocator_type
+set<T, Compare, Allocator, Threaded, Ranked, Augment>::NodeHandle::get_allocator() const
+{
+    return allocator_type(alloc());
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+void set<T, Compare, Allocator, Threaded, Ranked, Augment>::NodeHandle::swap(NodeHandle& other) noexcept
+{
+    if (ptr && other.ptr)
+    {
+        using std::swap;
+        swap(alloc(), other.alloc());
+    }
+    else if (ptr)
+    {
+        new (&other.alloc_storage) node_allocator(std::move(alloc()));
+        alloc().~node_allocator();
+    }
+    else if (other.ptr)
+    {
+        new (&alloc_storage) node_allocator(std::move(other.alloc()));
+        other.alloc().~node_allocator();
+    }
+    std::swap(ptr, other.ptr);
+}
+
+/// NODE IMPLEMENTATION ======================================================================
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+template <typename... Args>
+set<T, Compare, Allocator, Threaded, Ranked, Augment>::Node::Node(Args&&... args)
+        : set::BaseNode(),
+          key(std::forward<Args>(args)...)
 {}
 
 /// ITERATORS IMPLEMENTATION =================================================================
 
-template <typename T>
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
 template <typename U>
-set<T>::Iterator<U>::Iterator(BaseNode *ptr) :
+set<T, Compare, Allocator, Threaded, Ranked, Augment>::Iterator<U>::Iterator(BaseNode *ptr) :
         ptr(ptr)
 {}
 
-template <typename T>
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
 template <typename U>
 template <typename V>
-set<T>::Iterator<U>::Iterator(Iterator<V> const &other)
+set<T, Compare, Allocator, Threaded, Ranked, Augment>::Iterator<U>::Iterator(Iterator<V> const &other)
         : ptr(other.ptr)
 {}
 
-template <typename T>
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
 template <typename U>
-U& set<T>::Iterator<U>::operator*() const
+U& set<T, Compare, Allocator, Threaded, Ranked, Augment>::Iterator<U>::operator*() const
 {
     return (static_cast<Node*>(ptr))->key;
 }
 
 
-template <typename T>
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
 template <typename U>
-set<T>::Iterator<U>& set<T>::Iterator<U>::operator++()
+set<T, Compare, Allocator, Threaded, Ranked, Augment>::Iterator<U>& set<T, Compare, Allocator, Threaded, Ranked, Augment>::Iterator<U>::operator++()
 {
-    if (ptr->right_child)
-    {
-        ptr = ptr->right_child;
-        while (ptr->left_child)
-            ptr = ptr->left_child;
-    }
-    else
-    {
-        while (ptr->parent->right_child == ptr)
-            ptr = ptr->parent;
-        ptr = ptr->parent;
-    }
+    ptr = set::successor(ptr);
     return *this;
 }
 
-template <typename T>
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
 template <typename U>
-set<T>::Iterator<U>& set<T>::Iterator<U>::operator--()
+set<T, Compare, Allocator, Threaded, Ranked, Augment>::Iterator<U>& set<T, Compare, Allocator, Threaded, Ranked, Augment>::Iterator<U>::operator--()
 {
-    if (ptr->left_child)
-    {
-        ptr = ptr->left_child;
-        while (ptr->right_child)
-            ptr = ptr->right_child;
-    }
-    else
-    {
-        while (ptr->parent->left_child == ptr)
-            ptr = ptr->parent;
-        ptr = ptr->parent;
-    }
+    ptr = set::predecessor(ptr);
     return *this;
 }
 
-template <typename T>
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
 template <typename U>
-set<T>::Iterator<U> set<T>::Iterator<U>::operator++(int)
+set<T, Compare, Allocator, Threaded, Ranked, Augment>::Iterator<U> set<T, Compare, Allocator, Threaded, Ranked, Augment>::Iterator<U>::operator++(int)
 {
     auto tmp(*this);
     ++(*this);
     return tmp;
 }
 
-template <typename T>
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
 template <typename U>
-set<T>::Iterator<U> set<T>::Iterator<U>::operator--(int)
+set<T, Compare, Allocator, Threaded, Ranked, Augment>::Iterator<U> set<T, Compare, Allocator, Threaded, Ranked, Augment>::Iterator<U>::operator--(int)
 {
     auto tmp(*this);
     --(*this);
     return tmp;
 }
 
-template<typename T>
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
 template<typename U>
-U *set<T>::Iterator<U>::operator->() const {
+U *set<T, Compare, Allocator, Threaded, Ranked, Augment>::Iterator<U>::operator->() const {
     return &(static_cast<Node*>(ptr)->key);
 }
 
-template<typename T>
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
 template<typename U>
-typename set<T>::template Iterator<U> &set<T>::Iterator<U>::operator=(const set<T>::Iterator<U> &other)
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::template Iterator<U> &set<T, Compare, Allocator, Threaded, Ranked, Augment>::Iterator<U>::operator=(const set<T, Compare, Allocator, Threaded, Ranked, Augment>::Iterator<U> &other)
 {
     ptr = other.ptr;
     return *this;
 }
 
-template<typename T>
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
 template<typename U>
-set<T>::Iterator<U>::Iterator() : ptr(nullptr)
+set<T, Compare, Allocator, Threaded, Ranked, Augment>::Iterator<U>::Iterator() : ptr(nullptr)
 {}
 
 
 /// SET IMPLEMENTATION =======================================================================
 
-template <typename T>
-set<T>::set()
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+const bool set<T, Compare, Allocator, Threaded, Ranked, Augment>::concurrent_allocation;
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+const int set<T, Compare, Allocator, Threaded, Ranked, Augment>::scan_grain_height;
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+const size_t set<T, Compare, Allocator, Threaded, Ranked, Augment>::batch_lanes;
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+set<T, Compare, Allocator, Threaded, Ranked, Augment>::set()
         : siz(0),
-          root()
+          root(),
+          alloc(),
+          comp()
 {}
 
-template <typename T>
-set<T>::set(set const &other)
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+set<T, Compare, Allocator, Threaded, Ranked, Augment>::set(Compare const& comp, Allocator const& allocator)
+        : siz(0),
+          root(),
+          alloc(allocator),
+          comp(comp)
+{}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+set<T, Compare, Allocator, Threaded, Ranked, Augment>::set(Allocator const& allocator)
+        : siz(0),
+          root(),
+          alloc(allocator),
+          comp()
+{}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+set<T, Compare, Allocator, Threaded, Ranked, Augment>::set(set const &other)
+        : siz(other.siz),
+          root(),
+          alloc(node_traits::select_on_container_copy_construction(other.alloc)),
+          comp(other.comp)
+{
+    root.left_child = clone(other.root.left_child, &root);
+    update_bounds();
+    thread_nodes(root, threaded_tag());
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+set<T, Compare, Allocator, Threaded, Ranked, Augment>::set(set const &other, Allocator const& allocator)
         : siz(other.siz),
-          root()
+          root(),
+          alloc(allocator),
+          comp(other.comp)
+{
+    root.left_child = clone(other.root.left_child, &root);
+    update_bounds();
+    thread_nodes(root, threaded_tag());
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+set<T, Compare, Allocator, Threaded, Ranked, Augment>::set(set&& other) noexcept
+        : siz(0),
+          root(),
+          alloc(std::move(other.alloc)),
+          comp(other.comp)
+{
+    swap_trees(other);
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+template <typename InputIt>
+set<T, Compare, Allocator, Threaded, Ranked, Augment>::set(InputIt first, InputIt last, Compare const& comp, Allocator const& allocator)
+        : siz(0),
+          root(),
+          alloc(allocator),
+          comp(comp)
 {
-    for (auto x : other)
+    try
+    {
+        insert(first, last);
+    }
+    catch (...)
     {
-        insert(x);
+        destroy_subtree(root.left_child);
+        throw;
     }
 }
 
-template <typename T>
-set<T>::~set()
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+template <typename ForwardIt>
+set<T, Compare, Allocator, Threaded, Ranked, Augment>::set(sorted_unique_t, ForwardIt first, ForwardIt last,
+                                Compare const& comp, Allocator const& allocator)
+        : siz(static_cast<size_t>(std::distance(first, last))),
+          root(),
+          alloc(allocator),
+          comp(comp)
+{
+    root.left_child = build(first, siz, &root);
+    update_bounds();
+    thread_nodes(root, threaded_tag());
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+template <typename RandomIt>
+set<T, Compare, Allocator, Threaded, Ranked, Augment>::set(parallel_build_t, RandomIt first, RandomIt last, unsigned threads,
+                                Compare const& comp, Allocator const& allocator)
+        : siz(0),
+          root(),
+          alloc(allocator),
+          comp(comp)
+{
+    build_parallel(first, last, threads);
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+set<T, Compare, Allocator, Threaded, Ranked, Augment>::~set()
 {
-    delete root.left_child;
+    destroy_subtree(root.left_child);
     root.left_child = nullptr;
 }
 
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+template <typename... Args>
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::Node* set<T, Compare, Allocator, Threaded, Ranked, Augment>::create_node(Args&&... args)
+{
+    Node* node = node_traits::allocate(alloc, 1);
+    try
+    {
+        node_traits::construct(alloc, node, std::forward<Args>(args)...);
+    }
+    catch (...)
+    {
+        node_traits::deallocate(alloc, node, 1);
+        throw;
+    }
+    return node;
+}
 
-template <typename T>
-typename set<T>::iterator set<T>::begin() const
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+void set<T, Compare, Allocator, Threaded, Ranked, Augment>::destroy_node(BaseNode* node)
 {
-    BaseNode * cur = get_root_pointer();
-    while (cur->left_child)
-        cur = cur->left_child;
-    return set<T>::iterator(cur);
+    Node* p = static_cast<Node*>(node);
+    node_traits::destroy(alloc, p);
+    node_traits::deallocate(alloc, p, 1);
 }
 
-template <typename T>
-typename set<T>::iterator set<T>::end() const
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+size_t set<T, Compare, Allocator, Threaded, Ranked, Augment>::destroy_subtree(BaseNode* node)
 {
-    return set<T>::iterator(get_root_pointer());
+    // Без рекурсии и дополнительной памяти: левого ребёнка поворотом
+    // поднимаем наверх, узел без левого ребёнка удаляем и идём вправо.
+    // Возвращает число удалённых узлов
+    size_t count = 0;
+    while (node)
+    {
+        if (node->left_child)
+        {
+            BaseNode* left = node->left_child;
+            node->left_child = left->right_child;
+            left->right_child = node;
+            node = left;
+        }
+        else
+        {
+            BaseNode* right = node->right_child;
+            destroy_node(node);
+            node = right;
+            count++;
+        }
+    }
+    return count;
 }
 
-template <typename T>
-typename set<T>::reverse_iterator set<T>::rbegin() const
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::iterator set<T, Compare, Allocator, Threaded, Ranked, Augment>::begin() const
 {
-    return set<T>::reverse_iterator(end());
+    return set<T, Compare, Allocator, Threaded, Ranked, Augment>::iterator(root.leftmost);
 }
 
-template <typename T>
-typename set<T>::const_reverse_iterator set<T>::crend() const
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::iterator set<T, Compare, Allocator, Threaded, Ranked, Augment>::end() const
 {
-    return set<T>::const_reverse_iterator(set<T>::iterator(begin()));
+    return set<T, Compare, Allocator, Threaded, Ranked, Augment>::iterator(get_root_pointer());
 }
 
-template <typename T>
-typename set<T>::const_reverse_iterator set<T>::crbegin() const
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::reverse_iterator set<T, Compare, Allocator, Threaded, Ranked, Augment>::rbegin() const
 {
-    return set<T>::const_reverse_iterator(end());
+    return set<T, Compare, Allocator, Threaded, Ranked, Augment>::reverse_iterator(end());
 }
 
-template <typename T>
-typename set<T>::reverse_iterator set<T>::rend() const
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::const_reverse_iterator set<T, Compare, Allocator, Threaded, Ranked, Augment>::crend() const
 {
-    return set<T>::reverse_iterator(set<T>::iterator(begin()));
+    return set<T, Compare, Allocator, Threaded, Ranked, Augment>::const_reverse_iterator(set<T, Compare, Allocator, Threaded, Ranked, Augment>::iterator(begin()));
 }
 
-template <typename T>
-bool set<T>::empty() const
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::const_reverse_iterator set<T, Compare, Allocator, Threaded, Ranked, Augment>::crbegin() const
 {
-    return siz == 0;
+    return set<T, Compare, Allocator, Threaded, Ranked, Augment>::const_reverse_iterator(end());
 }
 
-template <typename T>
-size_t set<T>::size() const
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::reverse_iterator set<T, Compare, Allocator, Threaded, Ranked, Augment>::rend() const
+{
+    return set<T, Compare, Allocator, Threaded, Ranked, Augment>::reverse_iterator(set<T, Compare, Allocator, Threaded, Ranked, Augment>::iterator(begin()));
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+bool set<T, Compare, Allocator, Threaded, Ranked, Augment>::empty() const
+{
+    return !root.left_child;
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+size_t set<T, Compare, Allocator, Threaded, Ranked, Augment>::size() const
 {
     return siz;
 }
 
-template <typename T>
-std::pair<typename set<T>::iterator, bool> set<T>::insert(value_type const &x)
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::BaseNode* set<T, Compare, Allocator, Threaded, Ranked, Augment>::find_position(value_type const& x, BaseNode*& parent, bool& to_left) const
 {
-    if (!root.left_child)
+    // Возвращает узел с ключом x, если он есть; иначе nullptr и место,
+    // куда x следует подвесить: parent и сторону to_left.
+    // candidate -- последний узел с ключом >= x, единственный кандидат на равенство
+    parent = get_root_pointer();
+    to_left = true;
+    BaseNode* candidate = nullptr;
+    BaseNode* cur = root.left_child;
+    while (cur)
     {
-        root.left_child = new Node(x, &root);
-        siz++;
-        return { iterator(root.left_child), true };
+        int r = probe(static_cast<Node*>(cur)->key, x);
+        if (r == 0)
+            return cur;
+        parent = cur;
+        to_left = r > 0;
+        if (to_left)
+        {
+            candidate = cur;
+            cur = cur->left_child;
+        }
+        else
+            cur = cur->right_child;
     }
+    if (!is_three_way_compare<Compare>::value && candidate && !less(x, static_cast<Node*>(candidate)->key))
+        return candidate;
+    return nullptr;
+}
 
-    set<T>::BaseNode* cur = root.left_child;
-    while (true)
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::BaseNode* set<T, Compare, Allocator, Threaded, Ranked, Augment>::find_position(const_iterator hint, value_type const& x, BaseNode*& parent, bool& to_left) const
+{
+    // Верная подсказка -- первый элемент больше x (или end()): тогда x встаёт
+    // между hint и его предшественником, и хватает одного-двух сравнений.
+    // Иначе ищем от корня
+    BaseNode* next = hint.ptr;
+    if (next == get_root_pointer() || less(x, static_cast<Node*>(next)->key))
     {
-        if (static_cast<Node*>(cur)->key == x)
-            return { iterator(cur), false };
-        if (static_cast<Node*>(cur)->key > x)
-        {
-            if (cur->left_child)
-                cur = cur->left_child;
-            else
-            {
-                cur->left_child = new Node(x, cur);
-                siz++;
-                return { iterator(cur->left_child), true };
-            }
-        }
-        if (static_cast<Node*>(cur)->key < x)
+        // Предшественник next; nullptr, если next -- первый узел
+        BaseNode* prev = next == root.leftmost ? nullptr : predecessor(next);
+
+        int r = prev ? probe(static_cast<Node*>(prev)->key, x) : -1;
+        if (r < 0)
         {
-            if (cur->right_child)
-                cur = cur->right_child;
-            else
-            {
-                cur->right_child = new Node(x, cur);
-                siz++;
-                return { iterator(cur->right_child), true };
-            }
+            to_left = !next->left_child;
+            parent = to_left ? next : prev;
+            return nullptr;
         }
+        if (r == 0 || (!is_three_way_compare<Compare>::value && !less(x, static_cast<Node*>(prev)->key)))
+            return prev;
     }
+    else if (!less(static_cast<Node*>(next)->key, x))
+        return next;
+    return find_position(x, parent, to_left);
 }
 
-template <typename T>
-typename set<T>::const_iterator set<T>::detach(const_iterator iter)
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::iterator set<T, Compare, Allocator, Threaded, Ranked, Augment>::link_node(BaseNode* node, BaseNode* parent, bool to_left)
 {
-    if (!iter.ptr->left_child && !iter.ptr->right_child)
-    {
-        if (iter.ptr->parent->left_child == iter.ptr)
+    node->parent = parent;
+    if (to_left)
+        parent->left_child = node;
+    else
+        parent->right_child = node;
+    update_node(node);
+    if (parent == get_root_pointer())
+        root.leftmost = root.rightmost = node;
+    else if (to_left && parent == root.leftmost)
+        root.leftmost = node;
+    else if (!to_left && parent == root.rightmost)
+        root.rightmost = node;
+    thread_insert(node, to_left, threaded_tag());
+    siz++;
+    rebalance(parent);
+    return iterator(node);
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+std::pair<typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::iterator, bool> set<T, Compare, Allocator, Threaded, Ranked, Augment>::insert(value_type const &x)
+{
+    BaseNode* parent;
+    bool to_left;
+    if (BaseNode* found = find_position(x, parent, to_left))
+        return { iterator(found), false };
+    return { link_node(create_node(x), parent, to_left), true };
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+std::pair<typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::iterator, bool> set<T, Compare, Allocator, Threaded, Ranked, Augment>::insert(value_type&& x)
+{
+    BaseNode* parent;
+    bool to_left;
+    if (BaseNode* found = find_position(x, parent, to_left))
+        return { iterator(found), false };
+    return { link_node(create_node(std::move(x)), parent, to_left), true };
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::iterator set<T, Compare, Allocator, Threaded, Ranked, Augment>::insert(const_iterator hint, value_type const& x)
+{
+    BaseNode* parent;
+    bool to_left;
+    if (BaseNode* found = find_position(hint, x, parent, to_left))
+        return iterator(found);
+    return link_node(create_node(x), parent, to_left);
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::iterator set<T, Compare, Allocator, Threaded, Ranked, Augment>::insert(const_iterator hint, value_type&& x)
+{
+    BaseNode* parent;
+    bool to_left;
+    if (BaseNode* found = find_position(hint, x, parent, to_left))
+        return iterator(found);
+    return link_node(create_node(std::move(x)), parent, to_left);
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+template <typename InputIt>
+void set<T, Compare, Allocator, Threaded, Ranked, Augment>::insert(InputIt first, InputIt last)
+{
+    insert_range(first, last, typename std::iterator_traits<InputIt>::iterator_category());
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+template <typename InputIt>
+void set<T, Compare, Allocator, Threaded, Ranked, Augment>::insert_range(InputIt first, InputIt last, std::input_iterator_tag)
+{
+    // finger -- самый правый узел: ключ больше максимума подвешивается к нему
+    // без спуска от корня, так что отсортированный вход стоит O(1) амортизированно
+    BaseNode* finger = root.rightmost;
+    for (; first != last; ++first)
+        insert_after_max(finger, *first);
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+template <typename ForwardIt>
+void set<T, Compare, Allocator, Threaded, Ranked, Augment>::insert_range(ForwardIt first, ForwardIt last, std::forward_iterator_tag)
+{
+    // В пустое множество строго возрастающий диапазон укладывается
+    // сразу идеально сбалансированным деревом за O(n)
+    if (empty())
+    {
+        size_t count = 0;
+        bool sorted = true;
+        ForwardIt prev = first;
+        for (ForwardIt it = first; it != last; ++it, ++count)
+        {
+            if (count > 0 && !less(*prev, *it))
+            {
+                sorted = false;
+                break;
+            }
+            prev = it;
+        }
+        if (sorted)
+        {
+            root.left_child = build(first, count, &root);
+            siz = count;
+            update_bounds();
+            thread_nodes(root, threaded_tag());
+            return;
+        }
+    }
+    insert_range(first, last, std::input_iterator_tag());
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+template <typename V>
+void set<T, Compare, Allocator, Threaded, Ranked, Augment>::insert_after_max(BaseNode*& finger, V&& x)
+{
+    if (finger == get_root_pointer())
+    {
+        finger = insert(std::forward<V>(x)).first.ptr;
+        return;
+    }
+    if (!less(static_cast<Node*>(finger)->key, x))
+    {
+        insert(std::forward<V>(x));
+        return;
+    }
+    BaseNode* node = create_node(std::forward<V>(x));
+    link_node(node, finger, false);
+    finger = node;
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+template <typename... Args>
+std::pair<typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::iterator, bool> set<T, Compare, Allocator, Threaded, Ranked, Augment>::emplace(Args&&... args)
+{
+    // Ключ конструируется сразу в узле; если он уже есть в дереве, узел удаляется
+    Node* node = create_node(std::forward<Args>(args)...);
+    BaseNode* parent;
+    bool to_left;
+    BaseNode* found;
+    try
+    {
+        found = find_position(node->key, parent, to_left);
+    }
+    catch (...)
+    {
+        destroy_node(node);
+        throw;
+    }
+    if (found)
+    {
+        destroy_node(node);
+        return { iterator(found), false };
+    }
+    return { link_node(node, parent, to_left), true };
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+template <typename... Args>
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::iterator set<T, Compare, Allocator, Threaded, Ranked, Augment>::emplace_hint(const_iterator hint, Args&&... args)
+{
+    Node* node = create_node(std::forward<Args>(args)...);
+    BaseNode* parent;
+    bool to_left;
+    BaseNode* found;
+    try
+    {
+        found = find_position(hint, node->key, parent, to_left);
+    }
+    catch (...)
+    {
+        destroy_node(node);
+        throw;
+    }
+    if (found)
+    {
+        destroy_node(node);
+        return iterator(found);
+    }
+    return link_node(node, parent, to_left);
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::const_iterator set<T, Compare, Allocator, Threaded, Ranked, Augment>::detach(const_iterator iter)
+{
+    if (!iter.ptr->left_child && !iter.ptr->right_child)
+    {
+        if (iter.ptr->parent->left_child == iter.ptr)
             iter.ptr->parent->left_child = nullptr;
         else
             iter.ptr->parent->right_child = nullptr;
@@ -423,16 +1345,33 @@ typename set<T>::const_iterator set<T>::detach(const_iterator iter)
     return iter;
 }
 
-template <typename T>
-typename set<T>::iterator set<T>::erase(set<T>::const_iterator iter)
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::iterator set<T, Compare, Allocator, Threaded, Ranked, Augment>::erase(set<T, Compare, Allocator, Threaded, Ranked, Augment>::const_iterator iter)
+{
+    iterator ret = unlink(iter);
+    destroy_node(iter.ptr);
+    return ret;
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::iterator set<T, Compare, Allocator, Threaded, Ranked, Augment>::unlink(const_iterator iter)
 {
+    // Вынимает узел из дерева, не удаляя его; возвращает следующий за ним
     iterator ret = iter;
     ++ret;
-
+    if (iter.ptr == root.rightmost)
+        root.rightmost = iter.ptr == root.leftmost ? get_root_pointer() : std::prev(iter).ptr;
+    if (iter.ptr == root.leftmost)
+        root.leftmost = ret.ptr;
+    thread_erase(iter.ptr, ret.ptr, threaded_tag());
+
+    // Узел, с которого начинается перебалансировка после удаления
+    BaseNode* fix;
     if (iter.ptr->left_child && iter.ptr->right_child)
     {
         auto next = iter;
         ++next;
+        fix = next.ptr->parent == iter.ptr ? next.ptr : next.ptr->parent;
         const_iterator cur = detach(next);
 
         if (iter.ptr->parent->left_child == iter.ptr)
@@ -448,58 +1387,386 @@ typename set<T>::iterator set<T>::erase(set<T>::const_iterator iter)
         cur.ptr->parent = iter.ptr->parent;
         cur.ptr->left_child = iter.ptr->left_child;
         cur.ptr->right_child = iter.ptr->right_child;
+        cur.ptr->height = iter.ptr->height;
     }
     else
     {
+        fix = iter.ptr->parent;
         detach(iter);
     }
     --siz;
     iter.ptr->right_child = nullptr;
     iter.ptr->left_child = nullptr;
-    delete iter.ptr;
+    rebalance(fix);
     return ret;
 }
 
-template <typename T>
-typename set<T>::const_iterator set<T>::find(value_type const &x) const
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::node_type set<T, Compare, Allocator, Threaded, Ranked, Augment>::extract(const_iterator iter)
 {
-    BaseNode* cur = root.left_child;
-    while (true)
+    unlink(iter);
+    return node_type(static_cast<Node*>(iter.ptr), alloc);
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::node_type set<T, Compare, Allocator, Threaded, Ranked, Augment>::extract(value_type const& x)
+{
+    BaseNode* node = find_node(x);
+    if (node == get_root_pointer())
+        return node_type();
+    return extract(const_iterator(node));
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::insert_return_type set<T, Compare, Allocator, Threaded, Ranked, Augment>::insert(node_type&& node)
+{
+    if (node.empty())
+        return { end(), false, node_type() };
+    if (!(alloc == node.alloc()))
     {
-        if (!cur)
-            return end();
+        // Ключ перемещается, только если его действительно вставили
+        std::pair<iterator, bool> result = insert(std::move(node.value()));
+        if (result.second)
+            node.reset();
+        return { result.first, result.second, std::move(node) };
+    }
 
-        if (static_cast<Node*>(cur)->key == x)
-            return set<T>::const_iterator(cur);
-        else if (static_cast<Node*>(cur)->key < x)
-            cur = cur->right_child;
-        else if (static_cast<Node*>(cur)->key > x)
+    BaseNode* parent;
+    bool to_left;
+    if (BaseNode* found = find_position(node.ptr->key, parent, to_left))
+        return { iterator(found), false, std::move(node) };
+    return { link_node(node.release(), parent, to_left), true, node_type() };
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::iterator set<T, Compare, Allocator, Threaded, Ranked, Augment>::insert(const_iterator hint, node_type&& node)
+{
+    if (node.empty())
+        return end();
+    if (!(alloc == node.alloc()))
+    {
+        // При неудаче дескриптор должен остаться у вызывающего, как и без подсказки
+        insert_return_type result = insert(std::move(node));
+        if (!result.inserted)
+            node = std::move(result.node);
+        return result.position;
+    }
+
+    BaseNode* parent;
+    bool to_left;
+    if (BaseNode* found = find_position(hint, node.ptr->key, parent, to_left))
+        return iterator(found);
+    return link_node(node.release(), parent, to_left);
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::iterator set<T, Compare, Allocator, Threaded, Ranked, Augment>::erase(const_iterator first, const_iterator last)
+{
+    // Диапазон вырезается двумя разрезами дерева целиком, оставшиеся части
+    // склеиваются обратно: O(log n) на перестройку плюс удаление узлов
+    if (first == last)
+        return iterator(last.ptr);
+
+    thread_erase(first.ptr, last.ptr, threaded_tag());
+    BaseNode before, middle, rest, after;
+    split_before(first.ptr, &before, &middle);
+    if (last.ptr != get_root_pointer())
+        split_before(last.ptr, &rest, &after);
+    else
+        rest.left_child = middle.left_child;
+
+    size_t removed = destroy_subtree(rest.left_child);
+    siz -= removed;
+    root.left_child = join_trees(before.left_child, after.left_child);
+    if (root.left_child)
+        root.left_child->parent = get_root_pointer();
+    update_bounds();
+    return iterator(last.ptr);
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+size_t set<T, Compare, Allocator, Threaded, Ranked, Augment>::erase(value_type const& x)
+{
+    BaseNode* node = find_node(x);
+    if (node == get_root_pointer())
+        return 0;
+    erase(const_iterator(node));
+    return 1;
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+template <typename K>
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::BaseNode* set<T, Compare, Allocator, Threaded, Ranked, Augment>::find_node(K const &x) const
+{
+    BaseNode* candidate = nullptr;
+    BaseNode* cur = root.left_child;
+    while (cur)
+    {
+        int r = probe(static_cast<Node*>(cur)->key, x);
+        if (r == 0)
+            return cur;
+        if (r > 0)
+        {
+            candidate = cur;
             cur = cur->left_child;
+        }
+        else
+            cur = cur->right_child;
     }
+    if (!is_three_way_compare<Compare>::value && candidate && !less(x, static_cast<Node*>(candidate)->key))
+        return candidate;
+    return get_root_pointer();
 }
 
-template <typename T>
-void set<T>::clear()
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+void set<T, Compare, Allocator, Threaded, Ranked, Augment>::clear()
+{
+    destroy_subtree(release_tree());
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::BaseNode* set<T, Compare, Allocator, Threaded, Ranked, Augment>::release_tree()
 {
+    // Отцепляет всё дерево, оставляя множество пустым; узлы переходят вызывающему
+    BaseNode* tree = root.left_child;
     siz = 0;
-    if (root.left_child)
-        delete root.left_child;
     root.left_child = nullptr;
+    root.leftmost = root.rightmost = get_root_pointer();
+    close_threads(root, threaded_tag());
+    return tree;
 }
 
-template <typename T>
-typename set<T>::const_iterator set<T>::lower_bound(value_type const &x) const
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+void set<T, Compare, Allocator, Threaded, Ranked, Augment>::attach_tree(BaseNode* tree, size_t count)
+{
+    // Подвешивает готовое дерево из count узлов к пустому множеству. Прошивка
+    // внутри дерева должна быть уже верной, замыкаются только её концы
+    root.left_child = tree;
+    if (tree)
+        tree->parent = get_root_pointer();
+    siz = count;
+    update_bounds();
+    close_threads(root, threaded_tag());
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+template <typename N>
+size_t set<T, Compare, Allocator, Threaded, Ranked, Augment>::part_size(N* less_part, N*, size_t, std::true_type)
+{
+    return subtree_count(less_part);
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+size_t set<T, Compare, Allocator, Threaded, Ranked, Augment>::part_size(BaseNode* less_part, BaseNode* greater_part,
+                                                                        size_t total, std::false_type)
+{
+    // Размеров поддеревьев нет: обе части обходятся поочерёдно, пока одна не
+    // кончится, -- O(меньшей части)
+    BaseNode* a = subtree_first(less_part);
+    BaseNode* b = subtree_first(greater_part);
+    size_t count = 0;
+    for (; a && b; count++)
+    {
+        a = subtree_next(a, less_part);
+        b = subtree_next(b, greater_part);
+    }
+    return a ? total - count : count;
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::BaseNode* set<T, Compare, Allocator, Threaded, Ranked, Augment>::subtree_first(BaseNode* top)
+{
+    if (top)
+        while (top->left_child)
+            top = top->left_child;
+    return top;
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::BaseNode* set<T, Compare, Allocator, Threaded, Ranked, Augment>::subtree_next(BaseNode* node, BaseNode* top)
+{
+    // Следующий узел в порядке обхода поддерева top, без выхода выше top
+    if (node->right_child)
+        return subtree_first(node->right_child);
+    while (node != top && node == node->parent->right_child)
+        node = node->parent;
+    return node == top ? nullptr : node->parent;
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::value_type const& set<T, Compare, Allocator, Threaded, Ranked, Augment>::front() const
 {
-    // Итератор первого >= x
+    return static_cast<Node*>(root.leftmost)->key;
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::value_type const& set<T, Compare, Allocator, Threaded, Ranked, Augment>::back() const
+{
+    return static_cast<Node*>(root.rightmost)->key;
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+void set<T, Compare, Allocator, Threaded, Ranked, Augment>::pop_front()
+{
+    erase(const_iterator(root.leftmost));
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+void set<T, Compare, Allocator, Threaded, Ranked, Augment>::pop_back()
+{
+    erase(const_iterator(root.rightmost));
+}
 
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+template <bool R, typename>
+size_t set<T, Compare, Allocator, Threaded, Ranked, Augment>::rank(value_type const& x) const
+{
+    // Спуск как в lower_bound: уходя вправо, пропускаем левое поддерево и сам узел
+    size_t result = 0;
     BaseNode* cur = root.left_child;
-    if (!cur)
+    while (cur)
+    {
+        if (less(static_cast<Node*>(cur)->key, x))
+        {
+            result += subtree_count(cur->left_child) + 1;
+            cur = cur->right_child;
+        }
+        else
+            cur = cur->left_child;
+    }
+    return result;
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+template <bool R, typename>
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::const_iterator set<T, Compare, Allocator, Threaded, Ranked, Augment>::nth(size_t k) const
+{
+    if (k >= size())
         return end();
+    BaseNode* cur = root.left_child;
+    while (true)
+    {
+        size_t left = subtree_count(cur->left_child);
+        if (k == left)
+            return const_iterator(cur);
+        if (k < left)
+            cur = cur->left_child;
+        else
+        {
+            k -= left + 1;
+            cur = cur->right_child;
+        }
+    }
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+template <bool R, typename>
+size_t set<T, Compare, Allocator, Threaded, Ranked, Augment>::count_range(value_type const& lo, value_type const& hi) const
+{
+    // Число ключей в [lo, hi)
+    if (!less(lo, hi))
+        return 0;
+    return rank(hi) - rank(lo);
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+template <bool R, typename>
+std::ptrdiff_t set<T, Compare, Allocator, Threaded, Ranked, Augment>::distance(const_iterator first, const_iterator last) const
+{
+    return static_cast<std::ptrdiff_t>(index_of(last.ptr)) - static_cast<std::ptrdiff_t>(index_of(first.ptr));
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+template <typename A, typename>
+typename A::value_type set<T, Compare, Allocator, Threaded, Ranked, Augment>::aggregate() const
+{
+    return root.left_child ? root.left_child->aggregate : A::identity();
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+template <typename A, typename>
+typename A::value_type set<T, Compare, Allocator, Threaded, Ranked, Augment>::aggregate(value_type const& lo, value_type const& hi) const
+{
+    return aggregate_range<A>(lo, hi);
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+template <typename A, typename K>
+typename A::value_type set<T, Compare, Allocator, Threaded, Ranked, Augment>::aggregate_range(K const& lo, K const& hi) const
+{
+    // Спускаемся до первого узла из [lo, hi), где пути к lo и к hi расходятся.
+    // Дальше по пути к lo слева от него собираются целые правые поддеревья,
+    // а по пути к hi справа -- целые левые: O(log n) узлов и сравнений
+    BaseNode* split = root.left_child;
+    while (split)
+    {
+        if (less(static_cast<Node*>(split)->key, lo))
+            split = split->right_child;
+        else if (!less(static_cast<Node*>(split)->key, hi))
+            split = split->left_child;
+        else
+            break;
+    }
+    if (!split)
+        return A::identity();
+
+    typename A::value_type left = A::identity();
+    for (BaseNode* cur = split->left_child; cur; )
+    {
+        if (less(static_cast<Node*>(cur)->key, lo))
+            cur = cur->right_child;
+        else
+        {
+            if (cur->right_child)
+                left = A::combine(cur->right_child->aggregate, left);
+            left = A::combine(A::make(static_cast<Node*>(cur)->key), left);
+            cur = cur->left_child;
+        }
+    }
+
+    typename A::value_type right = A::identity();
+    for (BaseNode* cur = split->right_child; cur; )
+    {
+        if (!less(static_cast<Node*>(cur)->key, hi))
+            cur = cur->left_child;
+        else
+        {
+            if (cur->left_child)
+                right = A::combine(right, cur->left_child->aggregate);
+            right = A::combine(right, A::make(static_cast<Node*>(cur)->key));
+            cur = cur->right_child;
+        }
+    }
+    return A::combine(left, A::combine(A::make(static_cast<Node*>(split)->key), right));
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+template <typename N>
+size_t set<T, Compare, Allocator, Threaded, Ranked, Augment>::index_of(N* node) const
+{
+    // Позиция узла в порядке обхода: подъём к корню, складывая всё, что левее
+    if (node == get_root_pointer())
+        return size();
+    size_t index = subtree_count(node->left_child);
+    for (; node->parent != get_root_pointer(); node = node->parent)
+    {
+        if (node->parent->right_child == node)
+            index += subtree_count(node->parent->left_child) + 1;
+    }
+    return index;
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+template <typename K>
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::BaseNode* set<T, Compare, Allocator, Threaded, Ranked, Augment>::lower_bound_node(K const &x) const
+{
+    // Узел первого >= x
 
+    BaseNode* cur = root.left_child;
     BaseNode* ans = get_root_pointer();
     while (cur)
     {
-        if (static_cast<Node*>(cur)->key < x)
+        if (less(static_cast<Node*>(cur)->key, x))
             cur = cur->right_child;
         else
         {
@@ -507,22 +1774,20 @@ typename set<T>::const_iterator set<T>::lower_bound(value_type const &x) const
             cur = cur->left_child;
         }
     }
-    return set<T>::const_iterator(ans);
+    return ans;
 }
 
-template <typename T>
-typename set<T>::const_iterator set<T>::upper_bound(T const &x) const
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+template <typename K>
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::BaseNode* set<T, Compare, Allocator, Threaded, Ranked, Augment>::upper_bound_node(K const &x) const
 {
-    // Итератор первого > x
+    // Узел первого > x
 
     BaseNode* cur = root.left_child;
-    if (!cur)
-        return end();
-
     BaseNode* ans = get_root_pointer();
     while (cur)
     {
-        if (static_cast<Node*>(cur)->key <= x)
+        if (!less(x, static_cast<Node*>(cur)->key))
             cur = cur->right_child;
         else
         {
@@ -530,47 +1795,1393 @@ typename set<T>::const_iterator set<T>::upper_bound(T const &x) const
             cur = cur->left_child;
         }
     }
-    return set<T>::const_iterator(ans);
+    return ans;
 }
 
-template<typename T>
-void set<T>::swap(set<T> &other)
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::const_iterator set<T, Compare, Allocator, Threaded, Ranked, Augment>::find(value_type const &x) const
 {
-    std::swap(siz, other.siz);
-    if (root.left_child && other.root.left_child)
-        std::swap(root.left_child->parent, other.root.left_child->parent);
-    else if (root.left_child)
-        root.left_child->parent = other.get_root_pointer();
-    else if (other.root.left_child)
-        other.root.left_child->parent = get_root_pointer();
-    std::swap(root.left_child, other.root.left_child);
+    return const_iterator(find_node(x));
 }
 
-template<typename T>
-typename set<T>::const_iterator set<T>::cbegin() const {
-    return set::const_iterator(begin());
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+template <typename K, typename C, typename>
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::const_iterator set<T, Compare, Allocator, Threaded, Ranked, Augment>::find(K const &x) const
+{
+    return const_iterator(find_node(x));
 }
 
-template<typename T>
-typename set<T>::const_iterator set<T>::cend() const {
-    return set::const_iterator(end());
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::const_iterator set<T, Compare, Allocator, Threaded, Ranked, Augment>::lower_bound(value_type const &x) const
+{
+    return const_iterator(lower_bound_node(x));
 }
 
-template<typename T>
-set<T>& set<T>::operator=(set<T> other) {
-    swap(other);
-    return *this;
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+template <typename K, typename C, typename>
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::const_iterator set<T, Compare, Allocator, Threaded, Ranked, Augment>::lower_bound(K const &x) const
+{
+    return const_iterator(lower_bound_node(x));
 }
 
-template<typename T>
-typename set<T>::BaseNode *set<T>::get_root_pointer() const {
-    return const_cast<set<T>::BaseNode*>(&root);
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::const_iterator set<T, Compare, Allocator, Threaded, Ranked, Augment>::upper_bound(value_type const &x) const
+{
+    return const_iterator(upper_bound_node(x));
 }
 
-template <typename T>
-void swap(set<T> &a, set<T> &b)
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+template <typename K, typename C, typename>
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::const_iterator set<T, Compare, Allocator, Threaded, Ranked, Augment>::upper_bound(K const &x) const
 {
-    a.swap(b);
+    return const_iterator(upper_bound_node(x));
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+size_t set<T, Compare, Allocator, Threaded, Ranked, Augment>::count(value_type const &x) const
+{
+    return find_node(x) != get_root_pointer() ? 1 : 0;
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+template <typename K, typename C, typename>
+size_t set<T, Compare, Allocator, Threaded, Ranked, Augment>::count(K const &x) const
+{
+    return find_node(x) != get_root_pointer() ? 1 : 0;
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+bool set<T, Compare, Allocator, Threaded, Ranked, Augment>::contains(value_type const &x) const
+{
+    return find_node(x) != get_root_pointer();
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+template <typename K, typename C, typename>
+bool set<T, Compare, Allocator, Threaded, Ranked, Augment>::contains(K const &x) const
+{
+    return find_node(x) != get_root_pointer();
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+void set<T, Compare, Allocator, Threaded, Ranked, Augment>::prefetch(void const* address)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(address);
+#else
+    (void) address;
+#endif
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+template <typename ForwardIt, typename OutputIt>
+OutputIt set<T, Compare, Allocator, Threaded, Ranked, Augment>::descend_batch(ForwardIt first, ForwardIt last, OutputIt out, bool exact) const
+{
+    // Ключи берутся группами по batch_lanes. Спуски группы делают по шагу по
+    // очереди: пока сравнивается ключ одного, узлы остальных уже загружаются.
+    // Ключ узла может лежать в другой кэш-линии, чем его ссылки, поэтому
+    // запрашиваются обе
+
+    value_type const* keys[batch_lanes];
+    BaseNode* cur[batch_lanes];
+    BaseNode* ans[batch_lanes];
+    while (first != last)
+    {
+        size_t lanes = 0;
+        for (; lanes < batch_lanes && first != last; ++lanes, ++first)
+        {
+            keys[lanes] = &*first;
+            cur[lanes] = root.left_child;
+            ans[lanes] = get_root_pointer();
+        }
+
+        for (bool active = true; active; )
+        {
+            active = false;
+            for (size_t i = 0; i < lanes; i++)
+            {
+                BaseNode* node = cur[i];
+                if (!node)
+                    continue;
+                if (less(static_cast<Node*>(node)->key, *keys[i]))
+                    node = node->right_child;
+                else
+                {
+                    ans[i] = node;
+                    node = node->left_child;
+                }
+                cur[i] = node;
+                if (node)
+                {
+                    prefetch(node);
+                    prefetch(&static_cast<Node*>(node)->key);
+                    active = true;
+                }
+            }
+        }
+
+        for (size_t i = 0; i < lanes; i++, ++out)
+        {
+            if (exact && ans[i] != get_root_pointer() && less(*keys[i], static_cast<Node*>(ans[i])->key))
+                ans[i] = get_root_pointer();
+            *out = const_iterator(ans[i]);
+        }
+    }
+    return out;
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+template <typename ForwardIt, typename OutputIt>
+OutputIt set<T, Compare, Allocator, Threaded, Ranked, Augment>::find_batch(ForwardIt first, ForwardIt last, OutputIt out) const
+{
+    return descend_batch(first, last, out, true);
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+template <typename ForwardIt, typename OutputIt>
+OutputIt set<T, Compare, Allocator, Threaded, Ranked, Augment>::lower_bound_batch(ForwardIt first, ForwardIt last, OutputIt out) const
+{
+    return descend_batch(first, last, out, false);
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+std::pair<typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::const_iterator, typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::const_iterator>
+set<T, Compare, Allocator, Threaded, Ranked, Augment>::equal_range(value_type const &x) const
+{
+    return equal_range_nodes(x);
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+template <typename K, typename C, typename>
+std::pair<typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::const_iterator, typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::const_iterator>
+set<T, Compare, Allocator, Threaded, Ranked, Augment>::equal_range(K const &x) const
+{
+    return equal_range_nodes(x);
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+template <typename K>
+std::pair<typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::const_iterator, typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::const_iterator>
+set<T, Compare, Allocator, Threaded, Ranked, Augment>::equal_range_nodes(K const &x) const
+{
+    // В множестве ключи уникальны: после lower_bound нужно не более одного сравнения
+    const_iterator first(lower_bound_node(x));
+    const_iterator last = first;
+    if (first != end() && !less(x, *first))
+        ++last;
+    return { first, last };
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+template <typename A, typename B>
+bool set<T, Compare, Allocator, Threaded, Ranked, Augment>::less(A const& a, B const& b) const
+{
+    return probe(a, b, is_three_way_compare<Compare>()) < 0;
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+template <typename A, typename B>
+int set<T, Compare, Allocator, Threaded, Ranked, Augment>::probe(A const& key, B const& x) const
+{
+    // Одно сравнение: < 0, если key < x; 0, если key == x (только для
+    // трёхстороннего компаратора); > 0 в остальных случаях
+    return probe(key, x, is_three_way_compare<Compare>());
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+template <typename A, typename B>
+int set<T, Compare, Allocator, Threaded, Ranked, Augment>::probe(A const& key, B const& x, std::true_type) const
+{
+    return comp(key, x);
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+template <typename A, typename B>
+int set<T, Compare, Allocator, Threaded, Ranked, Augment>::probe(A const& key, B const& x, std::false_type) const
+{
+    return comp(key, x) ? -1 : 1;
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+size_t set<T, Compare, Allocator, Threaded, Ranked, Augment>::height() const
+{
+    return static_cast<size_t>(height(root.left_child));
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+int set<T, Compare, Allocator, Threaded, Ranked, Augment>::height(BaseNode* node)
+{
+    return node ? node->height : 0;
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+void set<T, Compare, Allocator, Threaded, Ranked, Augment>::update_node(BaseNode* node)
+{
+    int l = height(node->left_child);
+    int r = height(node->right_child);
+    node->height = (l > r ? l : r) + 1;
+    update_summary(node);
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+void set<T, Compare, Allocator, Threaded, Ranked, Augment>::update_summary(BaseNode* node)
+{
+    update_size(node, ranked_tag());
+    update_aggregate(node, augmented_tag());
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+template <typename N>
+void set<T, Compare, Allocator, Threaded, Ranked, Augment>::update_aggregate(N* node, std::true_type)
+{
+    typename Augment::value_type value = Augment::make(static_cast<Node*>(node)->key);
+    if (node->left_child)
+        value = Augment::combine(node->left_child->aggregate, value);
+    if (node->right_child)
+        value = Augment::combine(value, node->right_child->aggregate);
+    node->aggregate = value;
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+template <typename N>
+size_t set<T, Compare, Allocator, Threaded, Ranked, Augment>::subtree_count(N* node)
+{
+    return node ? node->size : 0;
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+template <typename N>
+void set<T, Compare, Allocator, Threaded, Ranked, Augment>::update_size(N* node, std::true_type)
+{
+    node->size = subtree_count(node->left_child) + subtree_count(node->right_child) + 1;
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+template <typename N>
+void set<T, Compare, Allocator, Threaded, Ranked, Augment>::update_ancestors(N* node, std::true_type)
+{
+    // Размеры и агрегаты меняются до самого корня, даже когда высоты уже не меняются
+    for (N* cur = node->parent; cur && cur->parent; cur = cur->parent)
+        update_summary(cur);
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+void set<T, Compare, Allocator, Threaded, Ranked, Augment>::replace_child(BaseNode* parent, BaseNode* old_child, BaseNode* new_child)
+{
+    if (parent->left_child == old_child)
+        parent->left_child = new_child;
+    else
+        parent->right_child = new_child;
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::BaseNode* set<T, Compare, Allocator, Threaded, Ranked, Augment>::rotate_left(BaseNode* node)
+{
+    BaseNode* pivot = node->right_child;
+    node->right_child = pivot->left_child;
+    if (pivot->left_child)
+        pivot->left_child->parent = node;
+    pivot->parent = node->parent;
+    replace_child(node->parent, node, pivot);
+    pivot->left_child = node;
+    node->parent = pivot;
+    update_node(node);
+    update_node(pivot);
+    return pivot;
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::BaseNode* set<T, Compare, Allocator, Threaded, Ranked, Augment>::rotate_right(BaseNode* node)
+{
+    BaseNode* pivot = node->left_child;
+    node->left_child = pivot->right_child;
+    if (pivot->right_child)
+        pivot->right_child->parent = node;
+    pivot->parent = node->parent;
+    replace_child(node->parent, node, pivot);
+    pivot->right_child = node;
+    node->parent = pivot;
+    update_node(node);
+    update_node(pivot);
+    return pivot;
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+void set<T, Compare, Allocator, Threaded, Ranked, Augment>::rebalance(BaseNode* node)
+{
+    // AVL: поднимаемся от node к корню, восстанавливая высоты и баланс.
+    // Если высота поддерева не изменилась, предки уже корректны.
+    // Корень подвешен к фиктивному узлу без родителя, на нём подъём заканчивается
+    while (node->parent)
+    {
+        int old_height = node->height;
+        update_node(node);
+        int balance = height(node->left_child) - height(node->right_child);
+        if (balance > 1)
+        {
+            if (height(node->left_child->left_child) < height(node->left_child->right_child))
+                rotate_left(node->left_child);
+            node = rotate_right(node);
+        }
+        else if (balance < -1)
+        {
+            if (height(node->right_child->right_child) < height(node->right_child->left_child))
+                rotate_right(node->right_child);
+            node = rotate_left(node);
+        }
+        if (node->height == old_height)
+            break;
+        node = node->parent;
+    }
+    update_ancestors(node, summary_tag());
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::BaseNode* set<T, Compare, Allocator, Threaded, Ranked, Augment>::join_trees(BaseNode* left, BaseNode* mid, BaseNode* right)
+{
+    // Склеивает деревья left < mid < right. Более низкое дерево вместе с mid
+    // подвешивается на край более высокого там, где высоты отличаются не больше
+    // чем на 1, после чего баланс восстанавливается вверх: O(|h(left) - h(right)| + 1).
+    // Возвращает корень; его parent нужно выставить вызывающему
+    int hl = height(left);
+    int hr = height(right);
+    if (hl > hr + 1)
+    {
+        BaseNode holder;
+        holder.left_child = left;
+        left->parent = &holder;
+        BaseNode* parent = left;
+        while (height(parent->right_child) > hr + 1)
+            parent = parent->right_child;
+        mid->left_child = parent->right_child;
+        mid->right_child = right;
+        parent->right_child = mid;
+        mid->parent = parent;
+        if (mid->left_child)
+            mid->left_child->parent = mid;
+        if (right)
+            right->parent = mid;
+        update_node(mid);
+        rebalance(parent);
+        return holder.left_child;
+    }
+    if (hr > hl + 1)
+    {
+        BaseNode holder;
+        holder.left_child = right;
+        right->parent = &holder;
+        BaseNode* parent = right;
+        while (height(parent->left_child) > hl + 1)
+            parent = parent->left_child;
+        mid->right_child = parent->left_child;
+        mid->left_child = left;
+        parent->left_child = mid;
+        mid->parent = parent;
+        if (mid->right_child)
+            mid->right_child->parent = mid;
+        if (left)
+            left->parent = mid;
+        update_node(mid);
+        rebalance(parent);
+        return holder.left_child;
+    }
+    mid->left_child = left;
+    mid->right_child = right;
+    if (left)
+        left->parent = mid;
+    if (right)
+        right->parent = mid;
+    update_node(mid);
+    return mid;
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::BaseNode* set<T, Compare, Allocator, Threaded, Ranked, Augment>::join_trees(BaseNode* left, BaseNode* right)
+{
+    // Склейка без среднего узла: его роль играет минимум right
+    if (!left)
+        return right;
+    if (!right)
+        return left;
+
+    BaseNode holder;
+    holder.left_child = right;
+    right->parent = &holder;
+    BaseNode* mid = right;
+    while (mid->left_child)
+        mid = mid->left_child;
+    BaseNode* parent = mid->parent;
+    replace_child(parent, mid, mid->right_child);
+    if (mid->right_child)
+        mid->right_child->parent = parent;
+    rebalance(parent);
+    return join_trees(left, mid, holder.left_child);
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+void set<T, Compare, Allocator, Threaded, Ranked, Augment>::split_before(BaseNode* node, BaseNode* less_holder, BaseNode* rest_holder)
+{
+    // Разрезает дерево, в котором лежит node, на узлы до node и на node со всеми
+    // следующими. Поднимаемся от node к корню и приклеиваем каждого предка вместе
+    // с его другим поддеревом к нужной части; суммарно O(log n).
+    // Результаты подвешиваются слева к less_holder и rest_holder
+    BaseNode* parent = node->parent;
+    BaseNode* less_part = node->left_child;
+    BaseNode* rest_part = join_trees(nullptr, node, node->right_child);
+    BaseNode* cur = node;
+    while (parent->parent)
+    {
+        BaseNode* next = parent->parent;
+        if (parent->left_child == cur)
+            rest_part = join_trees(rest_part, parent, parent->right_child);
+        else
+            less_part = join_trees(parent->left_child, parent, less_part);
+        cur = parent;
+        parent = next;
+    }
+
+    less_holder->left_child = less_part;
+    if (less_part)
+        less_part->parent = less_holder;
+    rest_holder->left_child = rest_part;
+    if (rest_part)
+        rest_part->parent = rest_holder;
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+template <typename K>
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::BaseNode*
+set<T, Compare, Allocator, Threaded, Ranked, Augment>::split_tree(BaseNode* tree, K const& x, BaseNode*& less_part, BaseNode*& greater_part) const
+{
+    // Разрезает отцепленное дерево по ключу на less_part < x < greater_part.
+    // Узел с ключом x, если он есть, возвращается отдельно; его дети не сброшены
+    if (!tree)
+    {
+        less_part = greater_part = nullptr;
+        return nullptr;
+    }
+
+    BaseNode* left = tree->left_child;
+    BaseNode* right = tree->right_child;
+    BaseNode* found;
+    int r = probe(static_cast<Node*>(tree)->key, x);
+    if (r < 0)
+    {
+        BaseNode* right_less;
+        found = split_tree(right, x, right_less, greater_part);
+        less_part = join_trees(left, tree, right_less);
+    }
+    else if (r > 0 && (is_three_way_compare<Compare>::value || less(x, static_cast<Node*>(tree)->key)))
+    {
+        BaseNode* left_greater;
+        found = split_tree(left, x, less_part, left_greater);
+        greater_part = join_trees(left_greater, tree, right);
+    }
+    else
+    {
+        less_part = left;
+        greater_part = right;
+        found = tree;
+    }
+    return found;
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::BaseNode*
+set<T, Compare, Allocator, Threaded, Ranked, Augment>::union_trees(BaseNode* a, BaseNode* b, BaseNode*& duplicates, size_t& duplicate_count,
+                                                                  BaseNode*& spilled) const
+{
+    // Корень a разрезает b, половины объединяются рекурсивно и склеиваются через
+    // корень a. Узлы b с ключами, которые уже есть в a, собираются в список
+    // duplicates через right_child. Сравнения есть только в split_tree, а он при
+    // исключении оставляет дерево нетронутым; все куски, которыми владеет
+    // уровень рекурсии, тогда сбрасываются в spilled
+    if (!a)
+        return b;
+    if (!b)
+        return a;
+
+    BaseNode* a_left = a->left_child;
+    BaseNode* a_right = a->right_child;
+    BaseNode *b_left, *b_right;
+    BaseNode* duplicate;
+    try
+    {
+        duplicate = split_tree(b, static_cast<Node*>(a)->key, b_left, b_right);
+    }
+    catch (...)
+    {
+        spill(a, spilled);
+        spill(b, spilled);
+        throw;
+    }
+    if (duplicate)
+    {
+        duplicate->left_child = nullptr;
+        duplicate->right_child = duplicates;
+        duplicates = duplicate;
+        duplicate_count++;
+    }
+
+    BaseNode* left = nullptr;
+    bool left_done = false;
+    try
+    {
+        left = union_trees(a_left, b_left, duplicates, duplicate_count, spilled);
+        left_done = true;
+        BaseNode* right = union_trees(a_right, b_right, duplicates, duplicate_count, spilled);
+        return join_trees(left, a, right);
+    }
+    catch (...)
+    {
+        // Упавший вызов уже сбросил свои входы; если упал левый, правые куски ещё наши
+        if (!left_done)
+        {
+            spill(a_right, spilled);
+            spill(b_right, spilled);
+        }
+        spill(left, spilled);
+        a->left_child = a->right_child = nullptr;
+        spill(a, spilled);
+        throw;
+    }
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+void set<T, Compare, Allocator, Threaded, Ranked, Augment>::spill(BaseNode* tree, BaseNode*& spilled)
+{
+    // Корни сброшенных деревьев связаны через parent
+    if (tree)
+    {
+        tree->parent = spilled;
+        spilled = tree;
+    }
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::BaseNode*
+set<T, Compare, Allocator, Threaded, Ranked, Augment>::union_or_destroy(BaseNode* a, BaseNode* b, BaseNode*& duplicates, size_t& duplicate_count)
+{
+    // Порядок между сброшенными кусками неизвестен, а новые сравнения тоже могут
+    // бросить, поэтому при исключении все узлы освобождаются
+    BaseNode* spilled = nullptr;
+    try
+    {
+        return union_trees(a, b, duplicates, duplicate_count, spilled);
+    }
+    catch (...)
+    {
+        while (spilled)
+        {
+            BaseNode* next = spilled->parent;
+            destroy_subtree(spilled);
+            spilled = next;
+        }
+        destroy_subtree(duplicates);
+        duplicates = nullptr;
+        throw;
+    }
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::BaseNode*
+set<T, Compare, Allocator, Threaded, Ranked, Augment>::intersect_trees(BaseNode* a, BaseNode* b, size_t& removed)
+{
+    // Остаются узлы a, ключи которых есть в b; все узлы b и прочие узлы a удаляются
+    if (!a)
+    {
+        destroy_subtree(b);
+        return nullptr;
+    }
+    if (!b)
+    {
+        removed += destroy_subtree(a);
+        return nullptr;
+    }
+
+    BaseNode* a_left = a->left_child;
+    BaseNode* a_right = a->right_child;
+    BaseNode *b_left, *b_right;
+    BaseNode* match = split_tree(b, static_cast<Node*>(a)->key, b_left, b_right);
+    BaseNode* left = intersect_trees(a_left, b_left, removed);
+    BaseNode* right = intersect_trees(a_right, b_right, removed);
+    if (match)
+    {
+        destroy_node(match);
+        return join_trees(left, a, right);
+    }
+    destroy_node(a);
+    removed++;
+    return join_trees(left, right);
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::BaseNode*
+set<T, Compare, Allocator, Threaded, Ranked, Augment>::subtract_trees(BaseNode* a, BaseNode* b, size_t& removed)
+{
+    // Корень b разрезает a, узел a с тем же ключом удаляется; все узлы b удаляются
+    if (!a)
+    {
+        destroy_subtree(b);
+        return nullptr;
+    }
+    if (!b)
+        return a;
+
+    BaseNode* b_left = b->left_child;
+    BaseNode* b_right = b->right_child;
+    BaseNode *a_left, *a_right;
+    BaseNode* match = split_tree(a, static_cast<Node*>(b)->key, a_left, a_right);
+    destroy_node(b);
+    if (match)
+    {
+        destroy_node(match);
+        removed++;
+    }
+    BaseNode* left = subtract_trees(a_left, b_left, removed);
+    BaseNode* right = subtract_trees(a_right, b_right, removed);
+    return join_trees(left, right);
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::BaseNode* set<T, Compare, Allocator, Threaded, Ranked, Augment>::clone(BaseNode const* node, BaseNode* parent)
+{
+    // Копирует поддерево целиком, повторяя его форму: O(n), без сравнений
+    if (!node)
+        return nullptr;
+
+    BaseNode* copy = create_node(static_cast<Node const*>(node)->key);
+    copy->parent = parent;
+    try
+    {
+        copy->left_child = clone(node->left_child, copy);
+        copy->right_child = clone(node->right_child, copy);
+    }
+    catch (...)
+    {
+        destroy_subtree(copy);
+        throw;
+    }
+    update_node(copy);
+    return copy;
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+template <typename ForwardIt>
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::BaseNode* set<T, Compare, Allocator, Threaded, Ranked, Augment>::build(ForwardIt& first, size_t count, BaseNode* parent)
+{
+    // Строит идеально сбалансированное дерево из count отсортированных ключей,
+    // начиная с first; first сдвигается за последний использованный ключ
+    if (count == 0)
+        return nullptr;
+
+    size_t left_count = count / 2;
+    BaseNode* left = build(first, left_count, nullptr);
+    BaseNode* node;
+    try
+    {
+        node = create_node(*first);
+    }
+    catch (...)
+    {
+        destroy_subtree(left);
+        throw;
+    }
+    node->parent = parent;
+    node->left_child = left;
+    if (left)
+        left->parent = node;
+    ++first;
+    try
+    {
+        node->right_child = build(first, count - left_count - 1, node);
+    }
+    catch (...)
+    {
+        destroy_subtree(node);
+        throw;
+    }
+    update_node(node);
+    return node;
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+template <typename F>
+void set<T, Compare, Allocator, Threaded, Ranked, Augment>::run_in_threads(unsigned count, F const& f)
+{
+    // f(0) выполняется в текущем потоке, f(1) ... f(count - 1) -- в новых.
+    // Первое исключение пробрасывается, когда завершатся все
+    std::vector<std::exception_ptr> errors(count);
+    std::vector<std::thread> workers;
+    workers.reserve(count - 1);
+    auto task = [&f, &errors](unsigned i) {
+        try
+        {
+            f(i);
+        }
+        catch (...)
+        {
+            errors[i] = std::current_exception();
+        }
+    };
+    try
+    {
+        for (unsigned i = 1; i < count; i++)
+            workers.emplace_back(task, i);
+    }
+    catch (...)
+    {
+        // Поток не создался: его часть делается здесь же
+        for (unsigned i = static_cast<unsigned>(workers.size()) + 1; i < count; i++)
+            task(i);
+    }
+    task(0);
+    for (auto& worker : workers)
+        worker.join();
+    for (auto& error : errors)
+        if (error)
+            std::rethrow_exception(error);
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+template <typename RandomIt>
+void set<T, Compare, Allocator, Threaded, Ranked, Augment>::build_parallel(RandomIt first, RandomIt last, unsigned threads)
+{
+    // 1. Каждый поток копирует свой кусок входа, сортирует его и убирает повторы.
+    // 2. По выборке из кусков выбираются threads - 1 разделителей; поток t сливает
+    //    из всех кусков ключи между t-1-м и t-м разделителями. Равные ключи
+    //    попадают в одну часть, поэтому повторы между кусками убираются там же.
+    // 3. Из каждой части строится идеально сбалансированное поддерево, и
+    //    поддеревья склеиваются по порядку за O(threads log n).
+    const size_t min_chunk = 1 << 14;
+    size_t n = static_cast<size_t>(last - first);
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = static_cast<unsigned>(std::max<size_t>(1, std::min<size_t>(threads, n / min_chunk)));
+    key_less<Compare> cmp{comp};
+
+    std::vector<std::vector<value_type>> runs(threads);
+    run_in_threads(threads, [&](unsigned t) {
+        std::vector<value_type>& run = runs[t];
+        run.assign(first + static_cast<std::ptrdiff_t>(n * t / threads),
+                   first + static_cast<std::ptrdiff_t>(n * (t + 1) / threads));
+        std::sort(run.begin(), run.end(), cmp);
+        run.erase(std::unique(run.begin(), run.end(), [&cmp](value_type const& a, value_type const& b) {
+            return !cmp(a, b);
+        }), run.end());
+    });
+
+    std::vector<value_type> samples;
+    for (auto& run : runs)
+        for (unsigned i = 1; i < threads && !run.empty(); i++)
+            samples.push_back(run[run.size() * i / threads]);
+    std::sort(samples.begin(), samples.end(), cmp);
+    // bounds[t][r] -- начало части t в куске r
+    std::vector<std::vector<size_t>> bounds(threads + 1, std::vector<size_t>(threads));
+    for (unsigned r = 0; r < threads; r++)
+    {
+        bounds[threads][r] = runs[r].size();
+        for (unsigned t = 1; t < threads; t++)
+            bounds[t][r] = samples.empty() ? runs[r].size() : static_cast<size_t>(
+                    std::lower_bound(runs[r].begin(), runs[r].end(), samples[samples.size() * t / threads], cmp)
+                    - runs[r].begin());
+    }
+
+    std::vector<std::vector<value_type>> parts(threads);
+    run_in_threads(threads, [&](unsigned t) {
+        // Куски сливаются попарно, за log(threads) проходов
+        std::vector<value_type>& part = parts[t];
+        std::vector<size_t> seams(1, 0);
+        for (unsigned r = 0; r < threads; r++)
+        {
+            part.insert(part.end(), std::make_move_iterator(runs[r].begin() + bounds[t][r]),
+                        std::make_move_iterator(runs[r].begin() + bounds[t + 1][r]));
+            seams.push_back(part.size());
+        }
+        for (size_t step = 1; step + 1 < seams.size(); step *= 2)
+            for (size_t i = 0; i + step + 1 < seams.size(); i += 2 * step)
+                std::inplace_merge(part.begin() + seams[i], part.begin() + seams[i + step],
+                                   part.begin() + seams[std::min(i + 2 * step, seams.size() - 1)], cmp);
+        part.erase(std::unique(part.begin(), part.end(), [&cmp](value_type const& a, value_type const& b) {
+            return !cmp(a, b);
+        }), part.end());
+    });
+    runs.clear();
+
+    std::vector<BaseNode*> trees(threads, nullptr);
+    auto build_part = [&](unsigned t) {
+        auto it = std::make_move_iterator(parts[t].begin());
+        trees[t] = build(it, parts[t].size(), nullptr);
+    };
+    try
+    {
+        if (concurrent_allocation)
+            run_in_threads(threads, build_part);
+        else
+            for (unsigned t = 0; t < threads; t++)
+                build_part(t);
+    }
+    catch (...)
+    {
+        for (BaseNode* tree : trees)
+            destroy_subtree(tree);
+        throw;
+    }
+
+    BaseNode* tree = nullptr;
+    size_t count = 0;
+    for (unsigned t = 0; t < threads; t++)
+    {
+        tree = join_trees(tree, trees[t]);
+        count += parts[t].size();
+    }
+    attach_tree(tree, count);
+    thread_nodes(root, threaded_tag());
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+void set<T, Compare, Allocator, Threaded, Ranked, Augment>::collect_pieces(BaseNode* node, value_type const* lo, value_type const* hi,
+                                                                std::vector<ScanPiece>& pieces) const
+{
+    // Невысокие поддеревья становятся кусками целиком, выше режем по узлам.
+    // Граница, которую поддерево уже заведомо не пересекает, сбрасывается
+    if (!node)
+        return;
+    if (node->height <= scan_grain_height)
+    {
+        pieces.push_back(ScanPiece{node, true, lo, hi});
+        return;
+    }
+    value_type const& key = static_cast<Node*>(node)->key;
+    if (lo && less(key, *lo))
+        return collect_pieces(node->right_child, lo, hi, pieces);
+    if (hi && !less(key, *hi))
+        return collect_pieces(node->left_child, lo, hi, pieces);
+    collect_pieces(node->left_child, lo, nullptr, pieces);
+    pieces.push_back(ScanPiece{node, false, nullptr, nullptr});
+    collect_pieces(node->right_child, nullptr, hi, pieces);
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+template <typename F>
+void set<T, Compare, Allocator, Threaded, Ranked, Augment>::scan_subtree(BaseNode* node, value_type const* lo, value_type const* hi, F& f) const
+{
+    while (node)
+    {
+        value_type const& key = static_cast<Node*>(node)->key;
+        if (lo && less(key, *lo))
+        {
+            node = node->right_child;
+            continue;
+        }
+        if (hi && !less(key, *hi))
+        {
+            node = node->left_child;
+            continue;
+        }
+        scan_subtree(node->left_child, lo, nullptr, f);
+        f(key);
+        node = node->right_child;
+        lo = nullptr;
+    }
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+template <typename F>
+void set<T, Compare, Allocator, Threaded, Ranked, Augment>::scan_piece(ScanPiece const& piece, F& f) const
+{
+    if (piece.whole)
+        scan_subtree(piece.node, piece.lo, piece.hi, f);
+    else
+        f(static_cast<Node*>(piece.node)->key);
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+template <typename F>
+void set<T, Compare, Allocator, Threaded, Ranked, Augment>::run_pieces(work_stealing_pool::task_group& group,
+                                                            size_t first, size_t last, F const& f)
+{
+    // Правая половина уходит в очередь, где её может перехватить свободный поток,
+    // левая делится дальше здесь же
+    while (last - first > 1)
+    {
+        size_t mid = first + (last - first) / 2;
+        group.spawn([&group, &f, mid, last]() { run_pieces(group, mid, last, f); });
+        last = mid;
+    }
+    if (first < last)
+        f(first);
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+template <typename F>
+void set<T, Compare, Allocator, Threaded, Ranked, Augment>::for_each_in(value_type const* lo, value_type const* hi, F f,
+                                                             work_stealing_pool& pool) const
+{
+    std::vector<ScanPiece> pieces;
+    collect_pieces(root.left_child, lo, hi, pieces);
+    // Задачи держат ссылку на run_piece, поэтому она объявлена до группы
+    auto run_piece = [this, &pieces, &f](size_t i) {
+        F local = f;
+        scan_piece(pieces[i], local);
+    };
+    work_stealing_pool::task_group group(pool);
+    run_pieces(group, 0, pieces.size(), run_piece);
+    group.wait();
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+template <typename R, typename Reduce, typename Transform>
+R set<T, Compare, Allocator, Threaded, Ranked, Augment>::transform_reduce_in(value_type const* lo, value_type const* hi, R init,
+                                                                  Reduce reduce, Transform transform,
+                                                                  work_stealing_pool& pool) const
+{
+    // У свёртки нет нейтрального элемента, поэтому пустой кусок -- нулевой указатель
+    std::vector<ScanPiece> pieces;
+    collect_pieces(root.left_child, lo, hi, pieces);
+    std::vector<std::unique_ptr<R>> partial(pieces.size());
+    auto run_piece = [&](size_t i) {
+        Reduce local_reduce = reduce;
+        Transform local_transform = transform;
+        std::unique_ptr<R>& acc = partial[i];
+        auto fold = [&](value_type const& key) {
+            if (acc)
+                *acc = local_reduce(std::move(*acc), local_transform(key));
+            else
+                acc.reset(new R(local_transform(key)));
+        };
+        scan_piece(pieces[i], fold);
+    };
+    work_stealing_pool::task_group group(pool);
+    run_pieces(group, 0, pieces.size(), run_piece);
+    group.wait();
+
+    for (auto& value : partial)
+        if (value)
+            init = reduce(std::move(init), std::move(*value));
+    return init;
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+template <typename F>
+void set<T, Compare, Allocator, Threaded, Ranked, Augment>::parallel_for_each(F f, work_stealing_pool& pool) const
+{
+    for_each_in(nullptr, nullptr, std::move(f), pool);
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+template <typename F>
+void set<T, Compare, Allocator, Threaded, Ranked, Augment>::parallel_for_each(value_type const& lo, value_type const& hi, F f,
+                                                                   work_stealing_pool& pool) const
+{
+    for_each_in(&lo, &hi, std::move(f), pool);
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+template <typename R, typename Reduce, typename Transform>
+R set<T, Compare, Allocator, Threaded, Ranked, Augment>::parallel_transform_reduce(R init, Reduce reduce, Transform transform,
+                                                                        work_stealing_pool& pool) const
+{
+    return transform_reduce_in(nullptr, nullptr, std::move(init), std::move(reduce), std::move(transform), pool);
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+template <typename R, typename Reduce, typename Transform>
+R set<T, Compare, Allocator, Threaded, Ranked, Augment>::parallel_transform_reduce(value_type const& lo, value_type const& hi, R init,
+                                                                        Reduce reduce, Transform transform,
+                                                                        work_stealing_pool& pool) const
+{
+    return transform_reduce_in(&lo, &hi, std::move(init), std::move(reduce), std::move(transform), pool);
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+void set<T, Compare, Allocator, Threaded, Ranked, Augment>::swap(set<T, Compare, Allocator, Threaded, Ranked, Augment> &other)
+{
+    swap_trees(other);
+    std::swap(comp, other.comp);
+    if (node_traits::propagate_on_container_swap::value)
+        std::swap(alloc, other.alloc);
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+void set<T, Compare, Allocator, Threaded, Ranked, Augment>::merge(set& source)
+{
+    if (this == &source)
+        return;
+    if (!(alloc == source.alloc))
+    {
+        // Чужие узлы нельзя освободить нашим аллокатором: переносим ключи по одному
+        for (const_iterator it = source.begin(); it != source.end(); )
+        {
+            const_iterator next = std::next(it);
+            if (insert(*it).second)
+                source.erase(it);
+            it = next;
+        }
+        return;
+    }
+
+    size_t count = size() + source.size();
+    BaseNode* duplicates = nullptr;
+    size_t duplicate_count = 0;
+    BaseNode* tree = union_or_destroy(release_tree(), source.release_tree(), duplicates, duplicate_count);
+    attach_tree(tree, count - duplicate_count);
+    thread_nodes(root, threaded_tag());
+
+    // Узел снимается со списка, только когда его место в source уже найдено
+    while (duplicates)
+    {
+        BaseNode* node = duplicates;
+        BaseNode* parent;
+        bool to_left;
+        try
+        {
+            source.find_position(static_cast<Node*>(node)->key, parent, to_left);
+        }
+        catch (...)
+        {
+            destroy_subtree(duplicates);
+            throw;
+        }
+        duplicates = node->right_child;
+        node->right_child = nullptr;
+        source.link_node(node, parent, to_left);
+    }
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+void set<T, Compare, Allocator, Threaded, Ranked, Augment>::merge(set&& source)
+{
+    merge(source);
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+void set<T, Compare, Allocator, Threaded, Ranked, Augment>::set_union(set other)
+{
+    if (!(alloc == other.alloc))
+    {
+        set_union(set(other, get_allocator()));
+        return;
+    }
+
+    size_t count = size() + other.size();
+    BaseNode* duplicates = nullptr;
+    size_t duplicate_count = 0;
+    BaseNode* tree = union_or_destroy(release_tree(), other.release_tree(), duplicates, duplicate_count);
+    attach_tree(tree, count - duplicate_count);
+    thread_nodes(root, threaded_tag());
+    while (duplicates)
+    {
+        BaseNode* node = duplicates;
+        duplicates = node->right_child;
+        destroy_node(node);
+    }
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+void set<T, Compare, Allocator, Threaded, Ranked, Augment>::set_intersection(set other)
+{
+    if (!(alloc == other.alloc))
+    {
+        set_intersection(set(other, get_allocator()));
+        return;
+    }
+
+    size_t count = size();
+    size_t removed = 0;
+    BaseNode* tree = intersect_trees(release_tree(), other.release_tree(), removed);
+    attach_tree(tree, count - removed);
+    thread_nodes(root, threaded_tag());
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+void set<T, Compare, Allocator, Threaded, Ranked, Augment>::set_difference(set other)
+{
+    if (!(alloc == other.alloc))
+    {
+        set_difference(set(other, get_allocator()));
+        return;
+    }
+
+    size_t count = size();
+    size_t removed = 0;
+    BaseNode* tree = subtract_trees(release_tree(), other.release_tree(), removed);
+    attach_tree(tree, count - removed);
+    thread_nodes(root, threaded_tag());
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+set<T, Compare, Allocator, Threaded, Ranked, Augment> set<T, Compare, Allocator, Threaded, Ranked, Augment>::split(value_type const& x)
+{
+    set result(comp, get_allocator());
+    size_t count = siz;
+    BaseNode *less_part, *greater_part;
+    if (BaseNode* found = split_tree(release_tree(), x, less_part, greater_part))
+        greater_part = join_trees(nullptr, found, greater_part);
+
+    // Прошивка внутри каждой части уже верна: обе части -- отрезки прежнего порядка
+    size_t less_count = part_size(less_part, greater_part, count, ranked_tag());
+    attach_tree(less_part, less_count);
+    result.attach_tree(greater_part, count - less_count);
+    return result;
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+void set<T, Compare, Allocator, Threaded, Ranked, Augment>::join(set right)
+{
+    if (!(alloc == right.alloc))
+    {
+        join(set(right, get_allocator()));
+        return;
+    }
+    if (right.empty())
+        return;
+    if (empty())
+    {
+        swap_trees(right);
+        return;
+    }
+
+    size_t count = siz + right.siz;
+    thread_seam(root.rightmost, right.root.leftmost, threaded_tag());
+    BaseNode* tree = join_trees(release_tree(), right.release_tree());
+    attach_tree(tree, count);
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+template <typename N>
+void set<T, Compare, Allocator, Threaded, Ranked, Augment>::thread_seam(N* left, N* right, std::true_type)
+{
+    left->next = right;
+    right->prev = left;
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+void set<T, Compare, Allocator, Threaded, Ranked, Augment>::swap_trees(set<T, Compare, Allocator, Threaded, Ranked, Augment> &other)
+{
+    std::swap(siz, other.siz);
+    if (root.left_child && other.root.left_child)
+        std::swap(root.left_child->parent, other.root.left_child->parent);
+    else if (root.left_child)
+        root.left_child->parent = other.get_root_pointer();
+    else if (other.root.left_child)
+        other.root.left_child->parent = get_root_pointer();
+    std::swap(root.left_child, other.root.left_child);
+    std::swap(root.leftmost, other.root.leftmost);
+    std::swap(root.rightmost, other.root.rightmost);
+    if (empty())
+        root.leftmost = root.rightmost = get_root_pointer();
+    if (other.empty())
+        other.root.leftmost = other.root.rightmost = other.get_root_pointer();
+    close_threads(root, threaded_tag());
+    close_threads(other.root, threaded_tag());
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::const_iterator set<T, Compare, Allocator, Threaded, Ranked, Augment>::cbegin() const {
+    return set::const_iterator(begin());
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::const_iterator set<T, Compare, Allocator, Threaded, Ranked, Augment>::cend() const {
+    return set::const_iterator(end());
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+set<T, Compare, Allocator, Threaded, Ranked, Augment>& set<T, Compare, Allocator, Threaded, Ranked, Augment>::operator=(set<T, Compare, Allocator, Threaded, Ranked, Augment> const& other) {
+    if (this != &other)
+    {
+        bool propagate = node_traits::propagate_on_container_copy_assignment::value;
+        set<T, Compare, Allocator, Threaded, Ranked, Augment> tmp(other, propagate ? other.get_allocator() : get_allocator());
+        // tmp забирает старое дерево вместе с аллокатором, которым оно было выделено
+        swap_trees(tmp);
+        std::swap(alloc, tmp.alloc);
+        std::swap(comp, tmp.comp);
+    }
+    return *this;
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+set<T, Compare, Allocator, Threaded, Ranked, Augment>& set<T, Compare, Allocator, Threaded, Ranked, Augment>::operator=(set<T, Compare, Allocator, Threaded, Ranked, Augment>&& other)
+        noexcept(node_traits::propagate_on_container_move_assignment::value) {
+    if (this == &other)
+        return *this;
+
+    if (node_traits::propagate_on_container_move_assignment::value || alloc == other.alloc)
+    {
+        clear();
+        swap_trees(other);
+        alloc = other.alloc;
+    }
+    else
+    {
+        // Узлы other нельзя освободить нашим аллокатором: копируем поэлементно
+        set<T, Compare, Allocator, Threaded, Ranked, Augment> tmp(other, get_allocator());
+        swap_trees(tmp);
+    }
+    comp = other.comp;
+    return *this;
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::allocator_type set<T, Compare, Allocator, Threaded, Ranked, Augment>::get_allocator() const {
+    return allocator_type(alloc);
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::key_compare set<T, Compare, Allocator, Threaded, Ranked, Augment>::key_comp() const {
+    return comp;
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::value_compare set<T, Compare, Allocator, Threaded, Ranked, Augment>::value_comp() const {
+    return comp;
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::BaseNode *set<T, Compare, Allocator, Threaded, Ranked, Augment>::get_root_pointer() const {
+    return const_cast<set<T, Compare, Allocator, Threaded, Ranked, Augment>::Header*>(&root);
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::BaseNode* set<T, Compare, Allocator, Threaded, Ranked, Augment>::successor(BaseNode* node)
+{
+    return successor(node, threaded_tag());
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+template <typename N>
+N* set<T, Compare, Allocator, Threaded, Ranked, Augment>::successor(N* node, std::true_type)
+{
+    return node->next;
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::BaseNode* set<T, Compare, Allocator, Threaded, Ranked, Augment>::successor(BaseNode* node, std::false_type)
+{
+    if (node->right_child)
+    {
+        node = node->right_child;
+        while (node->left_child)
+            node = node->left_child;
+    }
+    else
+    {
+        while (node->parent->right_child == node)
+            node = node->parent;
+        node = node->parent;
+    }
+    return node;
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::BaseNode* set<T, Compare, Allocator, Threaded, Ranked, Augment>::predecessor(BaseNode* node)
+{
+    return predecessor(node, threaded_tag());
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+template <typename N>
+N* set<T, Compare, Allocator, Threaded, Ranked, Augment>::predecessor(N* node, std::true_type)
+{
+    return node->prev;
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+typename set<T, Compare, Allocator, Threaded, Ranked, Augment>::BaseNode* set<T, Compare, Allocator, Threaded, Ranked, Augment>::predecessor(BaseNode* node, std::false_type)
+{
+    // Из end() сразу в последний узел, без спуска по правому краю
+    if (!node->parent)
+        return static_cast<Header*>(node)->rightmost;
+    if (node->left_child)
+    {
+        node = node->left_child;
+        while (node->right_child)
+            node = node->right_child;
+    }
+    else
+    {
+        while (node->parent->left_child == node)
+            node = node->parent;
+        node = node->parent;
+    }
+    return node;
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+template <typename N>
+void set<T, Compare, Allocator, Threaded, Ranked, Augment>::thread_insert(N* node, bool to_left, std::true_type)
+{
+    // Новый лист в порядке обхода стоит прямо перед родителем, если он левый ребёнок,
+    // и прямо после родителя, если правый
+    N* parent = node->parent;
+    node->prev = to_left ? parent->prev : parent;
+    node->next = to_left ? parent : parent->next;
+    node->prev->next = node;
+    node->next->prev = node;
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+template <typename N>
+void set<T, Compare, Allocator, Threaded, Ranked, Augment>::thread_erase(N* first, N* last, std::true_type)
+{
+    // Исключает из списка узлы [first, last)
+    N* before = first->prev;
+    before->next = last;
+    last->prev = before;
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+template <typename H>
+void set<T, Compare, Allocator, Threaded, Ranked, Augment>::thread_nodes(H& header, std::true_type)
+{
+    // Прошивка заново всего дерева после построения целиком: O(n)
+    BaseNode* prev = &header;
+    for (BaseNode* node = header.leftmost; node != &header; node = successor(node, std::false_type()))
+    {
+        node->prev = prev;
+        prev->next = node;
+        prev = node;
+    }
+    close_threads(header, std::true_type());
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+template <typename H>
+void set<T, Compare, Allocator, Threaded, Ranked, Augment>::close_threads(H& header, std::true_type)
+{
+    header.next = header.leftmost;
+    header.leftmost->prev = &header;
+    header.prev = header.rightmost;
+    header.rightmost->next = &header;
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+void set<T, Compare, Allocator, Threaded, Ranked, Augment>::update_bounds()
+{
+    // Пересчёт leftmost и rightmost спуском по краям дерева после массовых изменений
+    root.leftmost = root.rightmost = get_root_pointer();
+    if (!root.left_child)
+        return;
+    root.leftmost = root.rightmost = root.left_child;
+    while (root.leftmost->left_child)
+        root.leftmost = root.leftmost->left_child;
+    while (root.rightmost->right_child)
+        root.rightmost = root.rightmost->right_child;
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+void swap(set<T, Compare, Allocator, Threaded, Ranked, Augment> &a, set<T, Compare, Allocator, Threaded, Ranked, Augment> &b)
+{
+    a.swap(b);
+}
+
+template <typename T, typename Compare, typename Allocator, bool Threaded, bool Ranked, typename Augment>
+set<T, Compare, Allocator, Threaded, Ranked, Augment> join(set<T, Compare, Allocator, Threaded, Ranked, Augment> left,
+                                                           set<T, Compare, Allocator, Threaded, Ranked, Augment> right)
+{
+    left.join(std::move(right));
+    return left;
 }
 
 #endif //MY_SET_H
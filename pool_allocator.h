@@ -0,0 +1,222 @@
+#ifndef POOL_ALLOCATOR_H
+#define POOL_ALLOCATOR_H
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+// Пул памяти для узлов: память нарезается из крупных слэбов подряд идущими
+// блоками, освобождённые блоки попадают в список свободных своего размера
+// и переиспользуются. Пул не потокобезопасен.
+class node_pool
+{
+    struct free_block
+    {
+        free_block* next;
+    };
+
+    struct size_class
+    {
+        free_block* free_list;
+        char* cursor;
+        char* end;
+    };
+
+    static const size_t granularity = alignof(std::max_align_t);
+    static const size_t max_pooled_size = 512;
+
+    size_t blocks_per_slab;
+    std::vector<size_class> classes;
+    std::vector<void*> slabs;
+
+    static size_t class_index(size_t bytes);
+
+public:
+    explicit node_pool(size_t blocks_per_slab = 256);
+    ~node_pool();
+
+    node_pool(node_pool const&) = delete;
+    node_pool& operator=(node_pool const&) = delete;
+
+    void* allocate(size_t bytes);
+    void deallocate(void* p, size_t bytes);
+
+    size_t slab_count() const;
+};
+
+template <typename T>
+class pool_allocator
+{
+    template <typename U>
+    friend class pool_allocator;
+
+    std::shared_ptr<node_pool> pool;
+
+public:
+    typedef T value_type;
+    typedef std::true_type propagate_on_container_copy_assignment;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    pool_allocator();
+    explicit pool_allocator(std::shared_ptr<node_pool> pool);
+
+    template <typename U>
+    pool_allocator(pool_allocator<U> const& other);
+    // Перемещение -- то же копирование: перемещённый аллокатор должен остаться
+    // равным новому, иначе контейнер, из которого переместили, нельзя использовать
+    pool_allocator(pool_allocator const& other);
+    pool_allocator(pool_allocator&& other) noexcept;
+    pool_allocator& operator=(pool_allocator const& other);
+
+    T* allocate(size_t n);
+    void deallocate(T* p, size_t n);
+
+    std::shared_ptr<node_pool> const& get_pool() const;
+
+    template <typename U>
+    bool operator==(pool_allocator<U> const& other) const;
+    template <typename U>
+    bool operator!=(pool_allocator<U> const& other) const;
+};
+
+
+/// NODE POOL IMPLEMENTATION =================================================================
+
+inline node_pool::node_pool(size_t blocks_per_slab)
+        : blocks_per_slab(blocks_per_slab ? blocks_per_slab : 1),
+          classes(max_pooled_size / granularity + 1, size_class{nullptr, nullptr, nullptr}),
+          slabs()
+{}
+
+inline node_pool::~node_pool()
+{
+    for (void* slab : slabs)
+        ::operator delete(slab);
+}
+
+inline size_t node_pool::class_index(size_t bytes)
+{
+    return (bytes + granularity - 1) / granularity;
+}
+
+inline void* node_pool::allocate(size_t bytes)
+{
+    if (bytes > max_pooled_size)
+        return ::operator new(bytes);
+
+    size_t index = class_index(bytes);
+    size_class& cls = classes[index];
+    if (cls.free_list)
+    {
+        free_block* block = cls.free_list;
+        cls.free_list = block->next;
+        return block;
+    }
+
+    size_t block_size = index * granularity;
+    if (cls.cursor == cls.end)
+    {
+        slabs.reserve(slabs.size() + 1);
+        char* slab = static_cast<char*>(::operator new(block_size * blocks_per_slab));
+        slabs.push_back(slab);
+        cls.cursor = slab;
+        cls.end = slab + block_size * blocks_per_slab;
+    }
+    void* result = cls.cursor;
+    cls.cursor += block_size;
+    return result;
+}
+
+inline void node_pool::deallocate(void* p, size_t bytes)
+{
+    if (bytes > max_pooled_size)
+    {
+        ::operator delete(p);
+        return;
+    }
+
+    size_class& cls = classes[class_index(bytes)];
+    free_block* block = static_cast<free_block*>(p);
+    block->next = cls.free_list;
+    cls.free_list = block;
+}
+
+inline size_t node_pool::slab_count() const
+{
+    return slabs.size();
+}
+
+/// POOL ALLOCATOR IMPLEMENTATION ============================================================
+
+template <typename T>
+pool_allocator<T>::pool_allocator()
+        : pool(std::make_shared<node_pool>())
+{}
+
+template <typename T>
+pool_allocator<T>::pool_allocator(std::shared_ptr<node_pool> pool)
+        : pool(std::move(pool))
+{}
+
+template <typename T>
+template <typename U>
+pool_allocator<T>::pool_allocator(pool_allocator<U> const& other)
+        : pool(other.pool)
+{}
+
+template <typename T>
+pool_allocator<T>::pool_allocator(pool_allocator const& other)
+        : pool(other.pool)
+{}
+
+template <typename T>
+pool_allocator<T>::pool_allocator(pool_allocator&& other) noexcept
+        : pool(other.pool)
+{}
+
+template <typename T>
+pool_allocator<T>& pool_allocator<T>::operator=(pool_allocator const& other)
+{
+    pool = other.pool;
+    return *this;
+}
+
+template <typename T>
+T* pool_allocator<T>::allocate(size_t n)
+{
+    static_assert(alignof(T) <= alignof(std::max_align_t), "over-aligned types are not supported");
+    if (n > static_cast<size_t>(-1) / sizeof(T))
+        throw std::bad_alloc();
+    return static_cast<T*>(pool->allocate(n * sizeof(T)));
+}
+
+template <typename T>
+void pool_allocator<T>::deallocate(T* p, size_t n)
+{
+    pool->deallocate(p, n * sizeof(T));
+}
+
+template <typename T>
+std::shared_ptr<node_pool> const& pool_allocator<T>::get_pool() const
+{
+    return pool;
+}
+
+template <typename T>
+template <typename U>
+bool pool_allocator<T>::operator==(pool_allocator<U> const& other) const
+{
+    return pool == other.pool;
+}
+
+template <typename T>
+template <typename U>
+bool pool_allocator<T>::operator!=(pool_allocator<U> const& other) const
+{
+    return pool != other.pool;
+}
+
+#endif //POOL_ALLOCATOR_H
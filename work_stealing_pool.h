@@ -0,0 +1,270 @@
+#ifndef WORK_STEALING_POOL_H
+#define WORK_STEALING_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Пул потоков с перехватом работы для параллельных алгоритмов fork-join.
+// У каждого потока пула своя очередь: свои задачи он берёт с конца (последние
+// порождённые, пока они горячие в кэше), чужие перехватывает с начала (самые
+// крупные). Задачи внешних потоков попадают в общую очередь.
+// Поток, ждущий task_group, не спит, а выполняет задачи из очередей
+class work_stealing_pool
+{
+    struct task_queue
+    {
+        std::mutex lock;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    struct worker_slot
+    {
+        work_stealing_pool const* pool;
+        size_t index;
+    };
+
+    // Очереди потоков пула и последней -- общая
+    std::vector<std::unique_ptr<task_queue>> queues;
+    std::vector<std::thread> workers;
+    std::atomic<size_t> queued;
+    std::mutex sleep_lock;
+    std::condition_variable wake;
+    bool stopping;
+
+    static worker_slot& current_slot();
+    size_t home_queue() const;
+    void push(std::function<void()> task);
+    bool run_one(size_t home);
+    void work(size_t index);
+
+public:
+    // Задачи, порождённые через spawn, и ожидание их завершения. Первое
+    // исключение из задач пробрасывается из wait
+    class task_group
+    {
+        work_stealing_pool& pool;
+        std::atomic<size_t> pending;
+        std::mutex error_lock;
+        std::exception_ptr error;
+
+    public:
+        explicit task_group(work_stealing_pool& pool);
+        ~task_group();
+
+        task_group(task_group const&) = delete;
+        task_group& operator=(task_group const&) = delete;
+
+        template <typename F>
+        void spawn(F f);
+        void wait();
+    };
+
+    // threads == 0 -- по числу ядер
+    explicit work_stealing_pool(unsigned threads = 0);
+    ~work_stealing_pool();
+
+    work_stealing_pool(work_stealing_pool const&) = delete;
+    work_stealing_pool& operator=(work_stealing_pool const&) = delete;
+
+    unsigned size() const;
+
+    // Пул по умолчанию для параллельных алгоритмов контейнеров
+    static work_stealing_pool& shared();
+};
+
+
+/// WORK STEALING POOL IMPLEMENTATION ========================================================
+
+inline work_stealing_pool::work_stealing_pool(unsigned threads)
+        : queues(),
+          workers(),
+          queued(0),
+          stopping(false)
+{
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned i = 0; i <= threads; i++)
+        queues.emplace_back(new task_queue());
+    try
+    {
+        for (unsigned i = 0; i < threads; i++)
+            workers.emplace_back(&work_stealing_pool::work, this, static_cast<size_t>(i));
+    }
+    catch (...)
+    {
+        {
+            std::lock_guard<std::mutex> guard(sleep_lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& worker : workers)
+            worker.join();
+        throw;
+    }
+}
+
+inline work_stealing_pool::~work_stealing_pool()
+{
+    // Потоки доделывают все поставленные задачи и выходят
+    {
+        std::lock_guard<std::mutex> guard(sleep_lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto& worker : workers)
+        worker.join();
+}
+
+inline unsigned work_stealing_pool::size() const
+{
+    return static_cast<unsigned>(workers.size());
+}
+
+inline work_stealing_pool& work_stealing_pool::shared()
+{
+    static work_stealing_pool pool;
+    return pool;
+}
+
+inline work_stealing_pool::worker_slot& work_stealing_pool::current_slot()
+{
+    static thread_local worker_slot slot = {nullptr, 0};
+    return slot;
+}
+
+inline size_t work_stealing_pool::home_queue() const
+{
+    worker_slot const& slot = current_slot();
+    return slot.pool == this ? slot.index : queues.size() - 1;
+}
+
+inline void work_stealing_pool::push(std::function<void()> task)
+{
+    task_queue& queue = *queues[home_queue()];
+    {
+        std::lock_guard<std::mutex> guard(queue.lock);
+        queue.tasks.push_back(std::move(task));
+    }
+    queued++;
+    {
+        // Спящий поток проверяет queued под sleep_lock, так что пробуждение не теряется
+        std::lock_guard<std::mutex> guard(sleep_lock);
+    }
+    wake.notify_one();
+}
+
+inline bool work_stealing_pool::run_one(size_t home)
+{
+    std::function<void()> task;
+    for (size_t i = 0; i < queues.size() && !task; i++)
+    {
+        task_queue& queue = *queues[(home + i) % queues.size()];
+        std::lock_guard<std::mutex> guard(queue.lock);
+        if (queue.tasks.empty())
+            continue;
+        if (i == 0)
+        {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+        }
+        else
+        {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+        }
+    }
+    if (!task)
+        return false;
+    queued--;
+    task();
+    return true;
+}
+
+inline void work_stealing_pool::work(size_t index)
+{
+    current_slot() = worker_slot{this, index};
+    while (true)
+    {
+        if (run_one(index))
+            continue;
+        std::unique_lock<std::mutex> guard(sleep_lock);
+        wake.wait(guard, [this]() { return stopping || queued > 0; });
+        if (stopping && queued == 0)
+            return;
+    }
+}
+
+/// TASK GROUP IMPLEMENTATION ================================================================
+
+inline work_stealing_pool::task_group::task_group(work_stealing_pool& pool)
+        : pool(pool),
+          pending(0),
+          error_lock(),
+          error()
+{}
+
+inline work_stealing_pool::task_group::~task_group()
+{
+    // Задачи ссылаются на группу, поэтому без их завершения её удалять нельзя
+    try
+    {
+        wait();
+    }
+    catch (...)
+    {}
+}
+
+template <typename F>
+void work_stealing_pool::task_group::spawn(F f)
+{
+    pending++;
+    try
+    {
+        pool.push([this, f]() mutable {
+            try
+            {
+                f();
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> guard(error_lock);
+                if (!error)
+                    error = std::current_exception();
+            }
+            pending--;
+        });
+    }
+    catch (...)
+    {
+        pending--;
+        throw;
+    }
+}
+
+inline void work_stealing_pool::task_group::wait()
+{
+    size_t home = pool.home_queue();
+    while (pending > 0)
+        if (!pool.run_one(home))
+            std::this_thread::yield();
+
+    std::exception_ptr result;
+    {
+        std::lock_guard<std::mutex> guard(error_lock);
+        std::swap(result, error);
+    }
+    if (result)
+        std::rethrow_exception(result);
+}
+
+#endif //WORK_STEALING_POOL_H